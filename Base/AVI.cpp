@@ -24,6 +24,7 @@
 #include "Frame.h"
 #include "Options.h"
 #include "Sound.h"
+#include "ZMBV.h"
 
 namespace AVI
 {
@@ -36,7 +37,7 @@ static FILE* f;
 static WORD width, height;
 static bool fHalfSize = false;
 
-static long lRiffPos, lMoviPos;
+static int64_t llRiffPos, llMoviPos;
 static long lVideoMax, lAudioMax;
 static DWORD dwVideoFrames, dwAudioFrames, dwAudioSamples;
 static bool fWantVideo;
@@ -44,6 +45,54 @@ static bool fWantVideo;
 // These hold the option settings during recording, so they can't change
 static int nAudioReduce = 0;
 static bool fScanlines = false;
+static int nCodec = 0;                      // 0=MS-RLE, 1=ZMBV
+static int nLevel = 0;                      // ZMBV compression level
+static BYTE abPalette[256 * 3];             // SAM colours then scanline colours, as RGB
+
+enum { CODEC_MRLE, CODEC_ZMBV };
+
+// OpenDML splits the movie into RIFF segments, each with its own chunk indices
+const int64_t SEGMENT_SIZE = 0x40000000;    // Start a new RIFF after 1GB, as recommended for compatibility
+const int MAX_SEGMENTS = 256;               // Super index entries reserved in the headers (256GB per file)
+
+typedef struct
+{
+    int64_t llPos;      // File offset of chunk data (after the header)
+    DWORD dwSize;       // Data size
+    BYTE bStream;       // 0=video, 1=audio
+    bool fKeyFrame;
+} INDEX_ENTRY;
+
+typedef struct
+{
+    int64_t llPos;      // File offset of the standard index chunk
+    DWORD dwSize;       // Standard index size, including chunk header
+    DWORD dwDuration;   // Stream ticks covered by the index
+} SUPER_INDEX_ENTRY;
+
+static int nSegment;                        // Current RIFF segment, 0 being the AVI RIFF
+static std::vector<INDEX_ENTRY> vIndex;     // Chunks in the current segment
+static std::vector<SUPER_INDEX_ENTRY> avSuperIndex[2];
+static DWORD dwFirstSegmentFrames, dwSegmentSamples;
+
+// 64-bit file positions, as OpenDML recordings can exceed 2GB
+static int64_t FileTell(FILE* f_)
+{
+#ifdef _MSC_VER
+    return _ftelli64(f_);
+#else
+    return ftello(f_);
+#endif
+}
+
+static bool FileSeek(FILE* f_, int64_t llOffset_, int nOrigin_ = SEEK_SET)
+{
+#ifdef _MSC_VER
+    return _fseeki64(f_, llOffset_, nOrigin_) == 0;
+#else
+    return fseeko(f_, llOffset_, nOrigin_) == 0;
+#endif
+}
 
 static bool WriteLittleEndianWORD(WORD w_)
 {
@@ -58,30 +107,27 @@ static bool WriteLittleEndianDWORD(DWORD dw_)
     fputc((dw_ >> 16) & 0xff, f);
     return fputc((dw_ >> 24) & 0xff, f) != EOF;
 }
-
-static bool WriteLittleEndianLong(long l_)
-{
-    return WriteLittleEndianDWORD(static_cast<DWORD>(l_));
-}
 
-static DWORD ReadLittleEndianDWORD()
+static bool WriteLittleEndianQWORD(uint64_t qw_)
 {
-    BYTE ab[4] = {};
-    if (fread(ab, 1, sizeof(ab), f) != sizeof(ab))
-        return 0;
+    WriteLittleEndianDWORD(static_cast<DWORD>(qw_));
+    return WriteLittleEndianDWORD(static_cast<DWORD>(qw_ >> 32));
+}
 
-    return (ab[3] << 24) | (ab[2] << 16) | (ab[1] << 8) | ab[0];
+static bool WriteLittleEndianLong(long l_)
+{
+    return WriteLittleEndianDWORD(static_cast<DWORD>(l_));
 }
 
-static long WriteChunkStart(FILE* f_, const char* pszChunk_, const char* pszType_ = nullptr)
+static int64_t WriteChunkStart(FILE* f_, const char* pszChunk_, const char* pszType_ = nullptr)
 {
     // Write the chunk type
     if (pszChunk_ && fwrite(pszChunk_, 1, 4, f_) != 4)
         return 0;
 
     // Remember the length offset, and skip the length field (to be completed by WriteChunkEnd)
-    long lPos = ftell(f_);
-    if (fseek(f_, sizeof(DWORD), SEEK_CUR) != 0)
+    int64_t llPos = FileTell(f_);
+    if (!FileSeek(f_, sizeof(DWORD), SEEK_CUR))
         return 0;
 
     // If we have a type, write that too
@@ -89,28 +135,28 @@ static long WriteChunkStart(FILE* f_, const char* pszChunk_, const char* pszType
         return 0;
 
     // Return the offset to the length, so it can be completed later using WriteChunkEnd
-    return lPos;
+    return llPos;
 }
 
-static long WriteChunkEnd(FILE* f_, long lPos_)
+static long WriteChunkEnd(FILE* f_, int64_t llPos_)
 {
     // Remember the current position, and calculate the chunk size (not including the length field)
-    long lPos = ftell(f_);
-    long lSize = lPos - lPos_ - sizeof(DWORD);
+    int64_t llPos = FileTell(f_);
+    long lSize = static_cast<long>(llPos - llPos_ - sizeof(DWORD));
 
     // Seek back to the length field
-    if (lPos_ < 0 || fseek(f_, lPos_, SEEK_SET) != 0)
+    if (llPos_ < 0 || !FileSeek(f_, llPos_))
         return 0;
 
     // Write the chunk size
     WriteLittleEndianLong(lSize);
 
     // Restore original position (should always be end of file, but we'll use the value from earlier)
-    if (lPos < 0 || fseek(f_, lPos, SEEK_SET) != 0)
+    if (llPos < 0 || !FileSeek(f_, llPos))
         return 0;
 
     // If the length was odd, pad file position to even boundary
-    if (lPos & 1)
+    if (llPos & 1)
     {
         fputc(0x00, f);
         lSize++;
@@ -120,9 +166,20 @@ static long WriteChunkEnd(FILE* f_, long lPos_)
     return lSize;
 }
 
+// Record a completed data chunk in the in-memory index, ahead of WriteChunkEnd
+static void IndexChunk(int64_t llPos_, BYTE bStream_, bool fKeyFrame_)
+{
+    INDEX_ENTRY entry;
+    entry.llPos = llPos_ + sizeof(DWORD);
+    entry.dwSize = static_cast<DWORD>(FileTell(f) - entry.llPos);
+    entry.bStream = bStream_;
+    entry.fKeyFrame = fKeyFrame_;
+    vIndex.push_back(entry);
+}
+
 static bool WriteAVIHeader(FILE* f_)
 {
-    long lPos = WriteChunkStart(f_, "avih");
+    int64_t llPos = WriteChunkStart(f_, "avih");
 
     // Should we include an audio stream?
     DWORD dwStreams = (nAudioReduce < 4) ? 2 : 1;
@@ -131,7 +188,7 @@ static bool WriteAVIHeader(FILE* f_)
     WriteLittleEndianLong((lVideoMax * EMULATED_FRAMES_PER_SECOND) + (lAudioMax * EMULATED_FRAMES_PER_SECOND)); // approximate max data rate
     WriteLittleEndianDWORD(0);              // reserved
     WriteLittleEndianDWORD((1 << 8) | (1 << 4)); // flags: bit 4 = has index(idx1), bit 5 = use index for AVI structure, bit 8 = interleaved file, bit 16 = optimized for live video capture, bit 17 = copyrighted data
-    WriteLittleEndianDWORD(dwVideoFrames);  // total number of video frames
+    WriteLittleEndianDWORD(dwFirstSegmentFrames); // number of video frames in the first RIFF (see dmlh for total)
     WriteLittleEndianDWORD(0);              // initial frame number for interleaved files
     WriteLittleEndianDWORD(dwStreams);      // number of streams in the file (video+audio)
     WriteLittleEndianDWORD(0);              // suggested buffer size for reading the file
@@ -142,14 +199,15 @@ static bool WriteAVIHeader(FILE* f_)
     WriteLittleEndianDWORD(0);
     WriteLittleEndianDWORD(0);
 
-    return WriteChunkEnd(f_, lPos) != 0;
+    return WriteChunkEnd(f_, llPos) != 0;
 }
 
 static bool WriteVideoHeader(FILE* f_)
 {
-    long lPos = WriteChunkStart(f_, "strh", "vids");
+    int64_t llPos = WriteChunkStart(f_, "strh", "vids");
 
-    fwrite("mrle", 4, 1, f);                // 'mrle' = Microsoft Run Length Encoding Video Codec
+    // 'mrle' = Microsoft Run Length Encoding Video Codec, 'ZMBV' = Zip Motion Blocks Video (DOSBox)
+    fwrite((nCodec == CODEC_ZMBV) ? "ZMBV" : "mrle", 4, 1, f);
     WriteLittleEndianDWORD(0);              // flags, unused
     WriteLittleEndianDWORD(0);              // priority and language, unused
     WriteLittleEndianDWORD(0);              // initial frames
@@ -165,14 +223,29 @@ static bool WriteVideoHeader(FILE* f_)
     WriteLittleEndianWORD(width);           // right
     WriteLittleEndianWORD(height);          // bottom
 
-    WriteChunkEnd(f_, lPos);
+    WriteChunkEnd(f_, llPos);
 
-    lPos = WriteChunkStart(f_, "strf");
+    llPos = WriteChunkStart(f_, "strf");
 
     WriteLittleEndianDWORD(40);             // sizeof(BITMAPINFOHEADER)
     WriteLittleEndianDWORD(width);          // biWidth;
     WriteLittleEndianDWORD(height);         // biHeight;
     WriteLittleEndianWORD(1);               // biPlanes;
+
+    // ZMBV carries its own palette in each key frame, and reports a true colour output format
+    if (nCodec == CODEC_ZMBV)
+    {
+        WriteLittleEndianWORD(24);          // biBitCount
+        fwrite("ZMBV", 4, 1, f);            // biCompression
+        WriteLittleEndianDWORD(width * height * 4); // biSizeImage;
+        WriteLittleEndianDWORD(0);          // biXPelsPerMeter;
+        WriteLittleEndianDWORD(0);          // biYPelsPerMeter;
+        WriteLittleEndianDWORD(0);          // biClrUsed;
+        WriteLittleEndianDWORD(0);          // biClrImportant;
+
+        return WriteChunkEnd(f_, llPos) != 0;
+    }
+
     WriteLittleEndianWORD(8);               // biBitCount (8 = 256 colours)
     WriteLittleEndianDWORD(1);              // biCompression (1 = BI_RLE8)
     WriteLittleEndianDWORD(width * height); // biSizeImage;
@@ -181,65 +254,70 @@ static bool WriteVideoHeader(FILE* f_)
     WriteLittleEndianDWORD(256);            // biClrUsed;
     WriteLittleEndianDWORD(0);              // biClrImportant;
 
-    const COLOUR* pcPal = IO::GetPalette();
-    int i;
-
-    // The first half of the palette contains SAM colours
-    for (i = 0; i < N_PALETTE_COLOURS; i++)
+    // SAM colours in the first half of the palette, scanline intensity in the second
+    for (int i = 0; i < 256; i++)
     {
         // Note: colour order is BGR
-        fputc(pcPal[i].bBlue, f);
-        fputc(pcPal[i].bGreen, f);
-        fputc(pcPal[i].bRed, f);
+        fputc(abPalette[i * 3 + 2], f);
+        fputc(abPalette[i * 3 + 1], f);
+        fputc(abPalette[i * 3 + 0], f);
         fputc(0, f);    // RGBQUAD has this as reserved (zero) rather than alpha
     }
 
+    return WriteChunkEnd(f_, llPos) != 0;
+}
+
+// Build the recording palette: SAM colours, followed by the same colours at scanline intensity
+static void PreparePalette()
+{
+    const COLOUR* pcPal = IO::GetPalette();
+
     // Determine the appropriate brightness adjustment for scanlines
     int nScanAdjust = GetOption(scanlevel) - 100;
     if (nScanAdjust < -100) nScanAdjust = -100;
 
-    // The second half of the palette contains colours in scanline intensity
-    for (i = 0; i < N_PALETTE_COLOURS; i++)
+    for (int i = 0; i < N_PALETTE_COLOURS; i++)
     {
         BYTE r = pcPal[i].bRed, g = pcPal[i].bGreen, b = pcPal[i].bBlue;
-        AdjustBrightness(r, g, b, nScanAdjust);
+        BYTE* pb = abPalette + i * 3;
+        pb[0] = r;
+        pb[1] = g;
+        pb[2] = b;
 
-        // Note: colour order is BGR
-        fputc(b, f);
-        fputc(g, f);
-        fputc(r, f);
-        fputc(0, f);    // RGBQUAD has this as reserved (zero) rather than alpha
+        AdjustBrightness(r, g, b, nScanAdjust);
+        pb += N_PALETTE_COLOURS * 3;
+        pb[0] = r;
+        pb[1] = g;
+        pb[2] = b;
     }
-
-    return WriteChunkEnd(f_, lPos) != 0;
 }
 
 static bool WriteAudioHeader(FILE* f_)
 {
-    long lPos = WriteChunkStart(f_, "strh", "auds");
+    int64_t llPos = WriteChunkStart(f_, "strh", "auds");
 
     // Default to normal sound parameters
-    WORD wFreq = SAMPLE_FREQ;
+    DWORD dwFreq = Sound::GetSampleFreq();
     WORD wBits = SAMPLE_BITS;
     WORD wBlock = SAMPLE_BLOCK;
     WORD wChannels = SAMPLE_CHANNELS;
 
     // 8-bit?
-    if (nAudioReduce >= 1)
+    if (nAudioReduce >= 1)
     {
-        wBits /= 2;
-        wBlock /= 2;
+        wBits /= 2;
+        wBlock /= 2;
     }
 
     // 22kHz?
     if (nAudioReduce >= 2)
-        wFreq /= 2;
+        dwFreq /= 2;
 
     // Mono?
-    if (nAudioReduce >= 3)
+    if (nAudioReduce >= 3)
     {
-        wChannels /= 2;
-        wBlock /= 2;
+        wChannels /= 2;
+        wBlock /= 2;
     }
 
 
@@ -248,7 +326,7 @@ static bool WriteAudioHeader(FILE* f_)
     WriteLittleEndianDWORD(0);              // priority and language, unused
     WriteLittleEndianDWORD(1);              // initial frames
     WriteLittleEndianDWORD(wBlock);         // scale
-    WriteLittleEndianDWORD(wFreq * wBlock); // rate
+    WriteLittleEndianDWORD(dwFreq * wBlock); // rate
     WriteLittleEndianDWORD(0);              // start time
     WriteLittleEndianDWORD(dwAudioSamples); // total samples in stream
     WriteLittleEndianLong(lAudioMax);       // suggested buffer size
@@ -257,107 +335,188 @@ static bool WriteAudioHeader(FILE* f_)
     WriteLittleEndianDWORD(0);              // two unused rect coords
     WriteLittleEndianDWORD(0);              // two more unused rect coords
 
-    WriteChunkEnd(f_, lPos);
+    WriteChunkEnd(f_, llPos);
 
-    lPos = WriteChunkStart(f_, "strf");
+    llPos = WriteChunkStart(f_, "strf");
 
     WriteLittleEndianWORD(1);               // format tag (1 = WAVE_FORMAT_PCM)
     WriteLittleEndianWORD(wChannels);       // channels
-    WriteLittleEndianDWORD(wFreq);          // samples per second
-    WriteLittleEndianDWORD(wFreq * wBlock); // average bytes per second
+    WriteLittleEndianDWORD(dwFreq);         // samples per second
+    WriteLittleEndianDWORD(dwFreq * wBlock); // average bytes per second
     WriteLittleEndianWORD(wBlock);          // block align
     WriteLittleEndianWORD(wBits);           // bits per sample
     WriteLittleEndianWORD(0);               // extra structure size
 
-    return WriteChunkEnd(f_, lPos) != 0;
+    return WriteChunkEnd(f_, llPos) != 0;
 }
 
-static bool WriteIndex(FILE* f_)
+// Write the OpenDML super index for a stream, which has a fixed size so the headers can be rewritten in place
+static bool WriteSuperIndex(FILE* f_, int nStream_)
 {
-    // The chunk index is the final addition
-    long lIdx1Pos = WriteChunkStart(f_, "idx1");
-    if (fseek(f, -4, SEEK_CUR) != 0)
-        return false;
+    const auto& vSuper = avSuperIndex[nStream_];
+    int64_t llPos = WriteChunkStart(f_, "indx");
+
+    WriteLittleEndianWORD(4);               // longs per entry
+    fputc(0x00, f);                         // index sub-type
+    fputc(0x00, f);                         // index type (0 = AVI_INDEX_OF_INDEXES)
+    WriteLittleEndianDWORD(static_cast<DWORD>(vSuper.size())); // entries in use
+    fwrite(nStream_ ? "01wb" : "00dc", 4, 1, f); // chunk id
+    WriteLittleEndianDWORD(0);              // 3 reserved DWORDs
+    WriteLittleEndianDWORD(0);
     WriteLittleEndianDWORD(0);
 
-    // Locate the start of the movi data (after the chunk header)
-    lMoviPos += 2 * sizeof(DWORD);
+    for (int i = 0; i < MAX_SEGMENTS; i++)
+    {
+        // Unused entries are zero
+        SUPER_INDEX_ENTRY entry{};
+        if (i < static_cast<int>(vSuper.size()))
+            entry = vSuper[i];
+
+        WriteLittleEndianQWORD(entry.llPos);    // offset of standard index chunk
+        WriteLittleEndianDWORD(entry.dwSize);   // size of standard index chunk
+        WriteLittleEndianDWORD(entry.dwDuration); // stream ticks covered
+    }
+
+    return WriteChunkEnd(f_, llPos) != 0;
+}
 
-    // Calculate the number of entries in the index
-    DWORD dwIndexEntries = dwVideoFrames + dwAudioFrames;
-    DWORD dwVideoFrame = 0;
+// Write the standard index of a stream's chunks in the current segment, adding it to the super index
+static bool WriteStandardIndex(FILE* f_, int nStream_)
+{
+    DWORD dwEntries = 0;
+    for (auto& entry : vIndex)
+        dwEntries += (entry.bStream == nStream_);
+
+    int64_t llPos = WriteChunkStart(f_, nStream_ ? "ix01" : "ix00");
+
+    WriteLittleEndianWORD(2);               // longs per entry
+    fputc(0x00, f);                         // index sub-type
+    fputc(0x01, f);                         // index type (1 = AVI_INDEX_OF_CHUNKS)
+    WriteLittleEndianDWORD(dwEntries);      // entries in use
+    fwrite(nStream_ ? "01wb" : "00dc", 4, 1, f); // chunk id
+    WriteLittleEndianQWORD(llMoviPos);      // base offset for entries
+    WriteLittleEndianDWORD(0);              // reserved
 
-    // Loop through all frames in the file
-    for (UINT u = 0; u < dwIndexEntries; u++)
+    for (auto& entry : vIndex)
     {
-        BYTE abType[4];
+        if (entry.bStream != nStream_)
+            continue;
 
-        if (fseek(f, lMoviPos, SEEK_SET) != 0)
-            return false;
+        // Offsets are to the chunk data, with bit 31 of the size set for delta frames
+        WriteLittleEndianDWORD(static_cast<DWORD>(entry.llPos - llMoviPos));
+        WriteLittleEndianDWORD(entry.dwSize | (entry.fKeyFrame ? 0 : 0x80000000));
+    }
 
-        // Read the type and size from the movi chunk
-        if (fread(abType, 1, sizeof(abType), f) != sizeof(abType))
-            return false;
+    long lSize = WriteChunkEnd(f_, llPos);
 
-        DWORD dwSize = ReadLittleEndianDWORD();
-        if (fseek(f, 0, SEEK_END) != 0)
-            return false;
+    SUPER_INDEX_ENTRY super;
+    super.llPos = llPos - sizeof(DWORD);
+    super.dwSize = static_cast<DWORD>(lSize + 2 * sizeof(DWORD));
+    super.dwDuration = nStream_ ? dwSegmentSamples : dwEntries;
+    avSuperIndex[nStream_].push_back(super);
 
-        // Every 50th frame is a key frame
-        bool fKeyFrame = (abType[1] == '0') && !(dwVideoFrame++ % EMULATED_FRAMES_PER_SECOND);
+    return lSize != 0;
+}
 
-        // Write the type
-        if (fwrite(abType, 1, sizeof(abType), f) != sizeof(abType))
-            return false;
+// Write the original AVI 1.0 index, for players that don't support OpenDML
+static bool WriteLegacyIndex(FILE* f_)
+{
+    int64_t llIdx1Pos = WriteChunkStart(f_, "idx1");
 
-        // Write flags, offset and size to the index
-        WriteLittleEndianDWORD(fKeyFrame ? 0x10 : 0x00);
-        WriteLittleEndianLong(lMoviPos);
-        WriteLittleEndianDWORD(dwSize);
+    // Offsets are relative to the 'movi' list type
+    int64_t llMoviBase = llMoviPos + sizeof(DWORD);
 
-        // Calculate next position, aligned to even boundary
-        lMoviPos += 2 * sizeof(DWORD) + ((dwSize + 1) & ~1);
+    for (auto& entry : vIndex)
+    {
+        fwrite(entry.bStream ? "01wb" : "00dc", 4, 1, f);
+        WriteLittleEndianDWORD(entry.fKeyFrame ? 0x10 : 0x00);
+        WriteLittleEndianDWORD(static_cast<DWORD>(entry.llPos - 2 * sizeof(DWORD) - llMoviBase));
+        WriteLittleEndianDWORD(entry.dwSize);
     }
 
-    // Complete the index and riff chunks
-    return WriteChunkEnd(f_, lIdx1Pos) != 0;
+    return WriteChunkEnd(f_, llIdx1Pos) != 0;
+}
+
+// Complete the current RIFF segment, using the in-memory index
+static bool CloseSegment(FILE* f_)
+{
+    // Standard indices live inside the movi list
+    bool fRet = WriteStandardIndex(f_, 0);
+    if (nAudioReduce < 4)
+        fRet &= WriteStandardIndex(f_, 1);
+
+    fRet &= WriteChunkEnd(f_, llMoviPos) != 0;
+
+    // The first segment also has an old-style index, for AVI 1.0 readers
+    if (!nSegment)
+    {
+        dwFirstSegmentFrames = dwVideoFrames;
+        fRet &= WriteLegacyIndex(f_);
+    }
+
+    fRet &= WriteChunkEnd(f_, llRiffPos) != 0;
+
+    vIndex.clear();
+    dwSegmentSamples = 0;
+    return fRet;
+}
+
+// Start an AVIX extension segment
+static bool OpenSegment(FILE* f_)
+{
+    nSegment++;
+    llRiffPos = WriteChunkStart(f_, "RIFF", "AVIX");
+    llMoviPos = WriteChunkStart(f_, "LIST", "movi");
+
+    return llMoviPos != 0;
 }
 
 static bool WriteFileHeaders(FILE* f_)
 {
-    if (fseek(f_, 0, SEEK_SET) != 0)
+    if (!FileSeek(f_, 0))
         return false;
 
-    lRiffPos = WriteChunkStart(f_, "RIFF", "AVI ");
-    long lHdrlPos = WriteChunkStart(f_, "LIST", "hdrl");
+    llRiffPos = WriteChunkStart(f_, "RIFF", "AVI ");
+    int64_t llHdrlPos = WriteChunkStart(f_, "LIST", "hdrl");
 
     WriteAVIHeader(f_);
 
-    long lPos = WriteChunkStart(f_, "LIST", "strl");
+    int64_t llPos = WriteChunkStart(f_, "LIST", "strl");
     WriteVideoHeader(f_);
-    WriteChunkEnd(f_, lPos);
+    WriteSuperIndex(f_, 0);
+    WriteChunkEnd(f_, llPos);
 
     if (nAudioReduce < 4)
     {
-        lPos = WriteChunkStart(f_, "LIST", "strl");
+        llPos = WriteChunkStart(f_, "LIST", "strl");
         WriteAudioHeader(f_);
-        WriteChunkEnd(f_, lPos);
+        WriteSuperIndex(f_, 1);
+        WriteChunkEnd(f_, llPos);
     }
 
-    lPos = WriteChunkStart(f_, "JUNK");
+    // OpenDML extended header, with the total frame count
+    llPos = WriteChunkStart(f_, "LIST", "odml");
+    int64_t llDmlhPos = WriteChunkStart(f_, "dmlh");
+    WriteLittleEndianDWORD(dwVideoFrames);
+    for (int i = 0; i < 61; i++)
+        WriteLittleEndianDWORD(0);          // reserved
+    WriteChunkEnd(f_, llDmlhPos);
+    WriteChunkEnd(f_, llPos);
+
+    llPos = WriteChunkStart(f_, "JUNK");
 
     // Align movi data to 2048-byte boundary
-    if (fseek(f_, (-ftell(f) - 3 * sizeof(DWORD)) & 0x3ff, SEEK_CUR) != 0)
+    if (!FileSeek(f_, (-FileTell(f_) - 3 * sizeof(DWORD)) & 0x3ff, SEEK_CUR))
         return false;
 
-    WriteChunkEnd(f_, lPos);
-    WriteChunkEnd(f_, lHdrlPos);
+    WriteChunkEnd(f_, llPos);
+    WriteChunkEnd(f_, llHdrlPos);
 
     // Start of movie data
-    lMoviPos = WriteChunkStart(f_, "LIST", "movi");
+    llMoviPos = WriteChunkStart(f_, "LIST", "movi");
 
     // Check last write succeeded
-    return lMoviPos != 0;
+    return llMoviPos != 0;
 }
 
 
@@ -466,6 +625,230 @@ static void EncodeBlock(BYTE* pb_, int nLength_)
 }
 
 
+// Encode a frame as MS-RLE, relative to the previous frame unless it's a key frame
+static void EncodeMRLE(const BYTE* pbFrame_, bool fKeyFrame_)
+{
+    int x, nFrag, nJump = 0, nJumpX = 0, nJumpY = 0;
+
+    for (int y = height - 1; y > 0; y--)
+    {
+        BYTE* pbLine = const_cast<BYTE*>(pbFrame_) + (width * y);
+        BYTE* pb = pbLine, * pbP = pbCurr + (width * y);
+
+        for (x = 0; x < width; )
+        {
+            // Use the full width as a different fragment if this is a key frame
+            // otherwise find the next section different from the previous frame
+            nFrag = fKeyFrame_ ? width : FindRunFragment(pb, pbP, width - x, &nJump);
+
+            // If we've nothing to encode, advance by the jump block
+            if (!nFrag)
+            {
+                nJumpX += nJump;
+
+                x += nJump;
+                pb += nJump;
+                pbP += nJump;
+
+                continue;
+            }
+
+            // Convert negative jumps to positive jumps on the following line
+            if (nJumpX < 0)
+            {
+                fputc(0x00, f); // escape
+                fputc(0x00, f); // eol
+
+                nJumpX = x;
+                nJumpY--;
+            }
+
+            // Completely process the jump, positioning us ready for the data
+            while (nJumpX | nJumpY)
+            {
+                int ndX = std::min(nJumpX, 255), ndY = std::min(nJumpY, 255);
+
+                fputc(0x00, f); // escape
+                fputc(0x02, f); // jump
+                fputc(ndX, f);  // dx
+                fputc(ndY, f);  // dy
+
+                nJumpX -= ndX;
+                nJumpY -= ndY;
+            }
+
+            // Encode the fragment
+            EncodeBlock(pb, nFrag);
+
+            // Advance by the size of the fragment
+            x += nFrag;
+            pb += nFrag;
+            pbP += nFrag;
+        }
+
+        // Update our copy of the frame line
+        memcpy(pbCurr + (width * y), pbLine, width);
+
+        // Jump to the next line
+        nJumpY++;
+        nJumpX -= x;
+    }
+
+    fputc(0x00, f); // escape
+    fputc(0x01, f); // eoi
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Chunk waiting to be written by the encoder thread
+typedef struct
+{
+    BYTE bStream;               // 0=video, 1=audio
+    std::vector<BYTE> vbData;   // Captured frame (empty to repeat the previous frame), or audio data
+    UINT uSamples;              // Audio samples in the chunk
+} AVI_CHUNK;
+
+const int MAX_QUEUED_FRAMES = 8;    // Video frames waiting to be encoded, before repeats are used instead
+const size_t MAX_QUEUED_CHUNKS = EMULATED_FRAMES_PER_SECOND * 2;   // Chunks waiting to be written, before recording waits
+
+static std::queue<AVI_CHUNK> qPending;
+static std::vector<std::vector<BYTE>> vFreeFrames, vFreeAudio;
+
+static std::thread thWorker;
+static std::mutex mtxQueue;
+static std::condition_variable cvQueue, cvFree;
+static bool fQuit;
+static std::atomic<bool> fVolumeFull;
+
+#ifdef HAVE_LIBZ
+static CZMBVEncoder* pZMBV;
+#endif
+static std::vector<BYTE> vbEncoded;
+static int nSinceKeyFrame;
+static DWORD dwEncodeTime;
+
+// Write a video frame chunk (encoder thread)
+static void WriteVideoChunk(const AVI_CHUNK& chunk_)
+{
+    // Start a new RIFF segment when the current one is full
+    if (FileTell(f) - llRiffPos >= SEGMENT_SIZE)
+    {
+        // If the super index is full, ask for a continuation volume
+        if (static_cast<int>(avSuperIndex[0].size()) >= MAX_SEGMENTS - 1)
+            fVolumeFull = true;
+        else
+        {
+            CloseSegment(f);
+            OpenSegment(f);
+        }
+    }
+
+    const BYTE* pbFrame = chunk_.vbData.empty() ? nullptr : chunk_.vbData.data();
+
+    // Set regular key frames, which encode the full frame (MS-RLE every second, ZMBV less often)
+    int nKeyInterval = (nCodec == CODEC_ZMBV) ? EMULATED_FRAMES_PER_SECOND * 6 : EMULATED_FRAMES_PER_SECOND;
+    bool fKeyFrame = pbFrame && (!dwVideoFrames || ++nSinceKeyFrame >= nKeyInterval);
+    if (fKeyFrame)
+        nSinceKeyFrame = 0;
+
+    DWORD dwStart = OSD::GetTime();
+
+    // Start of frame chunk
+    int64_t llPos = WriteChunkStart(f, "00dc");
+
+#ifdef HAVE_LIBZ
+    if (pZMBV)
+    {
+        vbEncoded.clear();
+        pZMBV->EncodeFrame(vbEncoded, pbFrame, abPalette, fKeyFrame);
+        fwrite(vbEncoded.data(), 1, vbEncoded.size(), f);
+    }
+    else
+#endif
+    if (pbFrame)
+        EncodeMRLE(pbFrame, fKeyFrame);
+    else
+    {
+        fputc(0x00, f); // escape
+        fputc(0x01, f); // eoi
+    }
+
+    // Complete frame chunk
+    IndexChunk(llPos, 0, fKeyFrame);
+    long lSize = WriteChunkEnd(f, llPos);
+    dwVideoFrames++;
+
+    dwEncodeTime += OSD::GetTime() - dwStart;
+
+    // Track the maximum video data size
+    if (lSize > lVideoMax)
+        lVideoMax = lSize;
+}
+
+// Write an audio chunk (encoder thread)
+static void WriteAudioChunk(const AVI_CHUNK& chunk_)
+{
+    int64_t llPos = WriteChunkStart(f, "01wb");
+    fwrite(chunk_.vbData.data(), chunk_.vbData.size(), 1, f);
+    IndexChunk(llPos, 1, true);
+    long lSize = WriteChunkEnd(f, llPos);
+
+    // Update counters
+    dwAudioSamples += chunk_.uSamples;
+    dwSegmentSamples += chunk_.uSamples;
+    dwAudioFrames++;
+
+    // Track the maximum audio data size
+    if (lSize > lAudioMax)
+        lAudioMax = lSize;
+}
+
+static void WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(mtxQueue);
+
+    for (;;)
+    {
+        cvQueue.wait(lock, [] { return fQuit || !qPending.empty(); });
+
+        // Finish any queued chunks before quitting
+        if (qPending.empty())
+            break;
+
+        AVI_CHUNK chunk = std::move(qPending.front());
+        qPending.pop();
+        lock.unlock();
+
+        if (chunk.bStream == 0)
+            WriteVideoChunk(chunk);
+        else
+            WriteAudioChunk(chunk);
+
+        lock.lock();
+
+        // Return the data buffer to its pool
+        if (chunk.bStream == 1)
+            vFreeAudio.push_back(std::move(chunk.vbData));
+        else if (!chunk.vbData.empty())
+            vFreeFrames.push_back(std::move(chunk.vbData));
+
+        cvFree.notify_one();
+    }
+}
+
+static void QueueChunk(AVI_CHUNK&& chunk_)
+{
+    std::unique_lock<std::mutex> lock(mtxQueue);
+
+    // Wait rather than let the queue grow without limit if the disk can't keep up
+    cvFree.wait(lock, [] { return qPending.size() < MAX_QUEUED_CHUNKS; });
+
+    qPending.push(std::move(chunk_));
+    cvQueue.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool Start(bool fHalfSize_)
 {
     if (f)
@@ -482,9 +865,17 @@ bool Start(bool fHalfSize_)
         return false;
     }
 
-    // Reset the frame counters
+    // Reset the frame counters and index
     dwVideoFrames = dwAudioFrames = dwAudioSamples = 0;
+    dwFirstSegmentFrames = dwSegmentSamples = 0;
     lVideoMax = lAudioMax = 0;
+    nSegment = 0;
+    vIndex.clear();
+    avSuperIndex[0].clear();
+    avSuperIndex[1].clear();
+    nSinceKeyFrame = 0;
+    dwEncodeTime = 0;
+    fVolumeFull = false;
 
     // Set the size and flag we want a video frame first
     fHalfSize = fHalfSize_;
@@ -493,11 +884,19 @@ bool Start(bool fHalfSize_)
     // Set scanline mode for the recording (low-res only)
     fScanlines = GetOption(scanlines) && !GetOption(scanhires) && GetOption(aviscanlines);
 
-#if SAMPLE_FREQ == 44100 && SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
+#if SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
     // Set the audio reduction level
     nAudioReduce = GetOption(avireduce);
 #endif
 
+    // Select the video codec, which needs zlib for ZMBV
+#ifdef HAVE_LIBZ
+    nCodec = GetOption(avicodec) ? CODEC_ZMBV : CODEC_MRLE;
+#else
+    nCodec = CODEC_MRLE;
+#endif
+    nLevel = GetOption(avilevel);
+
     Frame::SetStatus("Recording AVI");
     return true;
 }
@@ -508,32 +907,55 @@ void Stop()
     if (!f)
         return;
 
-    // Silence the sound in case index generation is slow
-    Sound::Silence();
+    // Wait for the encoder to write any queued chunks
+    if (thWorker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxQueue);
+            fQuit = true;
+        }
+
+        cvQueue.notify_one();
+        thWorker.join();
+    }
 
-    // Complete the movi chunk, add the index, and complete the RIFF
-    WriteChunkEnd(f, lMoviPos);
-    WriteIndex(f);
-    WriteChunkEnd(f, lRiffPos);
+    // Write the indices for the final segment from memory, and complete the RIFF
+    CloseSegment(f);
 
     // Write the completed file headers
     WriteFileHeaders(f);
 
     // Seek to end before closing
-    if (fseek(f, 0, SEEK_END) != 0)
+    if (!FileSeek(f, 0, SEEK_END))
         TRACE("!!! AVI::Stop(): Failed to seek to end of recording\n");
 
+    // Report the data rate and encoding cost
+    int64_t llSize = FileTell(f);
+    DWORD dwSeconds = dwVideoFrames / EMULATED_FRAMES_PER_SECOND;
+    double dMBPerMin = dwSeconds ? (llSize / 1048576.0) * 60 / dwSeconds : 0.0;
+    TRACE("AVI: %s, %u frames, %.1fMB/min, %.2fms/frame encode\n", (nCodec == CODEC_ZMBV) ? "ZMBV" : "MS-RLE",
+        dwVideoFrames, dMBPerMin, dwVideoFrames ? static_cast<double>(dwEncodeTime) / dwVideoFrames : 0.0);
+
     // Close the recording
     fclose(f);
     f = nullptr;
 
-    // Free current frame data
+    // Free current frame data, index and encoder
     delete[] pbCurr; pbCurr = nullptr;
+    std::vector<INDEX_ENTRY>().swap(vIndex);
+    vFreeFrames.clear();
+    vFreeAudio.clear();
+#ifdef HAVE_LIBZ
+    delete pZMBV; pZMBV = nullptr;
+#endif
 
     // Free resample buffer
     delete[] pbResample; pbResample = nullptr;
 
-    Frame::SetStatus("Saved %s", pszFile);
+    if (dMBPerMin)
+        Frame::SetStatus("Saved %s (%.1fMB/min)", pszFile, dMBPerMin);
+    else
+        Frame::SetStatus("Saved %s", pszFile);
 }
 
 void Toggle(bool fHalfSize_)
@@ -553,147 +975,94 @@ bool IsRecording()
 // Add a video frame to the file
 void AddFrame(CScreen* pScreen_)
 {
-    DWORD size;
-
     // Ignore if we're not recording or we're expecting audio
     if (!f || !fWantVideo)
         return;
 
-    // Old-style AVI has a 2GB size limit, so restart if we're within 1MB of that
-    if (ftell(f) >= 0x7ff00000)
+    // Restart for a continuation volume if the encoder has filled the super index
+    if (fVolumeFull)
     {
         Stop();
 
-        // Restart for a continuation volume
         if (!Start(fHalfSize))
             return;
     }
 
     // Start of file?
-    if (ftell(f) == 0)
+    if (!thWorker.joinable())
     {
         // Store the dimensions, and allocate+invalidate the frame copy
         width = pScreen_->GetPitch() >> (fHalfSize ? 1 : 0);
         height = pScreen_->GetHeight() >> (fHalfSize ? 1 : 0);
-        size = (DWORD)width * (DWORD)height;
+        DWORD size = (DWORD)width * (DWORD)height;
         pbCurr = new BYTE[size];
         memset(pbCurr, 0xff, size);
 
+#ifdef HAVE_LIBZ
+        if (nCodec == CODEC_ZMBV)
+        {
+            pZMBV = new CZMBVEncoder(width, height, nLevel);
+            if (!pZMBV->IsValid())
+            {
+                delete pZMBV; pZMBV = nullptr;
+                nCodec = CODEC_MRLE;
+            }
+        }
+#endif
+
         // Write the placeholder file headers
+        PreparePalette();
         WriteFileHeaders(f);
-    }
-
-    // Set a key frame once per second, which encodes the full frame
-    bool fKeyFrame = !(dwVideoFrames % EMULATED_FRAMES_PER_SECOND);
 
-    // Start of frame chunk
-    long lPos = WriteChunkStart(f, "00dc");
+        // Fill the frame pool and start the encoder
+        vFreeFrames.assign(MAX_QUEUED_FRAMES, std::vector<BYTE>(size));
+        fQuit = false;
+        thWorker = std::thread(WorkerThread);
+    }
 
-    int x, nFrag, nJump = 0, nJumpX = 0, nJumpY = 0;
+    AVI_CHUNK chunk;
+    chunk.bStream = 0;
+    chunk.uSamples = 0;
 
-    for (int y = height - 1; y > 0; y--)
     {
-        BYTE* pbLine = pScreen_->GetLine(y >> (fHalfSize ? 0 : 1));
-        static BYTE abLine[WIDTH_PIXELS * 2];
-
-        // Is the recording low-res?
-        if (fHalfSize)
-        {
-            // Decide if we should sample the odd pixel for mode 3 lines
-            if (GetOption(mode3))
-                pbLine++;
-
-            // Use only half the pixels for a low-res line
-            for (int i = 0; i < width; i++)
-                abLine[i] = pbLine[i * 2];
-
-            pbLine = abLine;
-        }
-
-        // If this is a scanline, adjust the pixel values to use the 2nd palette section
-        if (fScanlines && !fHalfSize && (y & 1))
+        // If the encoder is behind, repeat the previous frame rather than wait for it
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        if (!vFreeFrames.empty())
         {
-            // It's no problem if pbLine is already pointing to abLine
-            DWORD* pdwS = (DWORD*)pbLine, * pdwD = (DWORD*)abLine;
-
-            // Set bit 7 of each colour, in 4-pixels blocks
-            for (int i = 0; i < width; i += sizeof(DWORD))
-                *pdwD++ = *pdwS++ | 0x80808080;
-
-            pbLine = abLine;
+            chunk.vbData = std::move(vFreeFrames.back());
+            vFreeFrames.pop_back();
         }
+    }
 
-        BYTE* pb = pbLine, * pbP = pbCurr + (width * y);
+    if (!chunk.vbData.empty())
+    {
+        // Decide if we should sample the odd pixel for mode 3 lines
+        int nMode3 = GetOption(mode3) ? 1 : 0;
 
-        for (x = 0; x < width; )
+        for (int y = 0; y < height; y++)
         {
-            // Use the full width as a different fragment if this is a key frame
-            // otherwise find the next section different from the previous frame
-            nFrag = fKeyFrame ? width : FindRunFragment(pb, pbP, width - x, &nJump);
+            BYTE* pbLine = pScreen_->GetLine(y >> (fHalfSize ? 0 : 1));
+            BYTE* pb = chunk.vbData.data() + width * y;
 
-            // If we've nothing to encode, advance by the jump block
-            if (!nFrag)
+            // Is the recording low-res?
+            if (fHalfSize)
             {
-                nJumpX += nJump;
-
-                x += nJump;
-                pb += nJump;
-                pbP += nJump;
-
-                continue;
+                // Use only half the pixels for a low-res line
+                for (int i = 0; i < width; i++)
+                    pb[i] = pbLine[i * 2 + nMode3];
             }
-
-            // Convert negative jumps to positive jumps on the following line
-            if (nJumpX < 0)
+            // If this is a scanline, adjust the pixel values to use the 2nd palette section
+            else if (fScanlines && (y & 1))
             {
-                fputc(0x00, f); // escape
-                fputc(0x00, f); // eol
-
-                nJumpX = x;
-                nJumpY--;
+                for (int i = 0; i < width; i++)
+                    pb[i] = pbLine[i] | 0x80;
             }
-
-            // Completely process the jump, positioning us ready for the data
-            while (nJumpX | nJumpY)
-            {
-                int ndX = std::min(nJumpX, 255), ndY = std::min(nJumpY, 255);
-
-                fputc(0x00, f); // escape
-                fputc(0x02, f); // jump
-                fputc(ndX, f);  // dx
-                fputc(ndY, f);  // dy
-
-                nJumpX -= ndX;
-                nJumpY -= ndY;
-            }
-
-            // Encode the fragment
-            EncodeBlock(pb, nFrag);
-
-            // Advance by the size of the fragment
-            x += nFrag;
-            pb += nFrag;
-            pbP += nFrag;
+            else
+                memcpy(pb, pbLine, width);
         }
-
-        // Update our copy of the frame line
-        memcpy(pbCurr + (width * y), pbLine, width);
-
-        // Jump to the next line
-        nJumpY++;
-        nJumpX -= x;
     }
 
-    fputc(0x00, f); // escape
-    fputc(0x01, f); // eoi
-
-    // Complete frame chunk
-    long lSize = WriteChunkEnd(f, lPos);
-    dwVideoFrames++;
-
-    // Track the maximum video data size
-    if (lSize > lVideoMax)
-        lVideoMax = lSize;
+    QueueChunk(std::move(chunk));
 
     // Want audio next, if enabled
     fWantVideo = (nAudioReduce >= 4);
@@ -725,17 +1094,17 @@ void AddFrame(const BYTE* pb_, UINT uLen_)
         if (nAudioReduce >= 2)
         {
             // If the last sample count was odd, skip the first sample
-            if (fOddLast)
+            if (fOddLast)
             {
-                pb_ += uBlock;
-                uSamples--;
+                pb_ += uBlock;
+                uSamples--;
             }
 
             // If the current sample count is odd, include the final sample
-            if (uSamples & 1)
+            if (uSamples & 1)
             {
-                fOddLast = true;
-                uSamples++;
+                fOddLast = true;
+                uSamples++;
             }
 
             // 22kHz drops half the samples
@@ -776,18 +1145,22 @@ void AddFrame(const BYTE* pb_, UINT uLen_)
         uLen_ = static_cast<UINT>(pbNew - pbResample);
     }
 
-    // Write the audio chunk
-    long lPos = WriteChunkStart(f, "01wb");
-    fwrite(pb_, uLen_, 1, f);
-    long lSize = WriteChunkEnd(f, lPos);
+    // Queue the audio chunk, reusing a pooled buffer if one is free
+    AVI_CHUNK chunk;
+    chunk.bStream = 1;
 
-    // Update counters
-    dwAudioSamples += uSamples;
-    dwAudioFrames++;
+    {
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        if (!vFreeAudio.empty())
+        {
+            chunk.vbData = std::move(vFreeAudio.back());
+            vFreeAudio.pop_back();
+        }
+    }
 
-    // Track the maximum audio data size
-    if (lSize > lAudioMax)
-        lAudioMax = lSize;
+    chunk.vbData.assign(pb_, pb_ + uLen_);
+    chunk.uSamples = uSamples;
+    QueueChunk(std::move(chunk));
 
     // Want video next
     fWantVideo = true;
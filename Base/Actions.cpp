@@ -31,6 +31,7 @@
 #include "Input.h"
 #include "Options.h"
 #include "Parallel.h"
+#include "Pipe.h"
 #include "Sound.h"
 #include "Tape.h"
 #include "UI.h"
@@ -122,8 +123,9 @@ bool Do(Action action, bool pressed/*=true*/)
             break;
 
         case Action::SaveFloppy1:
-            if (pFloppy1->HasDisk() && pFloppy1->DiskModified() && pFloppy1->Save())
-                Frame::SetStatus("%s  changes saved", pFloppy1->DiskFile());
+            // The outcome is reported once the save completes
+            if (pFloppy1->HasDisk() && pFloppy1->DiskModified() && !pFloppy1->Save())
+                Frame::SetStatus("Failed to save changes to %s", pFloppy1->DiskFile());
             break;
 
         case Action::InsertFloppy2:
@@ -142,8 +144,9 @@ bool Do(Action action, bool pressed/*=true*/)
             break;
 
         case Action::SaveFloppy2:
-            if (pFloppy2->HasDisk() && pFloppy2->DiskModified() && pFloppy2->Save())
-                Frame::SetStatus("%s  changes saved", pFloppy2->DiskFile());
+            // The outcome is reported once the save completes
+            if (pFloppy2->HasDisk() && pFloppy2->DiskModified() && !pFloppy2->Save())
+                Frame::SetStatus("Failed to save changes to %s", pFloppy2->DiskFile());
             break;
 
         case Action::NewDisk1:
@@ -283,6 +286,18 @@ bool Do(Action action, bool pressed/*=true*/)
             AVI::Stop();
             break;
 
+        case Action::RecordPipe:
+            Pipe::Toggle(false);
+            break;
+
+        case Action::RecordPipeHalf:
+            Pipe::Toggle(true);
+            break;
+
+        case Action::RecordPipeStop:
+            Pipe::Stop();
+            break;
+
         case Action::SpeedFaster:
             switch (GetOption(speed))
             {
@@ -429,6 +444,9 @@ std::string to_string(Action action)
         { Action::TapeInsert, "Insert Tape" },
         { Action::TapeEject, "Eject Tape" },
         { Action::TapeBrowser, "Tape Browser" },
+        { Action::RecordPipe, "Record raw video/audio" },
+        { Action::RecordPipeHalf, "Record raw half-size" },
+        { Action::RecordPipeStop, "Stop raw recording" },
     };
 
     auto it = action_descs.find(action);
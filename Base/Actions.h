@@ -31,7 +31,7 @@ enum class Action
     FlushPrinter, About, Minimise, RecordGif, RecordGifLoop, RecordGifStop,
     RecordWav, RecordWavSegment, RecordWavStop, RecordAvi, RecordAviHalf,
     RecordAviStop, SpeedFaster, SpeedSlower, SpeedNormal, Paste, TapeInsert,
-    TapeEject, TapeBrowser
+    TapeEject, TapeBrowser, RecordPipe, RecordPipeHalf, RecordPipeStop
 };
 
 namespace Actions
@@ -9,6 +9,14 @@
 #include <stdlib.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -403,3 +411,187 @@ void Blip_Buffer::mix_samples(blip_sample_t const* in, long count)
     }
     *out -= prev;
 }
+
+// Blip_Stereo_Buffer
+
+Blip_Stereo_Buffer::~Blip_Stereo_Buffer()
+{
+    free(buffer_);
+}
+
+void Blip_Stereo_Buffer::clear()
+{
+    offset_ = 0;
+    reader_accum[0] = reader_accum[1] = 0;
+    if (buffer_)
+        memset(buffer_, 0, (buffer_size_ + buffer_extra) * 2 * sizeof * buffer_);
+}
+
+Blip_Stereo_Buffer::blargg_err_t Blip_Stereo_Buffer::set_sample_rate(long new_rate, int msec)
+{
+    long new_size = (new_rate * (msec + 1) + 999) / 1000;
+
+    if (buffer_size_ != new_size)
+    {
+        void* p = realloc(buffer_, (new_size + buffer_extra) * 2 * sizeof * buffer_);
+        if (!p)
+            return "Out of memory";
+        buffer_ = (int*)p;
+    }
+
+    buffer_size_ = new_size;
+    sample_rate_ = new_rate;
+    if (clock_rate_)
+        clock_rate(clock_rate_);
+    bass_freq(bass_freq_);
+
+    clear();
+
+    return 0; // success
+}
+
+void Blip_Stereo_Buffer::clock_rate(long cps)
+{
+    clock_rate_ = cps;
+    double ratio = (double)sample_rate_ / clock_rate_;
+    factor_ = (unsigned long)floor(ratio * (1L << BLIP_BUFFER_ACCURACY) + 0.5);
+}
+
+void Blip_Stereo_Buffer::bass_freq(int freq)
+{
+    bass_freq_ = freq;
+    int shift = 31;
+    if (freq > 0)
+    {
+        shift = 13;
+        long f = (freq << 16) / sample_rate_;
+        while ((f >>= 1) && --shift) {}
+    }
+    bass_shift = shift;
+}
+
+void Blip_Stereo_Buffer::end_frame(blip_time_t t)
+{
+    offset_ += t * factor_;
+    assert(samples_avail() <= (long)buffer_size_); // time outside buffer length
+}
+
+long Blip_Stereo_Buffer::count_samples(blip_time_t t) const
+{
+    unsigned long last_sample = resampled_time(t) >> BLIP_BUFFER_ACCURACY;
+    unsigned long first_sample = offset_ >> BLIP_BUFFER_ACCURACY;
+    return (long)(last_sample - first_sample);
+}
+
+void Blip_Stereo_Buffer::remove_samples(long count)
+{
+    if (count)
+    {
+        assert(count <= samples_avail()); // tried to remove more samples than available
+        offset_ -= (blip_resampled_time_t)count << BLIP_BUFFER_ACCURACY;
+
+        // copy remaining samples to beginning and clear old samples
+        long remain = samples_avail() + buffer_extra;
+        memmove(buffer_, buffer_ + count * 2, remain * 2 * sizeof * buffer_);
+        memset(buffer_ + remain * 2, 0, count * 2 * sizeof * buffer_);
+    }
+}
+
+template<int width>
+void Blip_Stereo_Buffer::add_kernel(blip_resampled_time_t time, const int* kernel, int delta_left, int delta_right)
+{
+    int* out = buffer_ + ((time >> BLIP_BUFFER_ACCURACY) + (blip_widest_impulse_ - width) / 2) * 2;
+    int i = 0;
+
+#if defined(USE_SSE2)
+    if ((blip_sample_t)delta_left == delta_left && (blip_sample_t)delta_right == delta_right)
+    {
+        // taps and deltas fit in the low half of each lane, for a single multiply-add
+        __m128i delta = _mm_set_epi32(delta_right & 0xffff, delta_left & 0xffff,
+            delta_right & 0xffff, delta_left & 0xffff);
+        for (; i + 4 <= width * 2; i += 4)
+        {
+            __m128i k = _mm_loadu_si128((const __m128i*)(kernel + i));
+            __m128i o = _mm_loadu_si128((const __m128i*)(out + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi32(o, _mm_madd_epi16(k, delta)));
+        }
+    }
+#elif defined(USE_NEON)
+    int32x2_t pair = vset_lane_s32(delta_right, vdup_n_s32(delta_left), 1);
+    int32x4_t delta = vcombine_s32(pair, pair);
+    for (; i + 4 <= width * 2; i += 4)
+        vst1q_s32(out + i, vmlaq_s32(vld1q_s32(out + i), vld1q_s32(kernel + i), delta));
+#endif
+
+    for (; i < width * 2; i += 2)
+    {
+        out[i] += kernel[i] * delta_left;
+        out[i + 1] += kernel[i + 1] * delta_right;
+    }
+}
+
+template void Blip_Stereo_Buffer::add_kernel<blip_med_quality>(blip_resampled_time_t, const int*, int, int);
+template void Blip_Stereo_Buffer::add_kernel<blip_good_quality>(blip_resampled_time_t, const int*, int, int);
+template void Blip_Stereo_Buffer::add_kernel<blip_high_quality>(blip_resampled_time_t, const int*, int, int);
+
+long Blip_Stereo_Buffer::read_samples(blip_sample_t* out, long max_samples)
+{
+    long count = samples_avail();
+    if (count > max_samples)
+        count = max_samples;
+
+    if (count)
+    {
+        int const sample_shift = blip_sample_bits - 16;
+        const int* in = buffer_;
+
+#if defined(USE_SSE2)
+        // both channels integrated together in the low pair of lanes
+        __m128i accum = _mm_loadl_epi64((const __m128i*)reader_accum);
+        __m128i shift = _mm_cvtsi32_si128(bass_shift);
+        for (long n = count; n--; in += 2, out += 2)
+        {
+            __m128i s = _mm_srai_epi32(accum, sample_shift);
+            accum = _mm_sub_epi32(accum, _mm_sra_epi32(accum, shift));
+            accum = _mm_add_epi32(accum, _mm_loadl_epi64((const __m128i*)in));
+
+            int pair = _mm_cvtsi128_si32(_mm_packs_epi32(s, s));
+            memcpy(out, &pair, sizeof(pair));
+        }
+        _mm_storel_epi64((__m128i*)reader_accum, accum);
+#elif defined(USE_NEON)
+        int32x2_t accum = vld1_s32(reader_accum);
+        int32x2_t shift = vdup_n_s32(-bass_shift);
+        for (long n = count; n--; in += 2, out += 2)
+        {
+            int32x2_t s = vshr_n_s32(accum, sample_shift);
+            accum = vsub_s32(accum, vshl_s32(accum, shift));
+            accum = vadd_s32(accum, vld1_s32(in));
+            vst1_lane_s32((int32_t*)out, vreinterpret_s32_s16(vqmovn_s32(vcombine_s32(s, s))), 0);
+        }
+        vst1_s32(reader_accum, accum);
+#else
+        int accum_left = reader_accum[0], accum_right = reader_accum[1];
+        for (long n = count; n--; in += 2, out += 2)
+        {
+            int s_left = accum_left >> sample_shift;
+            int s_right = accum_right >> sample_shift;
+            accum_left += in[0] - (accum_left >> bass_shift);
+            accum_right += in[1] - (accum_right >> bass_shift);
+            out[0] = (blip_sample_t)s_left;
+            out[1] = (blip_sample_t)s_right;
+
+            // clamp samples
+            if ((blip_sample_t)s_left != s_left)
+                out[0] = (blip_sample_t)(0x7FFF - (s_left >> 24));
+            if ((blip_sample_t)s_right != s_right)
+                out[1] = (blip_sample_t)(0x7FFF - (s_right >> 24));
+        }
+        reader_accum[0] = accum_left;
+        reader_accum[1] = accum_right;
+#endif
+
+        remove_samples(count);
+    }
+    return count;
+}
@@ -220,6 +220,81 @@ private:
     friend class Blip_Synth_;
 };
 
+// Stereo pair of buffers sharing a single time frame, holding the left and right
+// values of each sample together so both channels are synthesized and read in one
+// pass. Interface matches Blip_Buffer, except read_samples() always interleaves.
+class Blip_Stereo_Buffer {
+public:
+    typedef const char* blargg_err_t;
+
+    blargg_err_t set_sample_rate(long samples_per_sec, int msec_length = 1000 / 4);
+    void clock_rate(long);
+    void end_frame(blip_time_t time);
+
+    // Read at most 'max_samples' stereo samples into 'dest' as left/right pairs.
+    // Returns number of samples actually read and removed.
+    long read_samples(blip_sample_t* dest, long max_samples);
+
+    long sample_rate() const { return sample_rate_; }
+    void bass_freq(int frequency);
+    void clear();
+    long samples_avail() const { return (long)(offset_ >> BLIP_BUFFER_ACCURACY); }
+    void remove_samples(long count);
+    long count_samples(blip_time_t duration) const;
+
+    typedef unsigned long blip_resampled_time_t;
+    blip_resampled_time_t resampled_time(blip_time_t t) const { return t * factor_ + offset_; }
+
+    // Add 'width' pairs of kernel taps, scaled by the left and right deltas, in one pass
+    template<int width>
+    void add_kernel(blip_resampled_time_t time, const int* kernel, int delta_left, int delta_right);
+public:
+    Blip_Stereo_Buffer() = default;
+    ~Blip_Stereo_Buffer();
+private:
+    // noncopyable
+    Blip_Stereo_Buffer(const Blip_Stereo_Buffer&);
+    Blip_Stereo_Buffer& operator = (const Blip_Stereo_Buffer&);
+public:
+    unsigned long factor_ = 0;
+    blip_resampled_time_t offset_ = 0;
+    int* buffer_ = nullptr;             // left/right pairs
+    long buffer_size_ = 0;
+private:
+    int reader_accum[2]{};
+    int bass_shift = 0;
+    long sample_rate_ = 0;
+    long clock_rate_ = 0;
+    int bass_freq_ = 16;
+};
+
+// Synth for a pair of waveforms output to a Blip_Stereo_Buffer. The kernel for each
+// phase is expanded with each tap repeated for both channels, so a transition on
+// either or both channels is added to the buffer in a single pass.
+template<int quality, int range>
+class Blip_Stereo_Synth {
+public:
+    void volume(double v) { impl.volume_unit(v * (1.0 / (range < 0 ? -range : range))); build_kernels(); }
+    void treble_eq(blip_eq_t const& eq) { impl.treble_eq(eq); build_kernels(); }
+    void output(Blip_Stereo_Buffer* b) { buf = b; last_left = last_right = 0; }
+
+    // Update amplitudes of both waveforms at given time
+    void update(blip_time_t time, int left, int right);
+
+    // Add amplitude transitions of specified deltas
+    void offset(blip_time_t, int delta_left, int delta_right) const;
+
+public:
+    Blip_Stereo_Synth() : impl(impulses, quality) { }
+private:
+    short impulses[blip_res * (quality / 2) + 1];
+    Blip_Synth_ impl;
+    Blip_Stereo_Buffer* buf = nullptr;
+    int last_left = 0, last_right = 0;
+    int kernels[blip_res][quality * 2]{};
+    void build_kernels();
+};
+
 int const blip_sample_bits = 30;
 
 // Optimized inline sample reader for custom sample formats and mixing of Blip_Buffer samples
@@ -327,6 +402,63 @@ void Blip_Synth<quality, range>::update(blip_time_t t, int amp)
     offset_resampled(t * impl.buf->factor_ + impl.buf->offset_, delta, impl.buf);
 }
 
+template<int quality, int range>
+void Blip_Stereo_Synth<quality, range>::build_kernels()
+{
+    // same taps as offset_resampled(), in buffer order
+    int const half = quality / 2;
+    for (int phase = 0; phase < blip_res; phase++)
+    {
+        int* k = kernels[phase];
+        for (int i = 0; i < half; i++)
+        {
+            k[i * 2] = k[i * 2 + 1] = impulses[blip_res - phase + blip_res * i];
+            k[(half + i) * 2] = k[(half + i) * 2 + 1] = impulses[phase + blip_res * (half - 1 - i)];
+        }
+    }
+}
+
+template<int quality, int range>
+void Blip_Stereo_Synth<quality, range>::offset(blip_time_t t, int delta_left, int delta_right) const
+{
+    blip_resampled_time_t time = t * buf->factor_ + buf->offset_;
+    assert((long)(time >> BLIP_BUFFER_ACCURACY) < buf->buffer_size_);
+    int phase = (int)(time >> (BLIP_BUFFER_ACCURACY - BLIP_PHASE_BITS) & (blip_res - 1));
+
+    // a change to one side only touches its own taps, leaving the other side's independent
+    if (!delta_left || !delta_right)
+    {
+        int const side = !delta_left;
+        int const delta = (delta_left + delta_right) * impl.delta_factor;
+        int* out = buf->buffer_ + ((time >> BLIP_BUFFER_ACCURACY) + (blip_widest_impulse_ - quality) / 2) * 2 + side;
+        const int* kernel = kernels[phase] + side;
+        for (int i = 0; i < quality * 2; i += 8)
+        {
+            int t0 = out[i] + kernel[i] * delta;
+            int t1 = out[i + 2] + kernel[i + 2] * delta;
+            int t2 = out[i + 4] + kernel[i + 4] * delta;
+            int t3 = out[i + 6] + kernel[i + 6] * delta;
+            out[i] = t0;
+            out[i + 2] = t1;
+            out[i + 4] = t2;
+            out[i + 6] = t3;
+        }
+        return;
+    }
+
+    buf->template add_kernel<quality>(time, kernels[phase], delta_left * impl.delta_factor, delta_right * impl.delta_factor);
+}
+
+template<int quality, int range>
+void Blip_Stereo_Synth<quality, range>::update(blip_time_t t, int left, int right)
+{
+    int delta_left = left - last_left;
+    int delta_right = right - last_right;
+    last_left = left;
+    last_right = right;
+    offset(t, delta_left, delta_right);
+}
+
 inline blip_eq_t::blip_eq_t(double t) :
     treble(t), rolloff_freq(0), sample_rate(44100), cutoff_freq(0) { }
 inline blip_eq_t::blip_eq_t(double t, long rf, long sr, long cf) :
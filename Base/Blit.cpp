@@ -0,0 +1,185 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Blit.cpp: Palette conversion of SAM display lines to native pixel formats
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  The display line converters are the hottest loops on the video side, so
+//  x86 builds select an AVX2 gather kernel at run-time when the CPU and OS
+//  support it, falling back on the portable scalar code otherwise.
+//
+//  A pshufb (SSSE3) lookup was considered, but it only indexes 16 entries
+//  per register and the SAM palette has 128 colours in 4 byte planes, which
+//  needs far more registers than are available.
+
+#include "SimCoupe.h"
+#include "Blit.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define USE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Blit
+{
+
+typedef void (*PFNLINE)(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_);
+
+static void Line16Scalar(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    for (int x = 0; x < nWidth_; x += 2)
+    {
+        DWORD dw = (pdwPalette_[pb_[x + 1]] << 16) | pdwPalette_[pb_[x]];
+#ifdef __BIG_ENDIAN__
+        dw = ((dw << 24) & 0xff000000) | ((dw << 8) & 0x00ff0000) | ((dw >> 8) & 0x0000ff00) | ((dw >> 24) & 0x000000ff);
+#endif
+        *pdw_++ = dw;
+    }
+}
+
+static void Line32Scalar(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    for (int x = 0; x < nWidth_; x += 8)
+    {
+        pdw_[0] = pdwPalette_[pb_[0]];
+        pdw_[1] = pdwPalette_[pb_[1]];
+        pdw_[2] = pdwPalette_[pb_[2]];
+        pdw_[3] = pdwPalette_[pb_[3]];
+        pdw_[4] = pdwPalette_[pb_[4]];
+        pdw_[5] = pdwPalette_[pb_[5]];
+        pdw_[6] = pdwPalette_[pb_[6]];
+        pdw_[7] = pdwPalette_[pb_[7]];
+
+        pdw_ += 8;
+        pb_ += 8;
+    }
+}
+
+#ifdef USE_AVX2
+
+TARGET_AVX2
+static void Line16AVX2(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    auto pnPalette = reinterpret_cast<const int*>(pdwPalette_);
+    int x = 0;
+
+    // 16 pixels per pass, gathered as 32-bit values then packed to 16-bit
+    for (; x + 16 <= nWidth_; x += 16)
+    {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb_ + x));
+        __m256i lo = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(idx), 4);
+        __m256i hi = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)), 4);
+
+        // Packing works within 128-bit lanes, so restore the pixel order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_ + (x >> 1)), packed);
+    }
+
+    if (x < nWidth_)
+        Line16Scalar(pdw_ + (x >> 1), pb_ + x, nWidth_ - x, pdwPalette_);
+}
+
+TARGET_AVX2
+static void Line32AVX2(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    auto pnPalette = reinterpret_cast<const int*>(pdwPalette_);
+    int x = 0;
+
+    // 16 pixels per pass, as two 8-pixel gathers
+    for (; x + 16 <= nWidth_; x += 16)
+    {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb_ + x));
+        __m256i lo = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(idx), 4);
+        __m256i hi = _mm256_i32gather_epi32(pnPalette, _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)), 4);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_ + x), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pdw_ + x + 8), hi);
+    }
+
+    if (x < nWidth_)
+        Line32Scalar(pdw_ + x, pb_ + x, nWidth_ - x, pdwPalette_);
+}
+
+static bool HasAVX2()
+{
+#ifdef _MSC_VER
+    int anRegs[4];
+    __cpuid(anRegs, 0);
+    if (anRegs[0] < 7)
+        return false;
+
+    // OSXSAVE and AVX, with the OS saving the YMM state
+    __cpuid(anRegs, 1);
+    if ((anRegs[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(anRegs, 7, 0);
+    return (anRegs[1] & 0x20) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // USE_AVX2
+
+
+static PFNLINE pfnLine16, pfnLine32;
+
+static void SelectKernels()
+{
+    pfnLine16 = Line16Scalar;
+    pfnLine32 = Line32Scalar;
+    const char* pcszKernel = "scalar";
+
+#ifdef USE_AVX2
+    if (HasAVX2())
+    {
+        pfnLine16 = Line16AVX2;
+        pfnLine32 = Line32AVX2;
+        pcszKernel = "AVX2";
+    }
+#endif
+
+    TRACE("Blit: using %s palette conversion\n", pcszKernel);
+}
+
+
+void Line16(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    if (!pfnLine16)
+        SelectKernels();
+
+    pfnLine16(pdw_, pb_, nWidth_, pdwPalette_);
+}
+
+void Line32(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    if (!pfnLine32)
+        SelectKernels();
+
+    pfnLine32(pdw_, pb_, nWidth_, pdwPalette_);
+}
+
+} // namespace Blit
@@ -0,0 +1,28 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Blit.h: Palette conversion of SAM display lines to native pixel formats
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+namespace Blit
+{
+// Convert nWidth_ palette indices to 16-bit pixels (little-endian pairs), or 32-bit pixels
+void Line16(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_);
+void Line32(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_);
+}
@@ -20,6 +20,12 @@
 
 // Notes:
 //  The CFloppyDisk implementation is OS-specific, and is in Floppy.cpp
+//
+//  Image saves copy the data to write and queue it for a save thread, so
+//  saving never stalls emulation. Rewrites go to a temporary file that
+//  replaces the image only once it's complete and flushed to disk, and
+//  in-place sector updates are flushed before the save is reported. The
+//  outcome of each save is passed to the callback from CompleteSaves().
 
 #include "SimCoupe.h"
 #include "Disk.h"
@@ -28,6 +34,150 @@
 #include "Floppy.h"
 #include "Util.h"
 
+// Image data waiting to be written by the save thread
+typedef struct
+{
+    CDisk* pDisk;               // Disk being saved, or nullptr once it's been closed
+    CStream* pStream;           // Stream to write to
+    std::string strFile;        // Display name of the image
+    bool fRewrite;              // Replace the stream contents, rather than updating them in place
+    bool fDeleteStream;         // Disk has been closed, so the stream is ours to delete
+    bool fSuccess;              // Save result, once complete
+    size_t uWritten;            // Bytes of image data written
+    std::vector<std::pair<size_t, std::vector<BYTE>>> vBlocks;  // File offsets and data
+} DISK_SAVE;
+
+static std::thread thSave;
+static std::mutex mtxSave;
+static std::condition_variable cvSave, cvSaved;
+static std::deque<DISK_SAVE*> dqSaves;
+static std::vector<DISK_SAVE*> vSaved;  // Completed saves, waiting to be reported
+static DISK_SAVE* pSaving;              // Save currently being written
+static bool fQuitSave;
+static PFNSAVEDPROC pfnSaved;
+
+static void SaveThread()
+{
+    std::unique_lock<std::mutex> lock(mtxSave);
+
+    for (;;)
+    {
+        // Wait for a save, finishing the queue before quitting
+        cvSave.wait(lock, [] { return fQuitSave || !dqSaves.empty(); });
+        if (dqSaves.empty())
+            break;
+
+        pSaving = dqSaves.front();
+        dqSaves.pop_front();
+        lock.unlock();
+
+        CStream* pStream = pSaving->pStream;
+        bool fSuccess = !pSaving->fRewrite || pStream->Rewind();
+        size_t uWritten = 0;
+
+        for (auto& block : pSaving->vBlocks)
+        {
+            size_t uLen = block.second.size();
+            fSuccess = fSuccess && (pSaving->fRewrite ? pStream->Write(block.second.data(), uLen) == uLen :
+                pStream->Update(block.first, block.second.data(), uLen));
+
+            if (fSuccess)
+                uWritten += uLen;
+        }
+
+        // Commit the new data, or discard a partial rewrite
+        if (fSuccess)
+            fSuccess = pStream->Commit();
+        else
+            pStream->Close();
+
+        if (fSuccess)
+            TRACE("Saved %s (%u bytes written)\n", pSaving->strFile.c_str(), static_cast<UINT>(uWritten));
+        else
+            TRACE("!!! SaveThread(): failed to save %s\n", pSaving->strFile.c_str());
+
+        pSaving->fSuccess = fSuccess;
+        pSaving->uWritten = uWritten;
+        std::vector<std::pair<size_t, std::vector<BYTE>>>().swap(pSaving->vBlocks);
+
+        lock.lock();
+
+        if (pSaving->fDeleteStream)
+            delete pStream;
+
+        pSaving->pStream = nullptr;
+        vSaved.push_back(pSaving);
+        pSaving = nullptr;
+        cvSaved.notify_all();
+    }
+}
+
+static DISK_SAVE* NewSave(CDisk* pDisk_, CStream* pStream_, bool fRewrite_)
+{
+    return new DISK_SAVE{ pDisk_, pStream_, pStream_->GetFile(), fRewrite_, false, false, 0, {} };
+}
+
+static void QueueSave(DISK_SAVE* pSave_)
+{
+    std::lock_guard<std::mutex> lock(mtxSave);
+
+    // Start the save thread on first use
+    if (!thSave.joinable())
+    {
+        fQuitSave = false;
+        thSave = std::thread(SaveThread);
+    }
+
+    dqSaves.push_back(pSave_);
+    cvSave.notify_one();
+}
+
+// Detach a closed disk from its saves, leaving the save thread to delete the stream if it's still needed
+static void ReleaseDisk(CDisk* pDisk_, CStream* pStream_)
+{
+    std::lock_guard<std::mutex> lock(mtxSave);
+    DISK_SAVE* pLast = nullptr;
+
+    for (auto pSave : vSaved)
+    {
+        if (pSave->pDisk == pDisk_)
+            pSave->pDisk = nullptr;
+    }
+
+    if (pSaving && pSaving->pDisk == pDisk_)
+    {
+        pSaving->pDisk = nullptr;
+        pLast = pSaving;
+    }
+
+    for (auto pSave : dqSaves)
+    {
+        if (pSave->pDisk == pDisk_)
+        {
+            pSave->pDisk = nullptr;
+            pLast = pSave;
+        }
+    }
+
+    if (pLast)
+        pLast->fDeleteStream = true;
+    else
+        delete pStream_;
+}
+
+// Wait for any queued saves to the given path to be written
+static void WaitForSave(const char* pcszPath_)
+{
+    std::unique_lock<std::mutex> lock(mtxSave);
+
+    cvSaved.wait(lock, [&] {
+        if (pSaving && !strcmp(pSaving->pStream->GetPath(), pcszPath_))
+            return false;
+
+        return std::none_of(dqSaves.begin(), dqSaves.end(), [&](DISK_SAVE* p) { return !strcmp(p->pStream->GetPath(), pcszPath_); });
+    });
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 /*static*/ int CDisk::GetType(CStream* pStream_)
@@ -62,6 +212,10 @@
 {
     CDisk* pDisk = nullptr;
 
+    // Don't read an image that's still being saved
+    if (pcszDisk_)
+        WaitForSave(pcszDisk_);
+
     // Fetch stream for the disk source
     CStream* pStream = CStream::Open(pcszDisk_, fReadOnly_);
 
@@ -92,6 +246,53 @@
     return pStream ? new CFileDisk(pStream) : nullptr;
 }
 
+// Set the function used to report the outcome of each save
+/*static*/ void CDisk::SetSaveCallback(PFNSAVEDPROC pfn_)
+{
+    pfnSaved = pfn_;
+}
+
+// Report saves finished by the save thread, leaving failed disks to be saved again in full
+/*static*/ void CDisk::CompleteSaves()
+{
+    std::vector<DISK_SAVE*> vDone;
+    {
+        std::lock_guard<std::mutex> lock(mtxSave);
+        vDone.swap(vSaved);
+    }
+
+    for (auto pSave : vDone)
+    {
+        if (!pSave->fSuccess && pSave->pDisk)
+        {
+            pSave->pDisk->m_fRewrite = true;
+            pSave->pDisk->SetModified();
+        }
+
+        if (pfnSaved)
+            pfnSaved(pSave->strFile.c_str(), pSave->fSuccess, pSave->uWritten);
+
+        delete pSave;
+    }
+}
+
+// Complete any queued saves and stop the save thread
+/*static*/ void CDisk::WaitForSaves()
+{
+    if (thSave.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxSave);
+            fQuitSave = true;
+        }
+
+        cvSave.notify_one();
+        thSave.join();
+    }
+
+    CompleteSaves();
+}
+
 
 CDisk::CDisk(CStream* pStream_, int nType_)
     : m_nType(nType_), m_nBusy(0), m_fModified(false), m_pStream(pStream_), m_pbData(nullptr)
@@ -101,8 +302,94 @@ CDisk::CDisk(CStream* pStream_, int nType_)
 CDisk::~CDisk()
 {
     // Delete the stream object and disk data memory we allocated
-    delete m_pStream;
-    delete[] m_pbData;
+    ReleaseDisk(this, m_pStream);
+
+    if (!m_fMapped)
+        delete[] m_pbData;
+}
+
+
+// Map an uncompressed image, so sectors aren't read until they're used
+bool CDisk::MapImage(size_t uSize_, UINT uBlockSize_)
+{
+    if (m_pStream->GetSize() != uSize_ || !(m_pbData = m_pStream->Map()))
+        return false;
+
+    m_fMapped = true;
+    m_fRewrite = false;
+    m_uBlockSize = uBlockSize_;
+    m_vDirty.assign((uSize_ + uBlockSize_ - 1) / uBlockSize_, false);
+
+    // Release the stream, which was only needed for identification
+    m_pStream->Close();
+    return true;
+}
+
+// Switch a mapped image to a private copy, so the file can be replaced by a full rewrite
+void CDisk::UnmapImage(size_t uSize_)
+{
+    BYTE* pb = new BYTE[uSize_];
+    memcpy(pb, m_pbData, uSize_);
+
+    m_pStream->Unmap();
+    m_pbData = pb;
+    m_fMapped = false;
+    std::vector<bool>().swap(m_vDirty);
+}
+
+// Flag part of a mapped image as needing to be saved
+void CDisk::SetDirty(size_t uOffset_, size_t uLen_)
+{
+    if (m_fMapped && uLen_)
+        std::fill(m_vDirty.begin() + uOffset_ / m_uBlockSize, m_vDirty.begin() + (uOffset_ + uLen_ - 1) / m_uBlockSize + 1, true);
+}
+
+// Queue a save of a flat image, with just the modified blocks of a mapped image
+bool CDisk::SaveImage(size_t uSize_)
+{
+    if (IsReadOnly())
+        return false;
+
+    // A full rewrite replaces the file, which can't be done on Windows while it's mapped
+    if (m_fRewrite && m_fMapped)
+        UnmapImage(uSize_);
+
+    DISK_SAVE* pSave = NewSave(this, m_pStream, m_fRewrite);
+
+    if (m_fRewrite)
+        pSave->vBlocks.emplace_back(0, std::vector<BYTE>(m_pbData, m_pbData + uSize_));
+    else
+    {
+        for (size_t i = 0; i < m_vDirty.size(); )
+        {
+            // Skip unmodified blocks
+            if (!m_vDirty[i])
+            {
+                i++;
+                continue;
+            }
+
+            // Find the end of this run of modified blocks
+            size_t j = i;
+            while (j < m_vDirty.size() && m_vDirty[j])
+                j++;
+
+            size_t uOffset = i * m_uBlockSize;
+            size_t uLen = std::min(j * m_uBlockSize, uSize_) - uOffset;
+            pSave->vBlocks.emplace_back(uOffset, std::vector<BYTE>(m_pbData + uOffset, m_pbData + uOffset + uLen));
+
+            i = j;
+        }
+    }
+
+    QueueSave(pSave);
+
+    // Only a mapped image can be updated in place next time
+    std::fill(m_vDirty.begin(), m_vDirty.end(), false);
+    m_fRewrite = !m_fMapped;
+    SetModified(false);
+
+    return true;
 }
 
 
@@ -142,6 +429,14 @@ bool CDisk::GetSector(BYTE cyl_, BYTE head_, BYTE index_, IDFIELD* pID_/*=nullpt
 CMGTDisk::CMGTDisk(CStream* pStream_, UINT uSectors_/*=NORMAL_DISK_SECTORS*/)
     : CDisk(pStream_, dtMGT)
 {
+    // Map an existing image rather than reading it all up front
+    if (pStream_->IsOpen() && MapImage(pStream_->GetSize(), NORMAL_SECTOR_SIZE))
+    {
+        // If it's an MS-DOS image, treat as 9 sectors-per-track, otherwise 10 as normal for SAM
+        m_uSectors = (pStream_->GetSize() == DOS_IMAGE_SIZE) ? DOS_DISK_SECTORS : NORMAL_DISK_SECTORS;
+        return;
+    }
+
     // Allocate some memory and clear it, just in case it's not a complete MGT image
     m_pbData = new BYTE[MGT_IMAGE_SIZE];
     memset(m_pbData, (uSectors_ == NORMAL_DISK_SECTORS) ? 0x00 : 0xe5, MGT_IMAGE_SIZE);
@@ -206,6 +501,7 @@ BYTE CMGTDisk::WriteData(BYTE cyl_, BYTE head_, BYTE index_, BYTE* pbData_, UINT
 
     // Copy the sector data to the image buffer, and set the modified flag
     memcpy(m_pbData + lPos, pbData_, *puSize_ = NORMAL_SECTOR_SIZE);
+    SetDirty(lPos, NORMAL_SECTOR_SIZE);
     SetModified();
 
     // Data is always perfect on MGT images, so return OK
@@ -216,15 +512,7 @@ BYTE CMGTDisk::WriteData(BYTE cyl_, BYTE head_, BYTE index_, BYTE* pbData_, UINT
 bool CMGTDisk::Save()
 {
     size_t uSize = NORMAL_DISK_SIDES * NORMAL_DISK_TRACKS * m_uSectors * NORMAL_SECTOR_SIZE;
-
-    // Write the image out as a single block
-    if (!m_pStream->Rewind() || m_pStream->Write(m_pbData, uSize) != uSize)
-        return false;
-
-    m_pStream->Close();
-    SetModified(false);
-
-    return true;
+    return SaveImage(uSize);
 }
 
 // Format a track using the specified format
@@ -265,6 +553,7 @@ BYTE CMGTDisk::FormatTrack(BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbData
     for (u = 0; u < uSectors_; u++)
         memcpy(m_pbData + lPos + ((paID_[u].bSector - 1) * NORMAL_SECTOR_SIZE), papbData_[u], NORMAL_SECTOR_SIZE);
 
+    SetDirty(lPos, uSectors_ * NORMAL_SECTOR_SIZE);
     SetModified();
     return 0;
 }
@@ -275,8 +564,8 @@ BYTE CMGTDisk::FormatTrack(BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbData
 {
     SAD_HEADER sh{};
 
-    // Read the header, check for the signature, and make sure the disk geometry is sensible
-    bool fValid = (pStream_->Rewind() && pStream_->Read(&sh, sizeof(sh)) == sizeof(sh) &&
+    // Check the header signature, and make sure the disk geometry is sensible
+    bool fValid = (pStream_->GetHeader(&sh, sizeof(sh)) == sizeof(sh) &&
         !memcmp(sh.abSignature, SAD_SIGNATURE, sizeof(sh.abSignature)) &&
         sh.bSides && sh.bSides <= MAX_DISK_SIDES && sh.bTracks && sh.bTracks <= 127 &&
         sh.bSectorSizeDiv64 && (sh.bSectorSizeDiv64 <= (MAX_SECTOR_SIZE >> 6)) &&
@@ -316,6 +605,11 @@ CSADDisk::CSADDisk(CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT u
     m_uSectorSize = sh.bSectorSizeDiv64 << 6;
 
     UINT uDiskSize = sizeof(sh) + m_uSides * m_uTracks * m_uSectors * m_uSectorSize;
+
+    // Map an existing image rather than reading it all up front
+    if (pStream_->IsOpen() && MapImage(uDiskSize, m_uSectorSize))
+        return;
+
     memcpy(m_pbData = new BYTE[uDiskSize], &sh, sizeof(sh));
     memset(m_pbData + sizeof(sh), 0, uDiskSize - sizeof(sh));
 
@@ -366,6 +660,7 @@ BYTE CSADDisk::WriteData(BYTE cyl_, BYTE head_, BYTE index_, BYTE* pbData_, UINT
 
     // Copy the sector data to the image buffer, and set the modified flag
     memcpy(m_pbData + lPos, pbData_, *puSize_ = m_uSectorSize);
+    SetDirty(lPos, m_uSectorSize);
     SetModified();
 
     // Data is always perfect on SAD images, so return OK
@@ -376,13 +671,7 @@ BYTE CSADDisk::WriteData(BYTE cyl_, BYTE head_, BYTE index_, BYTE* pbData_, UINT
 bool CSADDisk::Save()
 {
     UINT uDiskSize = sizeof(SAD_HEADER) + m_uSides * m_uTracks * m_uSectors * m_uSectorSize;
-
-    if (!m_pStream->Rewind() || m_pStream->Write(m_pbData, uDiskSize) != uDiskSize)
-        return false;
-
-    SetModified(false);
-    m_pStream->Close();
-    return true;
+    return SaveImage(uDiskSize);
 }
 
 // Format a track using the specified format
@@ -424,6 +713,7 @@ BYTE CSADDisk::FormatTrack(BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbData
         memcpy(m_pbData + lPos + ((paID_[u].bSector - 1) * m_uSectorSize), papbData_[u], m_uSectorSize);
 
     // Mark the disk stream as modified
+    SetDirty(lPos, uSectors_ * m_uSectorSize);
     SetModified();
 
     return 0;
@@ -434,8 +724,8 @@ BYTE CSADDisk::FormatTrack(BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbData
 {
     EDSK_HEADER eh;
 
-    // Read the header, check the signature and basic geometry
-    bool fValid = (pStream_->Rewind() && pStream_->Read(&eh, sizeof(eh)) == sizeof(eh) &&
+    // Check the header signature and basic geometry
+    bool fValid = (pStream_->GetHeader(&eh, sizeof(eh)) == sizeof(eh) &&
         (!memcmp(eh.szSignature, EDSK_SIGNATURE, sizeof(EDSK_SIGNATURE) - 1) ||
             !memcmp(eh.szSignature, DSK_SIGNATURE, sizeof(DSK_SIGNATURE) - 1)) &&
         eh.bSides >= 1 && eh.bSides <= MAX_DISK_SIDES);
@@ -452,6 +742,7 @@ CEDSKDisk::CEDSKDisk(CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT
     // Unformatted, initially
     memset(m_apTracks, 0, sizeof(m_apTracks));
     memset(m_abSizes, 0, sizeof(m_abSizes));
+    memset(m_afDirty, 0, sizeof(m_afDirty));
 
     // There's nothing more to do if we don't have a stream
     if (!pStream_->IsOpen())
@@ -470,6 +761,9 @@ CEDSKDisk::CEDSKDisk(CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT
     bool fEDSK = peh->szSignature[0] == EDSK_SIGNATURE[0];
     WORD wDSKTrackSize = peh->abTrackSize[0] | (peh->abTrackSize[1] << 8);  // DSK only
 
+    // Changes can only be saved in place if we'd write the same layout
+    bool fRewrite = !fEDSK || peh->bTracks > MAX_DISK_TRACKS || !pStream_->CanUpdate();
+
     for (BYTE cyl = 0; cyl < m_uTracks; cyl++)
     {
         for (BYTE head = 0; head < m_uSides; head++)
@@ -488,6 +782,7 @@ CEDSKDisk::CEDSKDisk(CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT
                 delete[] pb;
                 pt = nullptr;
                 size = 0;
+                fRewrite = true;
             }
 
             // Save the track (or nullptr) and size MSB
@@ -496,6 +791,7 @@ CEDSKDisk::CEDSKDisk(CStream* pStream_, UINT uSides_/*=NORMAL_DISK_SIDES*/, UINT
         }
     }
 
+    m_fRewrite = fRewrite;
     pStream_->Close();
 }
 
@@ -590,33 +886,43 @@ BYTE CEDSKDisk::WriteData(BYTE cyl_, BYTE head_, BYTE index_, BYTE* pbData_, UIN
     m_pSector->bStatus1 &= ~ST1_765_CRC_ERROR;
     m_pSector->bStatus2 &= ~ST2_765_CRC_ERROR;
 
+    m_afDirty[head_][cyl_] = true;
     SetModified();
     return 0;
 }
 
-// Save the disk out to the stream
+// Queue the disk changes to be written to the stream by the save thread
 bool CEDSKDisk::Save()
 {
     BYTE abHeader[256] = { 0 }, cyl, head;
     EDSK_HEADER* peh = reinterpret_cast<EDSK_HEADER*>(abHeader);
     BYTE* pbSizes = reinterpret_cast<BYTE*>(peh + 1);
 
-    // Complete the disk header
-    memcpy(peh->szSignature, EDSK_SIGNATURE, sizeof(peh->szSignature));
-    memcpy(peh->szCreator, "SimCoupe 1.1 ", sizeof(peh->szCreator)); // note: trailing space+null fills field
-    peh->bTracks = m_uTracks;
-    peh->bSides = m_uSides;
+    if (IsReadOnly())
+        return false;
 
-    // Complete the MSB size table
-    for (cyl = 0; cyl < m_uTracks; cyl++)
-        for (head = 0; head < m_uSides; head++)
-            *pbSizes++ = m_abSizes[head][cyl];
+    DISK_SAVE* pSave = NewSave(this, m_pStream, m_fRewrite);
 
-    // Write the disk header
-    bool fSuccess = m_pStream->Rewind() && m_pStream->Write(&abHeader, sizeof(abHeader)) == sizeof(abHeader);
+    // The header only changes with the layout, which needs a full rewrite
+    if (m_fRewrite)
+    {
+        // Complete the disk header
+        memcpy(peh->szSignature, EDSK_SIGNATURE, sizeof(peh->szSignature));
+        memcpy(peh->szCreator, "SimCoupe 1.1 ", sizeof(peh->szCreator)); // note: trailing space+null fills field
+        peh->bTracks = m_uTracks;
+        peh->bSides = m_uSides;
+
+        // Complete the MSB size table
+        for (cyl = 0; cyl < m_uTracks; cyl++)
+            for (head = 0; head < m_uSides; head++)
+                *pbSizes++ = m_abSizes[head][cyl];
+
+        pSave->vBlocks.emplace_back(0, std::vector<BYTE>(abHeader, abHeader + sizeof(abHeader)));
+    }
 
-    // Write the track data
-    for (cyl = 0; fSuccess && cyl < m_uTracks; cyl++)
+    // Add the track data, or just the modified tracks if the layout is unchanged
+    size_t uOffset = sizeof(abHeader);
+    for (cyl = 0; cyl < m_uTracks; cyl++)
     {
         for (head = 0; head < m_uSides; head++)
         {
@@ -625,15 +931,20 @@ bool CEDSKDisk::Save()
                 continue;
 
             UINT uSize = m_abSizes[head][cyl] << 8;
-            fSuccess &= (m_pStream->Write(m_apTracks[head][cyl], uSize) == uSize);
+            BYTE* pb = reinterpret_cast<BYTE*>(m_apTracks[head][cyl]);
+
+            if (m_fRewrite || m_afDirty[head][cyl])
+                pSave->vBlocks.emplace_back(uOffset, std::vector<BYTE>(pb, pb + uSize));
+
+            uOffset += uSize;
         }
     }
 
-    // Any problems?
-    if (!fSuccess)
-        return false;
+    QueueSave(pSave);
 
-    m_pStream->Close();
+    // The file now matches our layout, if the stream supports in-place updates
+    memset(m_afDirty, 0, sizeof(m_afDirty));
+    m_fRewrite = !m_pStream->CanUpdate();
     SetModified(false);
 
     return true;
@@ -707,6 +1018,12 @@ BYTE CEDSKDisk::FormatTrack(BYTE cyl_, BYTE head_, IDFIELD* paID_, BYTE* papbDat
         pb += uDataSize;
     }
 
+    // A change of track size or disk extents moves the tracks that follow in the file
+    if (m_abSizes[head_][cyl_] != (uDataTotal >> 8) || cyl_ >= m_uTracks || head_ >= m_uSides)
+        m_fRewrite = true;
+
+    m_afDirty[head_][cyl_] = true;
+
     // Delete any old track, and assign the new one
     delete m_apTracks[head_][cyl_];
     m_apTracks[head_][cyl_] = pt;
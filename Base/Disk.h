@@ -113,6 +113,8 @@ EDSK_SECTOR;
 
 enum { dtNone, dtUnknown, dtFloppy, dtFile, dtEDSK, dtSAD, dtMGT, dtSBT, dtCAPS };
 
+typedef void (*PFNSAVEDPROC)(const char* pcszFile_, bool fSuccess_, size_t uWritten_);
+
 #define LOAD_DELAY  3   // Number of status reads to artificially stay busy for image file track loads
 // Pro-Dos relies on data not being available immediately a command is submitted
 
@@ -131,6 +133,9 @@ public:
     static int GetType(CStream* pStream_);
     static CDisk* Open(const char* pcszDisk_, bool fReadOnly_ = false);
     static CDisk* Open(void* pv_, size_t uSize_, const char* pcszDisk_);
+    static void SetSaveCallback(PFNSAVEDPROC pfn_);
+    static void CompleteSaves();
+    static void WaitForSaves();
 
     virtual void Close() { m_pStream->Close(); }
     virtual void Flush() { }
@@ -156,6 +161,11 @@ protected:
 
     virtual bool IsBusy(BYTE* /*pbStatus_*/, bool /*fWait_*/ = false) { if (!m_nBusy) return false; m_nBusy--; return true; }
 
+    bool MapImage(size_t uSize_, UINT uBlockSize_);
+    void UnmapImage(size_t uSize_);
+    void SetDirty(size_t uOffset_, size_t uLen_);
+    bool SaveImage(size_t uSize_);
+
 protected:
     int m_nType;
     int m_nBusy;
@@ -163,6 +173,11 @@ protected:
 
     CStream* m_pStream;
     BYTE* m_pbData;
+
+    bool m_fMapped = false;         // m_pbData is a mapped view of the stream
+    bool m_fRewrite = true;         // Next save must write the whole image
+    UINT m_uBlockSize = 0;          // Size of each dirty block in a mapped image
+    std::vector<bool> m_vDirty;     // Modified blocks to write back on save
 };
 
 
@@ -230,6 +245,7 @@ protected:
 
     EDSK_TRACK* m_apTracks[MAX_DISK_SIDES][MAX_DISK_TRACKS];
     BYTE m_abSizes[MAX_DISK_SIDES][MAX_DISK_TRACKS];
+    bool m_afDirty[MAX_DISK_SIDES][MAX_DISK_TRACKS];    // Tracks changed since the last save
 
 private:
     // These are for private class use and only valid immediately after calling GetSector()
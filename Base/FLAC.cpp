@@ -0,0 +1,433 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// FLAC.cpp: Free Lossless Audio Codec encoder, for WAV recording
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  This is a small subset of the format, using only the fixed polynomial
+//  predictors with partitioned Rice coding of the residual, which is what
+//  the reference encoder does at its fastest levels. Emulated sound has long
+//  runs of silence and flat DAC levels, which reduce to constant subframes.
+//
+//  Stereo blocks try left/right, left/side, side/right and mid/side, picking
+//  whichever gives the smallest estimated size. Frames are a fixed 4096
+//  samples, except for the last in the stream.
+//
+//  The STREAMINFO header is rewritten with the sample count as the stream
+//  grows, and the MD5 signature is left as zero, which decoders treat as
+//  unknown rather than a mismatch.
+
+#include "SimCoupe.h"
+#include "FLAC.h"
+
+const int BLOCK_SIZE = 4096;            // Samples per frame
+const int MAX_FIXED_ORDER = 4;          // Highest fixed predictor order
+const int MAX_PARTITION_ORDER = 8;      // Up to 256 Rice partitions per subframe
+const int MAX_RICE_PARAM = 30;          // 5-bit parameters, with 31 reserved as an escape
+
+enum { SUBFRAME_CONSTANT, SUBFRAME_VERBATIM, SUBFRAME_FIXED };
+
+// Chosen encoding for a subframe
+struct SUBFRAME
+{
+    int nType = SUBFRAME_VERBATIM;
+    int nOrder = 0;                                 // Fixed predictor order
+    int nPartOrder = 0;                             // Rice partition order
+    int anParams[1 << MAX_PARTITION_ORDER]{};       // Rice parameter for each partition
+    uint64_t ullBits = 0;                           // Encoded size in bits
+};
+
+
+// MSB-first bit writer appending to a byte vector
+class CBitWriter
+{
+public:
+    explicit CBitWriter(std::vector<BYTE>& vOut_) : m_vOut(vOut_) { }
+
+    void Put(uint32_t uVal_, int nBits_)
+    {
+        if (!nBits_)
+            return;
+
+        m_ullAcc = (m_ullAcc << nBits_) | (uVal_ & ((1ULL << nBits_) - 1));
+        m_nBits += nBits_;
+
+        while (m_nBits >= 8)
+        {
+            m_nBits -= 8;
+            m_vOut.push_back(static_cast<BYTE>(m_ullAcc >> m_nBits));
+        }
+    }
+
+    void PutSigned(int32_t nVal_, int nBits_) { Put(static_cast<uint32_t>(nVal_), nBits_); }
+
+    // Unary quotient terminated by a 1 bit, then the low bits of the value
+    void PutRice(uint32_t uVal_, int nParam_)
+    {
+        uint32_t uQuotient = uVal_ >> nParam_;
+        for (; uQuotient >= 32; uQuotient -= 32)
+            Put(0, 32);
+
+        Put(1, uQuotient + 1);
+        Put(uVal_, nParam_);
+    }
+
+    // UTF-8 style coding used for frame numbers
+    void PutUTF8(DWORD dwVal_)
+    {
+        if (dwVal_ < 0x80)
+        {
+            Put(dwVal_, 8);
+            return;
+        }
+
+        int nBytes = 2;
+        while (dwVal_ >= (1UL << (5 * nBytes + 1)))
+            nBytes++;
+
+        Put(((0xff00 >> nBytes) & 0xff) | (dwVal_ >> (6 * (nBytes - 1))), 8);
+        for (int i = nBytes - 2; i >= 0; i--)
+            Put(0x80 | ((dwVal_ >> (6 * i)) & 0x3f), 8);
+    }
+
+    void Align()
+    {
+        if (m_nBits)
+            Put(0, 8 - m_nBits);
+    }
+
+protected:
+    std::vector<BYTE>& m_vOut;
+    uint64_t m_ullAcc = 0;
+    int m_nBits = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static BYTE CRC8(const BYTE* pb_, size_t uLen_)
+{
+    BYTE bCRC = 0;
+
+    while (uLen_--)
+    {
+        bCRC ^= *pb_++;
+        for (int i = 0; i < 8; i++)
+            bCRC = static_cast<BYTE>((bCRC & 0x80) ? (bCRC << 1) ^ 0x07 : (bCRC << 1));
+    }
+
+    return bCRC;
+}
+
+static WORD CRC16(const BYTE* pb_, size_t uLen_)
+{
+    WORD wCRC = 0;
+
+    while (uLen_--)
+    {
+        wCRC ^= *pb_++ << 8;
+        for (int i = 0; i < 8; i++)
+            wCRC = static_cast<WORD>((wCRC & 0x8000) ? (wCRC << 1) ^ 0x8005 : (wCRC << 1));
+    }
+
+    return wCRC;
+}
+
+// Map signed residuals to unsigned for Rice coding: 0, -1, 1, -2, 2, ...
+static inline uint32_t Fold(int32_t n_)
+{
+    return (static_cast<uint32_t>(n_) << 1) ^ static_cast<uint32_t>(n_ >> 31);
+}
+
+// Residual after a fixed polynomial predictor, starting after the warm-up samples
+static void FixedResidual(const int32_t* pn_, int nSamples_, int nOrder_, int32_t* pnRes_)
+{
+    for (int i = nOrder_; i < nSamples_; i++)
+    {
+        switch (nOrder_)
+        {
+        case 0: pnRes_[i] = pn_[i]; break;
+        case 1: pnRes_[i] = pn_[i] - pn_[i - 1]; break;
+        case 2: pnRes_[i] = pn_[i] - 2 * pn_[i - 1] + pn_[i - 2]; break;
+        case 3: pnRes_[i] = pn_[i] - 3 * pn_[i - 1] + 3 * pn_[i - 2] - pn_[i - 3]; break;
+        case 4: pnRes_[i] = pn_[i] - 4 * pn_[i - 1] + 6 * pn_[i - 2] - 4 * pn_[i - 3] + pn_[i - 4]; break;
+        }
+    }
+}
+
+// Estimate the bits for a partition with the given sum of folded residuals, returning the best parameter
+static uint64_t RiceBits(uint64_t ullSum_, int nCount_, int* pnParam_)
+{
+    uint64_t ullBest = UINT64_MAX;
+
+    for (int k = 0; k <= MAX_RICE_PARAM; k++)
+    {
+        uint64_t ullBits = static_cast<uint64_t>(nCount_) * (k + 1) + (ullSum_ >> k);
+        if (ullBits < ullBest)
+        {
+            ullBest = ullBits;
+            *pnParam_ = k;
+        }
+    }
+
+    return ullBest;
+}
+
+// Choose the Rice partitioning for a residual, returning the estimated coded size
+static uint64_t PlanResidual(const int32_t* pnRes_, int nSamples_, int nOrder_, SUBFRAME& sub_)
+{
+    // Find the finest partitioning allowed, which needs whole partitions longer than the warm-up
+    int nMaxOrder = 0;
+    while (nMaxOrder < MAX_PARTITION_ORDER && !(nSamples_ % (2 << nMaxOrder)) && (nSamples_ >> (nMaxOrder + 1)) > nOrder_)
+        nMaxOrder++;
+
+    // Sum the folded residual for each of the finest partitions
+    uint64_t aullSums[1 << MAX_PARTITION_ORDER];
+    int nLen = nSamples_ >> nMaxOrder;
+    for (int p = 0; p < (1 << nMaxOrder); p++)
+    {
+        uint64_t ullSum = 0;
+        for (int i = p ? p * nLen : nOrder_; i < (p + 1) * nLen; i++)
+            ullSum += Fold(pnRes_[i]);
+        aullSums[p] = ullSum;
+    }
+
+    // Try each partition order, merging pairs of sums on the way down
+    uint64_t ullBest = UINT64_MAX;
+    for (int nPartOrder = nMaxOrder; nPartOrder >= 0; nPartOrder--)
+    {
+        int nParts = 1 << nPartOrder, anParams[1 << MAX_PARTITION_ORDER];
+        uint64_t ullBits = 2 + 4;   // Coding method and partition order
+
+        nLen = nSamples_ >> nPartOrder;
+        for (int p = 0; p < nParts; p++)
+            ullBits += 5 + RiceBits(aullSums[p], p ? nLen : nLen - nOrder_, &anParams[p]);
+
+        if (ullBits < ullBest)
+        {
+            ullBest = ullBits;
+            sub_.nPartOrder = nPartOrder;
+            std::copy(anParams, anParams + nParts, sub_.anParams);
+        }
+
+        for (int p = 0; p < nParts / 2; p++)
+            aullSums[p] = aullSums[p * 2] + aullSums[p * 2 + 1];
+    }
+
+    return ullBest;
+}
+
+// Pick the smallest encoding for a channel
+static void PlanSubframe(const int32_t* pn_, int nSamples_, int nBits_, int32_t* pnRes_, SUBFRAME& sub_)
+{
+    sub_.nType = SUBFRAME_VERBATIM;
+    sub_.ullBits = 8 + static_cast<uint64_t>(nSamples_) * nBits_;
+
+    if (std::all_of(pn_, pn_ + nSamples_, [&](int32_t n) { return n == pn_[0]; }))
+    {
+        sub_.nType = SUBFRAME_CONSTANT;
+        sub_.ullBits = 8 + nBits_;
+        return;
+    }
+
+    SUBFRAME sub;
+    for (int nOrder = 0; nOrder <= MAX_FIXED_ORDER && nOrder < nSamples_; nOrder++)
+    {
+        FixedResidual(pn_, nSamples_, nOrder, pnRes_);
+        uint64_t ullBits = 8 + static_cast<uint64_t>(nOrder) * nBits_ + PlanResidual(pnRes_, nSamples_, nOrder, sub);
+
+        if (ullBits < sub_.ullBits)
+        {
+            sub_ = sub;
+            sub_.nType = SUBFRAME_FIXED;
+            sub_.nOrder = nOrder;
+            sub_.ullBits = ullBits;
+        }
+    }
+}
+
+static void WriteSubframe(CBitWriter& bw_, const int32_t* pn_, int nSamples_, int nBits_, int32_t* pnRes_, const SUBFRAME& sub_)
+{
+    switch (sub_.nType)
+    {
+    case SUBFRAME_CONSTANT:
+        bw_.Put(0x00, 8);
+        bw_.PutSigned(pn_[0], nBits_);
+        break;
+
+    case SUBFRAME_VERBATIM:
+        bw_.Put(0x02, 8);
+        for (int i = 0; i < nSamples_; i++)
+            bw_.PutSigned(pn_[i], nBits_);
+        break;
+
+    case SUBFRAME_FIXED:
+    {
+        bw_.Put(0x10 | (sub_.nOrder << 1), 8);
+        for (int i = 0; i < sub_.nOrder; i++)
+            bw_.PutSigned(pn_[i], nBits_);
+
+        FixedResidual(pn_, nSamples_, sub_.nOrder, pnRes_);
+
+        // Partitioned Rice coding with 5-bit parameters
+        bw_.Put(1, 2);
+        bw_.Put(sub_.nPartOrder, 4);
+
+        int nLen = nSamples_ >> sub_.nPartOrder;
+        for (int p = 0; p < (1 << sub_.nPartOrder); p++)
+        {
+            bw_.Put(sub_.anParams[p], 5);
+            for (int i = p ? p * nLen : sub_.nOrder; i < (p + 1) * nLen; i++)
+                bw_.PutRice(Fold(pnRes_[i]), sub_.anParams[p]);
+        }
+        break;
+    }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CFLACEncoder::CFLACEncoder(int nSampleRate_, int nChannels_)
+    : m_nSampleRate(nSampleRate_), m_nChannels(nChannels_)
+{
+    m_vsBlock.resize(BLOCK_SIZE * nChannels_);
+}
+
+// Stream marker and STREAMINFO, with the current sample count
+void CFLACEncoder::EncodeHeader(std::vector<BYTE>& vOut_)
+{
+    CBitWriter bw(vOut_);
+
+    for (auto c : { 'f', 'L', 'a', 'C' })
+        bw.Put(c, 8);
+
+    bw.Put(0x80, 8);                    // Last metadata block, STREAMINFO
+    bw.Put(34, 24);                     // Block length
+
+    bw.Put(BLOCK_SIZE, 16);             // Minimum block size
+    bw.Put(BLOCK_SIZE, 16);             // Maximum block size
+    bw.Put(0, 24);                      // Minimum frame size (unknown)
+    bw.Put(0, 24);                      // Maximum frame size (unknown)
+    bw.Put(m_nSampleRate, 20);
+    bw.Put(m_nChannels - 1, 3);
+    bw.Put(16 - 1, 5);                  // Bits per sample
+    bw.Put(static_cast<uint32_t>(m_ullSamples >> 32), 4);
+    bw.Put(static_cast<uint32_t>(m_ullSamples), 32);
+
+    for (int i = 0; i < 16; i++)        // MD5 signature (unknown)
+        bw.Put(0, 8);
+}
+
+// Buffer interleaved samples, encoding each block as it fills
+void CFLACEncoder::AddSamples(std::vector<BYTE>& vOut_, const int16_t* ps_, int nSamples_)
+{
+    while (nSamples_ > 0)
+    {
+        int nCopy = std::min(nSamples_, BLOCK_SIZE - m_nBlockSamples);
+        std::copy(ps_, ps_ + nCopy * m_nChannels, m_vsBlock.begin() + m_nBlockSamples * m_nChannels);
+
+        ps_ += nCopy * m_nChannels;
+        nSamples_ -= nCopy;
+
+        if ((m_nBlockSamples += nCopy) == BLOCK_SIZE)
+            EncodeBlock(vOut_, BLOCK_SIZE);
+    }
+}
+
+// Encode any partial block at the end of the stream
+void CFLACEncoder::Flush(std::vector<BYTE>& vOut_)
+{
+    if (m_nBlockSamples)
+        EncodeBlock(vOut_, m_nBlockSamples);
+}
+
+void CFLACEncoder::EncodeBlock(std::vector<BYTE>& vOut_, int nSamples_)
+{
+    // Separate the channels, adding mid and side for stereo
+    std::vector<int32_t> avnChannels[4], vnRes(nSamples_);
+    for (int c = 0; c < m_nChannels; c++)
+    {
+        avnChannels[c].resize(nSamples_);
+        for (int i = 0; i < nSamples_; i++)
+            avnChannels[c][i] = m_vsBlock[i * m_nChannels + c];
+    }
+
+    SUBFRAME asSubs[4];
+    int nAssignment = m_nChannels - 1;  // Independent channels
+    int anSources[2] = { 0, 1 };
+
+    if (m_nChannels == 2)
+    {
+        avnChannels[2].resize(nSamples_);
+        avnChannels[3].resize(nSamples_);
+        for (int i = 0; i < nSamples_; i++)
+        {
+            avnChannels[2][i] = (avnChannels[0][i] + avnChannels[1][i]) >> 1;
+            avnChannels[3][i] = avnChannels[0][i] - avnChannels[1][i];
+        }
+
+        for (int c = 0; c < 4; c++)
+            PlanSubframe(avnChannels[c].data(), nSamples_, (c == 3) ? 17 : 16, vnRes.data(), asSubs[c]);
+
+        // Left/right, left/side, side/right, mid/side
+        static const int anPairs[4][3] = { { 1, 0, 1 }, { 8, 0, 3 }, { 9, 3, 1 }, { 10, 2, 3 } };
+        uint64_t ullBest = UINT64_MAX;
+        for (auto& pair : anPairs)
+        {
+            uint64_t ullBits = asSubs[pair[1]].ullBits + asSubs[pair[2]].ullBits;
+            if (ullBits < ullBest)
+            {
+                ullBest = ullBits;
+                nAssignment = pair[0];
+                anSources[0] = pair[1];
+                anSources[1] = pair[2];
+            }
+        }
+    }
+    else
+    {
+        for (int c = 0; c < m_nChannels; c++)
+            PlanSubframe(avnChannels[c].data(), nSamples_, 16, vnRes.data(), asSubs[c]);
+    }
+
+    size_t uStart = vOut_.size();
+    CBitWriter bw(vOut_);
+
+    // Frame header, with the block size stored separately for a short final block
+    bw.Put(0xfff8, 16);                                 // Sync code, fixed block size
+    bw.Put((nSamples_ == BLOCK_SIZE) ? 12 : 7, 4);      // 12 = 4096 samples
+    bw.Put(0, 4);                                       // Sample rate from STREAMINFO
+    bw.Put(nAssignment, 4);
+    bw.Put(4, 3);                                       // 16 bits per sample
+    bw.Put(0, 1);
+    bw.PutUTF8(m_dwFrame++);
+    if (nSamples_ != BLOCK_SIZE)
+        bw.Put(nSamples_ - 1, 16);
+    bw.Put(CRC8(vOut_.data() + uStart, vOut_.size() - uStart), 8);
+
+    for (int c = 0; c < m_nChannels; c++)
+    {
+        int nSource = anSources[c];
+        WriteSubframe(bw, avnChannels[nSource].data(), nSamples_, (nSource == 3) ? 17 : 16, vnRes.data(), asSubs[nSource]);
+    }
+
+    bw.Align();
+    bw.Put(CRC16(vOut_.data() + uStart, vOut_.size() - uStart), 16);
+
+    m_ullSamples += nSamples_;
+    m_nBlockSamples = 0;
+}
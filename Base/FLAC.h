@@ -0,0 +1,48 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// FLAC.h: Free Lossless Audio Codec encoder, for WAV recording
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+class CFLACEncoder final
+{
+public:
+    CFLACEncoder(int nSampleRate_, int nChannels_);
+    CFLACEncoder(const CFLACEncoder&) = delete;
+    void operator= (const CFLACEncoder&) = delete;
+
+public:
+    static const int HEADER_SIZE = 42;     // Stream marker and STREAMINFO block
+
+    uint64_t GetSamples() const { return m_ullSamples; }
+    void EncodeHeader(std::vector<BYTE>& vOut_);
+    void AddSamples(std::vector<BYTE>& vOut_, const int16_t* ps_, int nSamples_);
+    void Flush(std::vector<BYTE>& vOut_);
+
+protected:
+    void EncodeBlock(std::vector<BYTE>& vOut_, int nSamples_);
+
+protected:
+    int m_nSampleRate = 0, m_nChannels = 0;
+    uint64_t m_ullSamples = 0;      // Samples in completed frames
+    DWORD m_dwFrame = 0;            // Next frame number
+
+    std::vector<int16_t> m_vsBlock; // Interleaved samples for the current block
+    int m_nBlockSamples = 0;
+};
@@ -27,7 +27,6 @@
 //  on whether or not the current line is high resolution.
 
 // ToDo:
-//  - change from dirty lines to dirty rectangles, to reduce rendering further
 //  - maybe move away from the template class, as it's not as useful anymore
 
 #include "SimCoupe.h"
@@ -43,6 +42,7 @@
 #include "Memory.h"
 #include "Options.h"
 #include "OSD.h"
+#include "Pipe.h"
 #include "PNG.h"
 #include "Sound.h"
 #include "Util.h"
@@ -95,6 +95,7 @@ REGION asViews[] =
 namespace Frame
 {
 static void DrawOSD(CScreen* pScreen_);
+static void DrawStatus(CScreen* pScreen_, int nHeight_);
 static void Flip(CScreen* pScreen_);
 
 bool Init(bool fFirstInit_/*=false*/)
@@ -153,6 +154,8 @@ void Exit(bool fReInit_/*=false*/)
     // Stop any recording
     GIF::Stop();
     AVI::Stop();
+    Pipe::Stop();
+    PNG::Exit();
 
     delete pFrame; pFrame = nullptr;
     delete pScreen; pScreen = nullptr;
@@ -270,13 +273,9 @@ static void CopyBeforeLastUpdate()
             nBottom--;
         }
 
-        // Copy the remaining full lines
-        for (int i = 0; i <= nBottom; i++)
-        {
-            BYTE* pLine = pScreen->GetLine(i);
-            BYTE* pLastLine = pLastScreen->GetLine(i);
-            memcpy(pLine, pLastLine, pScreen->GetPitch());
-        }
+        // Take the remaining full lines by exchanging them, rather than copying
+        if (nBottom >= 0)
+            pScreen->SwapLines(pLastScreen, 0, nBottom + 1);
     }
 }
 
@@ -304,13 +303,8 @@ static void CopyAfterRaster()
             nTop++;
         }
 
-        // Copy the remaining lines
-        for (int i = nTop; i < nBottom; i++)
-        {
-            BYTE* pLine = pScreen->GetLine(i);
-            BYTE* pLastLine = pLastScreen->GetLine(i);
-            memcpy(pLine, pLastLine, pScreen->GetPitch());
-        }
+        // Exchange the remaining lines, as the previous frame won't need them again
+        pScreen->SwapLines(pLastScreen, nTop, nBottom);
     }
 }
 
@@ -336,10 +330,8 @@ static void DrawRaster(CScreen* pScreen_)
     static int nPhase = 0;
     BYTE bColour = anFlash[++nPhase & 0xf];
 
-    // Write the 2x2 pixel block
-    BYTE* pLine0 = pScreen_->GetLine(nLine);
-    BYTE* pLine1 = pScreen_->GetLine(nLine + 1);
-    pLine0[nOffset] = pLine0[nOffset + 1] = pLine1[nOffset] = pLine1[nOffset + 1] = bColour;
+    // Draw the 2x2 pixel block
+    pScreen_->FillRect(nOffset, nLine, 2, 2, bColour);
 }
 
 
@@ -368,21 +360,37 @@ void End()
 
         if (GUI::IsActive())
         {
-            // Make a double-height copy of the current frame for the GUI to overlay
-            for (int i = 0; i < GetHeight(); i++)
+            // Refresh the double-height copy of the current frame for the GUI to overlay.
+            // Only lines previously drawn over by the GUI, or with changed frame data, need copying.
+            for (int i = 0; i < GetHeight(); i += 2)
             {
-                // Fetch the source line data
                 BYTE* pbLine = pScreen->GetLine(i >> 1);
+                BYTE* pbGui0 = pGuiScreen->GetLine(i);
+                BYTE* pbGui1 = pGuiScreen->GetLine(i + 1);
                 int nWidth = pScreen->GetPitch();
 
-                // Copy the frame data
-                memcpy(pGuiScreen->GetLine(i), pbLine, nWidth);
+                if (pGuiScreen->IsLineDrawn(i) || pGuiScreen->IsLineDrawn(i + 1) || memcmp(pbGui0, pbLine, nWidth))
+                {
+                    memcpy(pbGui0, pbLine, nWidth);
+                    memcpy(pbGui1, pbLine, nWidth);
+                }
             }
 
+            pGuiScreen->ResetDrawnLines();
+
             // If the debugger is active, highlight the current raster position
             if (Debug::IsActive())
                 DrawRaster(pGuiScreen);
 
+            // Continue any screenshot burst from the emulated frame beneath the GUI
+            PNG::AddFrame(pScreen);
+
+            // Keep pipe video in step with its audio, which continues under the GUI
+            Pipe::AddFrame(pScreen);
+
+            // Show any status message under the GUI widgets
+            DrawStatus(pGuiScreen, pGuiScreen->GetHeight());
+
             // Overlay the GUI widgets
             GUI::Draw(pGuiScreen);
 
@@ -391,6 +399,9 @@ void End()
         }
         else
         {
+            // Continue any screenshot burst
+            PNG::AddFrame(pScreen);
+
             // Screenshot required?
             if (fSaveScreen)
             {
@@ -401,6 +412,7 @@ void End()
             // Add the frame to any recordings
             GIF::AddFrame(pScreen);
             AVI::AddFrame(pScreen);
+            Pipe::AddFrame(pScreen);
 
             // Overlay the floppy LEDs and status text
             DrawOSD(pScreen);
@@ -412,6 +424,11 @@ void End()
         // Redraw what's new
         Redraw();
     }
+    else
+    {
+        // Repeat the previous pipe video frame, to stay in step with the audio
+        Pipe::AddFrame(nullptr);
+    }
 
     // Decide whether we should draw the next frame
     Sync();
@@ -471,8 +488,9 @@ void Sync()
         // 100% speed is actually 50.08fps, so the 51fps we see every ~12 seconds is still fine
         if (nFrame == 51) nPercent = 100;
 
-        // Format the profile string and reset it
+        // Format the profile string and reset it, adding any audio statistics
         sprintf(szProfile, "%d%%", nPercent);
+        Sound::AddProfile(szProfile, sizeof(szProfile));
         TRACE("%s  %d frames\n", szProfile, nFrame);
 
         // Adjust for next time, taking care to preserve any fractional part
@@ -486,8 +504,8 @@ void Sync()
     if (GUI::IsActive())
     {
         // Add a frame's worth of silence
-        static BYTE abSilence[SAMPLE_FREQ * SAMPLE_BLOCK / EMULATED_FRAMES_PER_SECOND];
-        Audio::AddData(abSilence, sizeof(abSilence));
+        static BYTE abSilence[MAX_SAMPLES_PER_FRAME * SAMPLE_BLOCK];
+        Audio::AddData(abSilence, Sound::GetSampleFreq() / EMULATED_FRAMES_PER_SECOND * SAMPLE_BLOCK);
     }
 }
 
@@ -503,24 +521,33 @@ void Redraw()
 void Flip(CScreen* pScreen_)
 {
     int nHeight = pScreen_->GetHeight() >> (GUI::IsActive() ? 0 : 1);
-
-    DWORD* pdwA = reinterpret_cast<DWORD*>(pScreen_->GetLine(0));
-    DWORD* pdwB = reinterpret_cast<DWORD*>(pDisplayScreen->GetLine(0));
-    int nPitchDW = pScreen_->GetPitch() >> 2;
+    int nWidth = pScreen_->GetPitch();
 
     // Work out what has changed since the last frame
     for (int i = 0; i < nHeight; i++)
     {
-        // Skip lines currently marked as dirty
+        // Skip lines already entirely dirty
         if (Video::IsLineDirty(i))
-            continue;
+        {
+            int nLeft, nRight;
+            Video::GetDirtySpan(i, &nLeft, &nRight);
+            if (nLeft <= 0 && nRight >= nWidth)
+                continue;
+        }
+
+        BYTE* pbA = pScreen_->GetLine(i);
+        BYTE* pbB = pDisplayScreen->GetLine(i);
 
         // If they're different resolutions, or have different contents, they're dirty
-        if (memcmp(pdwA, pdwB, pScreen_->GetPitch()))
-            Video::SetLineDirty(i);
+        if (memcmp(pbA, pbB, nWidth))
+        {
+            // Narrow the change down to whole 16-pixel blocks (the pitch is a multiple of 16)
+            int nLeft = 0, nRight = nWidth;
+            while (!memcmp(pbA + nLeft, pbB + nLeft, 16)) nLeft += 16;
+            while (!memcmp(pbA + nRight - 16, pbB + nRight - 16, 16)) nRight -= 16;
 
-        pdwA += nPitchDW;
-        pdwB += nPitchDW;
+            Video::SetLineDirty(i, nLeft, nRight);
+        }
     }
 
     // Remember the last drawn screen, to compare differences next time
@@ -573,13 +600,19 @@ void DrawOSD(CScreen* pScreen_)
         pScreen_->DrawString(nX - 2, 1, szProfile, WHITE);
     }
 
-    // Any active status line?
+    DrawStatus(pScreen_, nHeight);
+}
+
+// Draw any active status line in the bottom-right corner
+void DrawStatus(CScreen* pScreen_, int nHeight_)
+{
     if (GetOption(status) && szStatus[0])
     {
-        int nX = nWidth - pScreen_->GetStringWidth(szStatus);
+        pScreen_->SetFont(&sPropFont);
+        int nX = pScreen_->GetPitch() - pScreen_->GetStringWidth(szStatus);
 
-        pScreen_->DrawString(nX, nHeight - CHAR_HEIGHT - 1, szStatus, BLACK);
-        pScreen_->DrawString(nX - 2, nHeight - CHAR_HEIGHT - 2, szStatus, WHITE);
+        pScreen_->DrawString(nX, nHeight_ - CHAR_HEIGHT - 1, szStatus, BLACK);
+        pScreen_->DrawString(nX - 2, nHeight_ - CHAR_HEIGHT - 2, szStatus, WHITE);
     }
 }
 
@@ -47,6 +47,31 @@ static LoopState nLoopState;
 
 #define COLOUR_DEPTH    7   // 128 SAM colours
 
+// Frame captured for the encoder thread
+typedef struct
+{
+    std::vector<BYTE> vbPixels; // Half-size frame, one byte per pixel
+    int nFrames;                // Frames elapsed since the previous queued frame
+} GIF_FRAME;
+
+const int MAX_QUEUED_FRAMES = 8;    // Frames can be dropped (extending the previous delay) if the queue is full
+
+static GIF_FRAME asFrames[MAX_QUEUED_FRAMES];
+static std::vector<GIF_FRAME*> vFree;
+static std::queue<GIF_FRAME*> qPending;
+
+static std::thread thWorker;
+static std::mutex mtxQueue;
+static std::condition_variable cvQueue;
+static bool fQuit;
+static std::atomic<bool> fLoopComplete;
+
+static WORD wWidth, wHeight;        // Recording dimensions
+static int nUnqueuedFrames;         // Frames since the last one queued
+static GifCompressor gc;            // Reused for every frame
+static std::vector<BYTE> vbImageData;
+static DWORD dwEncoded, dwEncodeTime;
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static void WriteLogicalScreenDescriptor(CScreen* pScreen_)
@@ -156,23 +181,22 @@ static void WriteFileTerminator()
 
 
 // Compare our copy of the screen with the new display contents
-static bool GetChangeRect(BYTE* pb_, CScreen* pScreen_)
+static bool GetChangeRect(BYTE* pb_, const BYTE* pbFrame_)
 {
     int l, t, r, b, w, h;
     l = t = r = b = 0;
 
-    WORD width = pScreen_->GetPitch() / 2, height = pScreen_->GetHeight() / 2;
-    int step = 2; // sample alternate pixels
+    WORD width = wWidth, height = wHeight;
 
     BYTE* pbC = pb_;
 
     // Search down for the top-most change
     for (h = 0; h < height; h++)
     {
-        BYTE* pb = pScreen_->GetLine(h);
+        const BYTE* pb = pbFrame_ + h * width;
 
         // Scan the full width of the current line
-        for (w = 0; w < width; w++, pbC++, pb += step)
+        for (w = 0; w < width; w++, pbC++, pb++)
         {
             if (*pbC != *pb)
             {
@@ -195,11 +219,10 @@ found_top:
     // Search up for the bottom-most change
     for (h = height - 1; h >= t; h--)
     {
-        BYTE* pb = pScreen_->GetLine(h);
-        pb += (width - 1) * step;
+        const BYTE* pb = pbFrame_ + h * width + (width - 1);
 
         // Scan the full width of the line, right to left
-        for (w = width - 1; w >= 0; w--, pbC--, pb -= step)
+        for (w = width - 1; w >= 0; w--, pbC--, pb--)
         {
             if (*pbC != *pb)
             {
@@ -220,12 +243,12 @@ found_bottom:
     // Scan within the inclusive vertical extents of the change rect
     for (h = t; h <= b; h++, pbC += width)
     {
-        BYTE* pb = pScreen_->GetLine(h);
+        const BYTE* pb = pbFrame_ + h * width;
 
         // Scan the unknown left strip
         for (w = 0; w < l; w++)
         {
-            if (pbC[w] != pb[w * step])
+            if (pbC[w] != pb[w])
             {
                 // Reduce the left edge to the change point
                 if (w < l) l = w;
@@ -236,7 +259,7 @@ found_bottom:
         // Scan the unknown right strip
         for (w = width - 1; w > r; w--)
         {
-            if (pbC[w] != pb[w * step])
+            if (pbC[w] != pb[w])
             {
                 // Increase the right edge to the change point
                 if (w > r) r = w;
@@ -255,10 +278,9 @@ found_bottom:
 }
 
 // Update current image and determine sub-region difference to encode
-static BYTE UpdateImage(BYTE* pb_, CScreen* pScreen_)
+static BYTE UpdateImage(BYTE* pb_, const BYTE* pbFrame_)
 {
-    WORD width = pScreen_->GetPitch() / 2;
-    int step = 2;
+    WORD width = wWidth;
     BYTE abUsed[1 << COLOUR_DEPTH] = { 0 };
     BYTE* pbSub_ = pbSub;
 
@@ -270,10 +292,9 @@ static BYTE UpdateImage(BYTE* pb_, CScreen* pScreen_)
 
     for (int y = wt; y < wt + wh; y++, pb += width)
     {
-        BYTE* pbScr = pScreen_->GetLine(y);
-        pbScr += (wl * step);
+        const BYTE* pbScr = pbFrame_ + y * width + wl;
 
-        for (int x = 0; x < ww; x++, pbScr += step)
+        for (int x = 0; x < ww; x++, pbScr++)
         {
             BYTE bOld = pb[x], bNew = *pbScr;
             pb[x] = bNew;
@@ -357,6 +378,104 @@ static BYTE UpdateImage(BYTE* pb_, CScreen* pScreen_)
     return 0xff;
 }
 
+// Encode a captured frame, appending it to the file (encoder thread)
+static void EncodeFrame(const GIF_FRAME* pFrame_)
+{
+    DWORD size = (DWORD)wWidth * (DWORD)wHeight;
+    const BYTE* pbFrame = pFrame_->vbPixels.data();
+
+    // Count the frames between changes
+    nDelay += pFrame_->nFrames;
+
+    // Return if there were no changes from the last frame
+    if (!GetChangeRect(pbCurr, pbFrame))
+        return;
+
+    // If recording a loop, force this frame to be encoded in full
+    if (nLoopState == kWaitLoopStart)
+    {
+        // Invalidate the stored image and mark the whole region
+        memset(pbCurr, 0xff, size);
+        wl = wt = 0;
+        ww = wWidth;
+        wh = wHeight;
+        nDelay = 0;
+    }
+
+    // Update our copy and encode the difference in the changed region
+    BYTE bTrans = UpdateImage(pbCurr, pbFrame);
+
+    // If recording a loop, wait for the first real change
+    if (nLoopState == kIgnoreFirstChange)
+    {
+        nLoopState = kWaitLoopStart;
+        return;
+    }
+    // If recording a loop, make a copy of the first frame
+    else if (nLoopState == kWaitLoopStart)
+    {
+        nLoopState = kLoopStarted;
+        pbFirst = new BYTE[size];
+        memcpy(pbFirst, pbCurr, size);
+    }
+    // If we're looking for the end of a loop, compare with the first frame
+    else if (pbFirst && !memcmp(pbFirst, pbCurr, size))
+    {
+        delete[] pbFirst; pbFirst = nullptr;
+        fLoopComplete = true;
+        return;
+    }
+
+    // Write any accumulated delay of identical frames to the previous header
+    if (lDelayOffset)
+    {
+        WriteGraphicControlExtensionDelay(lDelayOffset, nDelay * 2);
+        nDelay = 0;
+    }
+
+    // Write the GCE, storing its offset for the following delay
+    lDelayOffset = ftell(f) + 4;
+    WriteGraphicControlExtension(0, bTrans);
+
+    // Write the image header and changed frame data
+    WriteImageDescriptor(wl, wt, ww, wh);
+
+    // Compress the image data, and write it in a single block
+    vbImageData.clear();
+    gc.WriteDataBlocks(vbImageData, pbSub, ww * wh, COLOUR_DEPTH);
+    fwrite(vbImageData.data(), 1, vbImageData.size(), f);
+}
+
+static void WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(mtxQueue);
+
+    for (;;)
+    {
+        cvQueue.wait(lock, [] { return fQuit || !qPending.empty(); });
+
+        // Finish any queued frames before quitting
+        if (qPending.empty())
+            break;
+
+        GIF_FRAME* pFrame = qPending.front();
+        lock.unlock();
+
+        // Frames after the end of a loop are discarded
+        if (!fLoopComplete)
+        {
+            DWORD dwStart = OSD::GetTime();
+            EncodeFrame(pFrame);
+            dwEncodeTime += OSD::GetTime() - dwStart;
+            dwEncoded++;
+        }
+
+        lock.lock();
+        qPending.pop();
+        vFree.push_back(pFrame);
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 bool Start(bool fAnimLoop_)
@@ -376,6 +495,9 @@ bool Start(bool fAnimLoop_)
     // Reset the frame counters
     nDelay = 0;
     lDelayOffset = 0;
+    nUnqueuedFrames = 0;
+    dwEncoded = dwEncodeTime = 0;
+    fLoopComplete = false;
 
     // Recording a looped animation?
     nLoopState = fAnimLoop_ ? kIgnoreFirstChange : kNone;
@@ -390,6 +512,24 @@ void Stop()
     if (!f)
         return;
 
+    // Wait for the encoder to finish any queued frames
+    if (thWorker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxQueue);
+            fQuit = true;
+        }
+
+        cvQueue.notify_one();
+        thWorker.join();
+
+        TRACE("GIF: encoded %u frames in %ums (%u fps)\n", dwEncoded, dwEncodeTime,
+            dwEncodeTime ? dwEncoded * 1000 / dwEncodeTime : 0);
+    }
+
+    // Include frames that didn't reach the encoder
+    nDelay += nUnqueuedFrames;
+
     // Add any final delay to allow for identical frames at the end
     if (lDelayOffset)
         WriteGraphicControlExtensionDelay(lDelayOffset, nDelay * 2);
@@ -425,20 +565,27 @@ void AddFrame(CScreen* pScreen_)
     if (!f)
         return;
 
+    // Stop if the encoder has seen the end of a loop
+    if (fLoopComplete)
+    {
+        Stop();
+        return;
+    }
+
     // Count the frames between changes
-    nDelay++;
+    nUnqueuedFrames++;
 
     // Return if there's no screen to record
     if (!pScreen_)
         return;
 
-    WORD width = pScreen_->GetPitch() / 2;
-    WORD height = pScreen_->GetHeight() / 2;
-    DWORD size = (DWORD)width * (DWORD)height;
-
-    // If this is the first frame, write the file headers
-    if (ftell(f) == 0)
+    // If this is the first frame, write the file headers and start the encoder
+    if (!thWorker.joinable())
     {
+        wWidth = pScreen_->GetPitch() / 2;
+        wHeight = pScreen_->GetHeight() / 2;
+        DWORD size = (DWORD)wWidth * (DWORD)wHeight;
+
         pbCurr = new BYTE[size];
         pbSub = new BYTE[size];
         memset(pbCurr, 0xff, size);
@@ -452,6 +599,16 @@ void AddFrame(CScreen* pScreen_)
 
         // Set the animation to loop back to the start when it finishes
         WriteNetscapeLoopExtension();
+
+        fQuit = false;
+        vFree.clear();
+        for (auto& frame : asFrames)
+        {
+            frame.vbPixels.resize(size);
+            vFree.push_back(&frame);
+        }
+
+        thWorker = std::thread(WorkerThread);
     }
 
     // GIF isn't suited to full framerate recording, so frame-skip
@@ -459,73 +616,45 @@ void AddFrame(CScreen* pScreen_)
     if ((nFrames++ % nFrameSkip))
         return;
 
-    // Return if there were no changes from the last frame
-    if (!GetChangeRect(pbCurr, pScreen_))
-        return;
-
-    // If recording a loop, force this frame to be encoded in full
-    if (nLoopState == kWaitLoopStart)
+    GIF_FRAME* pFrame;
     {
-        // Invalidate the stored image and mark the whole region
-        memset(pbCurr, 0xff, size);
-        wl = wt = 0;
-        ww = width;
-        wh = height;
-        nDelay = 0;
-    }
+        // If the encoder is behind, skip the frame and let its time carry over to the next
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        if (vFree.empty())
+            return;
 
-    // Update our copy and encode the difference in the changed region
-    BYTE bTrans = UpdateImage(pbCurr, pScreen_);
-
-    // If recording a loop, wait for the first real change
-    if (nLoopState == kIgnoreFirstChange)
-    {
-        nLoopState = kWaitLoopStart;
-        return;
-    }
-    // If recording a loop, make a copy of the first frame
-    else if (nLoopState == kWaitLoopStart)
-    {
-        nLoopState = kLoopStarted;
-        pbFirst = new BYTE[size];
-        memcpy(pbFirst, pbCurr, size);
-    }
-    // If we're looking for the end of a loop, compare with the first frame
-    else if (pbFirst && !memcmp(pbFirst, pbCurr, size))
-    {
-        delete[] pbFirst; pbFirst = nullptr;
-        Stop();
-        return;
+        pFrame = vFree.back();
+        vFree.pop_back();
     }
 
-    // Write any accumulated delay of identical frames to the previous header
-    if (lDelayOffset)
+    // Capture alternate pixels from alternate lines
+    BYTE* pbFrame = pFrame->vbPixels.data();
+    for (int h = 0; h < wHeight; h++)
     {
-        WriteGraphicControlExtensionDelay(lDelayOffset, nDelay * 2);
-        nDelay = 0;
+        const BYTE* pb = pScreen_->GetLine(h);
+        for (int w = 0; w < wWidth; w++)
+            *pbFrame++ = pb[w * 2];
     }
 
-    // Write the GCE, storing its offset for the following delay
-    lDelayOffset = ftell(f) + 4;
-    WriteGraphicControlExtension(0, bTrans);
+    pFrame->nFrames = nUnqueuedFrames;
+    nUnqueuedFrames = 0;
 
-    // Write the image header and changed frame data
-    WriteImageDescriptor(wl, wt, ww, wh);
-
-    // Write the compressed image data
-    GifCompressor* pgc = new GifCompressor;
-    if (pgc) pgc->WriteDataBlocks(f, ww * wh, COLOUR_DEPTH);
-    delete pgc;
+    std::lock_guard<std::mutex> lock(mtxQueue);
+    qPending.push(pFrame);
+    cvQueue.notify_one();
 }
 
 } // namespace GIF
 
 ////////////////////////////////////////////////////////////////////////////////
 
-BitPacker::BitPacker(FILE* bf)
-    : binfile(bf), pos(buffer)
+void BitPacker::Start(std::vector<BYTE>* pvOut_)
 {
+    out = pvOut_;
+    pos = buffer;
     *pos = 0x00;
+    need = 8;
+    byteswritten = 0;
 }
 
 BYTE* BitPacker::AddCodeToBuffer(DWORD code, short n)
@@ -589,15 +718,15 @@ BYTE* BitPacker::AddCodeToBuffer(DWORD code, short n)
 
 
 // Packs an incoming code of n bits to the buffer. As soon as 255 bytes are full,
-// they are written to 'binfile' as a data block and cleared from 'buffer'
+// they are appended to 'out' as a data block and cleared from 'buffer'
 BYTE* BitPacker::Submit(DWORD code, WORD n)
 {
     AddCodeToBuffer(code, n);
 
     if (pos - buffer >= 255)            // pos pointing to buffer[255] or beyond
     {
-        fputc(255, binfile);            // write the "bytecount-byte"
-        fwrite(buffer, 255, 1, binfile);// write buffer[0..254] to file
+        out->push_back(255);            // write the "bytecount-byte"
+        out->insert(out->end(), buffer, buffer + 255); // write buffer[0..254]
         buffer[0] = buffer[255];        // rotate the following bytes,
         buffer[1] = buffer[256];        // which may still contain data, to the
         buffer[2] = buffer[257];        // beginning of buffer, and point
@@ -610,7 +739,7 @@ BYTE* BitPacker::Submit(DWORD code, WORD n)
 }
 
 
-// Writes any data contained in 'buffer' to the file as one data block of
+// Writes any data contained in 'buffer' to the output as one data block of
 // 1<=length<=255. Clears 'buffer' and reinitializes for new data
 void BitPacker::WriteFlush()
 {
@@ -619,8 +748,8 @@ void BitPacker::WriteFlush()
     if (pos <= buffer)          // buffer is empty
         return;
 
-    fputc((int)(pos - buffer), binfile);
-    fwrite(buffer, pos - buffer, 1, binfile);
+    out->push_back(static_cast<BYTE>(pos - buffer));
+    out->insert(out->end(), buffer, pos);
     byteswritten += (int)(pos - buffer + 1);
 
     pos = buffer;
@@ -630,38 +759,37 @@ void BitPacker::WriteFlush()
 
 ////////////////////////////////////////////////////////////////////////////////
 
-// Initialize a root node for each root code
-void GifCompressor::InitRoots()
+// The stringtable is flushed by starting a new generation, leaving just the implicit root codes
+void GifCompressor::FlushStringTable()
 {
-    WORD nofrootcodes = 1 << COLOUR_DEPTH;
+    generation += 1 << 20;
 
-    for (WORD i = 0; i < nofrootcodes; i++)
+    // Clear the table only when the generation wraps, as the old entries would match again
+    if (!generation)
     {
-        axon[i] = 0;
-        pix[i] = (BYTE)i;
-        // next[] is unused for root codes
+        memset(hashkey, 0, sizeof(hashkey));
+        generation = 1 << 20;
     }
 }
 
 
-// The stringtable is flushed by removing the outlets of all root nodes
-void GifCompressor::FlushStringTable()
+// Looks up the code for the string 'headnode' extended by 'pixel'.
+// Returns that code, or 0 if there is no such string, with *pnSlot_ set to the slot
+// to use for it. (0 cannot be a result since root nodes are never extensions).
+WORD GifCompressor::FindPixelOutlet(WORD headnode, BYTE pixel_, int* pnSlot_)
 {
-    WORD nofrootcodes = 1 << COLOUR_DEPTH;
-
-    for (WORD i = 0; i < nofrootcodes; i++)
-        axon[i] = 0;
-}
+    DWORD key = generation | ((DWORD)headnode << 8) | pixel_;
+    int slot = ((key & 0xfffff) * 2654435761U) >> 19;      // Fibonacci hash, top 13 bits
 
+    // Linear probing, which the low load factor keeps short
+    for (; (hashkey[slot] & 0xfff00000) == generation; slot = (slot + 1) & (HASH_SIZE - 1))
+    {
+        if (hashkey[slot] == key)
+            return hashcode[slot];
+    }
 
-// Checks if the chain emanating from headnode's axon contains a node for 'pixel'.
-// Returns that node's address (=code), or 0 if there is no such node.
-// (0 cannot be the root node 0, since root nodes occur in no chain).
-WORD GifCompressor::FindPixelOutlet(WORD headnode, BYTE pixel_)
-{
-    WORD outlet;
-    for (outlet = axon[headnode]; outlet && pix[outlet] != pixel_; outlet = next[outlet]);
-    return outlet;
+    *pnSlot_ = slot;
+    return 0;
 }
 
 
@@ -671,85 +799,59 @@ WORD GifCompressor::FindPixelOutlet(WORD headnode, BYTE pixel_)
 DWORD GifCompressor::DoNext()
 {
     WORD up = pixel, down;          // start with the root node for 'pixel'
+    int slot = 0;
 
     if (++curordinal >= nofdata)    // end of data stream ? Terminate
     {
-        bp->Submit(up, nbits);
+        bp.Submit(up, nbits);
         return curordinal;
     }
 
     // Follow the string table and the data stream to the end of the longest string that has a code
-    pixel = GIF::pbSub[curordinal];
+    pixel = data[curordinal];
 
-    while ((down = FindPixelOutlet(up, pixel)) != 0)
+    while ((down = FindPixelOutlet(up, pixel, &slot)) != 0)
     {
         up = down;
 
         if (++curordinal >= nofdata)        // end of data stream ? Terminate
         {
-            bp->Submit(up, nbits);
+            bp.Submit(up, nbits);
             return curordinal;
         }
 
-        pixel = GIF::pbSub[curordinal];
+        pixel = data[curordinal];
     }
 
     // Submit 'up' which is the code of the longest string ...
-    bp->Submit(up, nbits);
-
-    // ... and extend the string by appending 'pixel':
-    //  Create a successor node for 'pixel' whose code is 'freecode'...
-    pix[freecode] = pixel;
-    axon[freecode] = next[freecode] = 0;
-
-    // ...and link it to the end of the chain emanating from axon[up].
-    // Don't link it to the start instead: it would slow down performance.
+    bp.Submit(up, nbits);
 
-    down = axon[up];
-
-    if (!down)
-        axon[up] = freecode;
-    else
-    {
-        while (next[down])
-            down = next[down];
-
-        next[down] = freecode;
-    }
+    // ... and extend the string by appending 'pixel', using the empty slot found by the search
+    hashkey[slot] = generation | ((DWORD)up << 8) | pixel;
+    hashcode[slot] = freecode;
 
     return curordinal;
 }
 
 
-DWORD GifCompressor::WriteDataBlocks(FILE* bf, DWORD nof, WORD dd)
+DWORD GifCompressor::WriteDataBlocks(std::vector<BYTE>& vOut_, const BYTE* pb_, DWORD nof, WORD dd)
 {
+    data = pb_;                 // pixel data stream
     nofdata = nof;              // number of pixels in data stream
 
     curordinal = 0;             // pixel #0 is next to be processed
-    pixel = GIF::pbSub[curordinal]; // get pixel #0
+    pixel = data[curordinal];   // get pixel #0
 
     nbits = COLOUR_DEPTH + 1;       // initial size of compression codes
     cc = (1 << (nbits - 1));        // 'cc' is the lowest code requiring 'nbits' bits
     eoi = cc + 1;                   // 'end-of-information'-code
     freecode = (WORD)cc + 2;        // code of the next entry to be added to the stringtable
 
-    bp = new BitPacker(bf);     // object that does the packing of the codes and renders them to the binary file 'bf'
-    axon = new WORD[4096];
-    next = new WORD[4096];
-    pix = new BYTE[4096];
+    bp.Start(&vOut_);           // object that does the packing of the codes into 'vOut_'
 
-    if (!pix || !next || !axon || !bp)
-    {
-        delete[] pix;
-        delete[] next;
-        delete[] axon;
-        delete bp;
-        return 0;
-    }
-
-    InitRoots();                // initialize the string table's root nodes
-    fputc(COLOUR_DEPTH, bf);        // Write what the GIF specification calls the "code size", which is the colour depth
-    bp->Submit(cc, nbits);      // Submit one 'cc' as the first code
+    FlushStringTable();         // start with just the root codes
+    vOut_.push_back(COLOUR_DEPTH);  // Write what the GIF specification calls the "code size", which is the colour depth
+    bp.Submit(cc, nbits);       // Submit one 'cc' as the first code
 
     for (;;)
     {
@@ -757,17 +859,11 @@ DWORD GifCompressor::WriteDataBlocks(FILE* bf, DWORD nof, WORD dd)
 
         if (curordinal >= nofdata)  // if reached the end of data stream:
         {
-            bp->Submit(eoi, nbits); // submit 'eoi' as the last item of the code stream
-            bp->WriteFlush();       // write remaining codes including this 'eoi' to the binary file
-            fputc(0x00, bf);        // write an empty data block to signal the end of "raster data" section in the file
-
-            delete[] axon;
-            delete[] next;
-            delete[] pix;
+            bp.Submit(eoi, nbits);  // submit 'eoi' as the last item of the code stream
+            bp.WriteFlush();        // write remaining codes including this 'eoi' to the output
+            vOut_.push_back(0x00);  // write an empty data block to signal the end of "raster data" section in the file
 
-            DWORD byteswritten = 2 + bp->byteswritten;
-            delete bp;
-            return byteswritten;
+            return 2 + bp.byteswritten;
         }
 
         if (freecode == (1U << nbits))  // if the latest code added to the stringtable exceeds 'nbits' bits:
@@ -778,7 +874,7 @@ DWORD GifCompressor::WriteDataBlocks(FILE* bf, DWORD nof, WORD dd)
         if (freecode == 0xfff)
         {
             FlushStringTable();     // avoid stringtable overflow
-            bp->Submit(cc, nbits);  // tell the decoding software to flush its stringtable
+            bp.Submit(cc, nbits);   // tell the decoding software to flush its stringtable
             nbits = dd + 1;
             freecode = (WORD)cc + 2;
         }
@@ -35,8 +35,8 @@ void AddFrame(CScreen* pScreen_);
 
 /*
   Packs a sequence of variable length codes into a buffer. Every time
-  255 bytes have been completed, they are written to a binary file as a
-  data block of 256 bytes (where the first byte is the 'bytecount' of the
+  255 bytes have been completed, they are appended to the output vector as
+  a data block of 256 bytes (where the first byte is the 'bytecount' of the
   rest and therefore equals 255). Any remaining bits are moved to the
   buffer start to become part of the following block. After submitting
   the last code via Submit(), the user must call WriteFlush() to write
@@ -45,7 +45,7 @@ void AddFrame(CScreen* pScreen_);
 class BitPacker final
 {
 private:
-    FILE* binfile = nullptr;
+    std::vector<BYTE>* out = nullptr;
     BYTE buffer[260];      // holds the total buffer
     BYTE* pos = nullptr;   // points into buffer
     WORD need = 8;         // used by AddCodeToBuffer(), see there
@@ -53,10 +53,10 @@ private:
     BYTE* AddCodeToBuffer(DWORD code, short n);
 
 public:
-    BitPacker(FILE* bf);
+    void Start(std::vector<BYTE>* pvOut_);
 
 public:
-    DWORD byteswritten = 0; // number of bytes written during the object's lifetime 
+    DWORD byteswritten = 0; // number of bytes written since Start()
     BYTE* Submit(DWORD code, WORD n);
     void WriteFlush();
 };
@@ -64,39 +64,39 @@ public:
 
 class GifCompressor final
     /*
-      Contains the stringtable, generates compression codes and writes them to a
-      binary file, formatted in data blocks of maximum length 255 with
-      additional bytecount header.
-      Users will open the binary file, write the first part themselves,
-      create a GifCompressor, call its method writedatablocks(), delete it and
-      write the last byte 0x3b themselves before closing the file.
+      Contains the stringtable, generates compression codes and appends them to
+      an output buffer, formatted in data blocks of maximum length 255 with
+      additional bytecount header. One compressor is reused for every frame
+      of a recording, as the string table is reset at the start of each image.
     */
 {
 private:
-    BitPacker* bp = nullptr;  // object that does the packing and writing of the compression codes
+    BitPacker bp;             // object that does the packing of the compression codes
 
+    const BYTE* data = nullptr; // pixel data stream
     DWORD nofdata = 0;        // number of pixels in the data stream
-    DWORD width = 0;          // width of bitmap in pixels
-    DWORD height = 0;         // height of bitmap in pixels
 
     DWORD curordinal = 0;     // ordinal number of next pixel to be encoded
     BYTE pixel = 0;           // next pixel to be encoded
 
     WORD nbits = 0;           // current length of compression codes in bits (changes during encoding process)
-    WORD* axon = nullptr;     // arrays making up the stringtable
-    WORD* next = nullptr;
-    BYTE* pix = nullptr;
     DWORD cc = 0;             // "clear code" which signals the clearing of the string table
     DWORD eoi = 0;            // "end-of-information code" which must be the last item of the code stream
     WORD freecode = 0;        // next code to be added to the string table
 
+    // The stringtable is an open-addressed hash of (prefix code, pixel) keys, each mapping to the
+    // code of the extended string. It's at most half full, as there are only 4096 possible codes.
+    // Slots are tagged with the table generation, so a flush just starts a new generation.
+    static const int HASH_SIZE = 8192;
+    DWORD hashkey[HASH_SIZE]; // generation in the top 12 bits, key in the low 20 bits
+    WORD hashcode[HASH_SIZE];
+    DWORD generation = 0;
+
     void FlushStringTable();
-    void InitRoots();
     DWORD DoNext();
-    BYTE Map(DWORD);
-    WORD FindPixelOutlet(WORD headnode, BYTE pixel);
+    WORD FindPixelOutlet(WORD headnode, BYTE pixel, int* pnSlot_);
 
 public:
-    GifCompressor() = default;
-    DWORD WriteDataBlocks(FILE* bf, DWORD nof, WORD ds);
+    GifCompressor() { memset(hashkey, 0, sizeof(hashkey)); }
+    DWORD WriteDataBlocks(std::vector<BYTE>& vOut_, const BYTE* pb_, DWORD nof, WORD ds);
 };
@@ -155,8 +155,9 @@ bool CHDFHardDisk::Create(UINT uTotalSectors_)
     RS_IDE sHeader = { {'R','S','-','I','D','E'}, 0x1a, 0x11, 0x00,
                        static_cast<BYTE>(uDataOffset & 0xff), static_cast<BYTE>(uDataOffset >> 8) };
 
-    // Create the file in binary mode
-    FILE* pFile = fopen(m_strPath.c_str(), "wb");
+    // Create the file in binary mode, under a temporary name until it's complete if possible
+    std::string strTemp;
+    FILE* pFile = Util::OpenForRewrite(m_strPath.c_str(), strTemp);
     if (pFile)
     {
         // Set the sector count, and generate suitable identify data
@@ -173,12 +174,15 @@ bool CHDFHardDisk::Create(UINT uTotalSectors_)
             !fseek(pFile, lDataSize - sizeof(bNull), SEEK_CUR) &&
             fwrite(&bNull, sizeof(bNull), 1, pFile);
 
-        // Close the file (this may be slow)
-        fclose(pFile);
+        // Flush the file to disk and close it (this may be slow)
+        fRet = fRet && Util::SyncFile(pFile);
+        fRet &= !fclose(pFile);
 
-        // Remove the file if unsuccessful
-        if (!fRet)
-            unlink(m_strPath.c_str());
+        // Replace any existing file, or remove it if unsuccessful
+        if (fRet)
+            fRet = Util::CommitFile(strTemp.c_str(), m_strPath.c_str());
+        else if (!strTemp.empty())
+            unlink(strTemp.c_str());
     }
 
     return fRet;
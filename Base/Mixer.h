@@ -0,0 +1,30 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Mixer.h: Saturating mixer for 16-bit sound device output
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+namespace Mixer
+{
+const int UNITY_GAIN = 256;     // Source gains are 8.8 fixed point
+
+// Sum nSamples_ from each source into psDst_ (which may also be a source), scaled by the
+// source gains and clipped to the 16-bit range
+void Mix(int16_t* psDst_, const int16_t* const* ppsSrc_, const int* pnGain_, int nSources_, int nSamples_);
+}
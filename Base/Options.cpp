@@ -79,6 +79,14 @@ OPTION aOptions[] =
 
     OPT_N("AviReduce",    avireduce,      1),         // Record 44kHz 8-bit stereo audio (50% saving)
     OPT_F("AviScanlines", aviscanlines,   false),     // Don't include scanlines in AVI recordings
+    OPT_N("AviCodec",     avicodec,       0),         // MS-RLE video, for the widest player support
+    OPT_N("AviLevel",     avilevel,       4),         // Fast ZMBV compression
+    OPT_N("PngLevel",     pnglevel,       6),         // zlib's default compression level
+    OPT_N("PngFilter",    pngfilter,      5),         // Adaptive row filtering
+    OPT_N("PngBurst",     pngburst,       1),         // Single frame screenshots
+    OPT_F("WavFlac",      wavflac,        false),     // Record uncompressed WAV files
+    OPT_S("PipeVideo",    pipevideo,      ""),        // Raw video to simcNNNN.y4m
+    OPT_S("PipeAudio",    pipeaudio,      ""),        // Raw audio to simcNNNN.pcm
 
     OPT_S("ROM",          rom,            ""),        // No custom ROM (use built-in)
     OPT_F("RomWrite",     romwrite,       false),     // ROM is read-only
@@ -151,12 +159,18 @@ OPTION aOptions[] =
 
     OPT_F("Sound",        sound,          true),      // Sound enabled
     OPT_N("Latency",      latency,        3),         // Sound latency of 3 frames
+    OPT_N("SampleRate",   samplerate,     0),         // Sound output at the device's native rate
     OPT_N("DAC7C",        dac7c,          1),         // Blue Alpha Sampler on port &7c
     OPT_N("SamplerFreq",  samplerfreq,    18000),     // Blue Alpha clock frequency (default=18KHz)
     OPT_N("SID",          sid,            1),         // SID interface with MOS6581
+    OPT_F("SAABlip",      saablip,        false),     // Bit-exact SAASound synthesis rather than band-limited
+    OPT_F("SoundThread",  soundthread,    true),      // SID generated alongside the SAA on multi-core hosts
+    OPT_F("SoundBatch",   soundbatch,     true),      // SAA/SID writes synthesised in one batch per frame
+    OPT_S("AudioLog",     audiolog,       ""),        // No audio statistics log
 
     OPT_N("DriveLights",  drivelights,    1),         // Show drive activity lights
     OPT_F("Profile",      profile,        true),      // Show only emulation speed and framerate
+    OPT_F("ProfileAudio", profileaudio,   false),     // No sound timings or audio statistics in the profile
     OPT_F("Status",       status,         true),      // Show status line for changed options, etc.
 
     OPT_F("BreakOnExec",  breakonexec,    false),     // Don't break on code auto-execute
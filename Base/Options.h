@@ -44,6 +44,14 @@ typedef struct
 
     int     avireduce;              // Reduce AVI audio size (0=lossless to 4=muted)
     bool    aviscanlines;           // Include scanlines in AVI recording?
+    int     avicodec;               // AVI video codec (0=MS-RLE, 1=ZMBV)
+    int     avilevel;               // ZMBV compression level (1-9)
+    int     pnglevel;               // PNG compression level (0-9)
+    int     pngfilter;              // PNG row filter (0-4, or 5 for adaptive)
+    int     pngburst;               // Number of frames captured per screenshot
+    bool    wavflac;                // Record WAV audio as lossless FLAC?
+    char    pipevideo[MAX_PATH];    // File or named pipe for raw YUV4MPEG2 video output
+    char    pipeaudio[MAX_PATH];    // File or named pipe for raw PCM audio output
 
     char    rom[MAX_PATH];          // SAM ROM image path
     bool    romwrite;               // Allow writes to ROM?
@@ -118,12 +126,18 @@ typedef struct
 
     bool    sound;                  // Sound enabled?
     int     latency;                // Amount of sound buffering
+    int     samplerate;             // Sound output rate in Hz (0=device native)
     int     dac7c;                  // DAC device on shared port &7c? (0=none, 1=BlueAlpha Sampler, 2=SAMVox, 3=Paula)
     int     samplerfreq;            // Blue Alpha Sampler clock frequency
     int     sid;                    // SID chip type (0=none, 1=MOS6581, 2=MOS8580)
+    bool    saablip;                // Band-limited SAA synthesis?
+    bool    soundthread;            // Generate SID sound on a worker thread?
+    bool    soundbatch;             // Log SAA/SID writes for synthesis at frame end?
+    char    audiolog[MAX_PATH];     // File for periodic audio statistics (CSV, or JSON lines for .json)
 
     int     drivelights;            // Show floppy drive LEDs
     bool    profile;                // Show profile stats?
+    bool    profileaudio;           // Add sound timings and audio statistics to the profile stats?
     bool    status;                 // Show status line?
 
     bool    breakonexec;            // Break on code auto-execute?
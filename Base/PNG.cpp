@@ -25,6 +25,10 @@
 //  This modules relies on Zlib for compression, and if HAVE_LIBZ is not
 //  defined at compile time the whole implementation will be missing.
 //  SaveImage() becomes a no-op, and the screenshot function will not work.
+//
+//  Frames are copied into a small pool of snapshot buffers and encoded on
+//  a worker thread, so saving never stalls emulation. If the pool is full
+//  (a long burst at high compression) frames are skipped instead.
 
 #include "SimCoupe.h"
 #include "PNG.h"
@@ -108,16 +112,15 @@ static bool WriteFile(FILE* hFile_, PNG_INFO* pPNG_)
 
 
 // ZLib compress the image data (the default, and currently only method for PNG)
-static bool CompressImageData(PNG_INFO* pPNG_)
+static bool CompressImageData(PNG_INFO* pPNG_, int nLevel_)
 {
     bool fRet = false;
 
-    // ZLib says the compressed size could be at least 0.1% more than the source, plus 12 bytes
-    uLongf ulSize = ((pPNG_->uSize * 1001) / 1000) + 12;
+    uLongf ulSize = compressBound(pPNG_->uSize);
     BYTE* pbCompressed = new BYTE[ulSize];
 
     // Compress the image data
-    if (pbCompressed && compress(pbCompressed, &ulSize, pPNG_->pbImage, pPNG_->uSize) == Z_OK)
+    if (pbCompressed && compress2(pbCompressed, &ulSize, pPNG_->pbImage, pPNG_->uSize, nLevel_) == Z_OK)
     {
         // Delete the uncompressed version
         delete[] pPNG_->pbImage;
@@ -136,39 +139,86 @@ static bool CompressImageData(PNG_INFO* pPNG_)
 }
 
 
-static bool SaveFile(FILE* f_, CScreen* pScreen_)
+static inline BYTE PaethPredictor(BYTE a_, BYTE b_, BYTE c_)
+{
+    int p = a_ + b_ - c_;
+    int pa = abs(p - a_), pb = abs(p - b_), pc = abs(p - c_);
+    return (pa <= pb && pa <= pc) ? a_ : (pb <= pc) ? b_ : c_;
+}
+
+// Filter a row of RGB data, with pbPrev_ holding the unfiltered row above (all zero for the first row)
+static void FilterRow(BYTE* pbOut_, const BYTE* pbRow_, const BYTE* pbPrev_, int nBytes_, int nFilter_)
+{
+    const int BPP = 3;
+    int i;
+
+    switch (nFilter_)
+    {
+    case PNG_FILTER_VALUE_SUB:
+        for (i = 0; i < BPP; i++) pbOut_[i] = pbRow_[i];
+        for (; i < nBytes_; i++) pbOut_[i] = pbRow_[i] - pbRow_[i - BPP];
+        break;
+
+    case PNG_FILTER_VALUE_UP:
+        for (i = 0; i < nBytes_; i++) pbOut_[i] = pbRow_[i] - pbPrev_[i];
+        break;
+
+    case PNG_FILTER_VALUE_AVG:
+        for (i = 0; i < BPP; i++) pbOut_[i] = pbRow_[i] - (pbPrev_[i] >> 1);
+        for (; i < nBytes_; i++) pbOut_[i] = pbRow_[i] - ((pbRow_[i - BPP] + pbPrev_[i]) >> 1);
+        break;
+
+    case PNG_FILTER_VALUE_PAETH:
+        for (i = 0; i < BPP; i++) pbOut_[i] = pbRow_[i] - pbPrev_[i];
+        for (; i < nBytes_; i++) pbOut_[i] = pbRow_[i] - PaethPredictor(pbRow_[i - BPP], pbPrev_[i], pbPrev_[i - BPP]);
+        break;
+
+    default:
+        memcpy(pbOut_, pbRow_, nBytes_);
+        break;
+    }
+}
+
+// Sum of absolute signed values, used to estimate how well a filtered row will compress
+static UINT RowCost(const BYTE* pb_, int nBytes_)
+{
+    UINT uCost = 0;
+    for (int i = 0; i < nBytes_; i++)
+        uCost += abs(static_cast<signed char>(pb_[i]));
+    return uCost;
+}
+
+
+// Convert a snapshot to filtered RGB image data
+static bool BuildImage(PNG_INFO* pPNG_, const PNG_SNAPSHOT* pSnap_)
 {
     // Are we to stretch the saved image?
     int nDen = 5, nNum = 4;
-    bool fStretch = GetOption(ratio5_4);
-
-    // Calculate the intensity reduction for scanlines, in the range -100 to +100
-    int nScanAdjust = (GetOption(scanlines) && !GetOption(scanhires)) ? (GetOption(scanlevel) - 100) : 0;
-    if (nScanAdjust < -100) nScanAdjust = -100;
+    bool fStretch = pSnap_->fStretch;
+    int nScanAdjust = pSnap_->nScanAdjust;
+    int nPitch = pSnap_->nWidth + 1;
 
-    PNG_INFO png{};
-    png.dwWidth = pScreen_->GetPitch();
-    png.dwHeight = pScreen_->GetHeight();
-    if (fStretch) png.dwWidth = png.dwWidth * nDen / nNum;
+    pPNG_->dwWidth = pSnap_->nWidth;
+    pPNG_->dwHeight = pSnap_->nHeight;
+    if (fStretch) pPNG_->dwWidth = pPNG_->dwWidth * nDen / nNum;
 
-    png.uSize = png.dwHeight * (1 + (png.dwWidth * 3));
-    if (!(png.pbImage = new BYTE[png.uSize]))
+    int nRowBytes = pPNG_->dwWidth * 3;
+    pPNG_->uSize = pPNG_->dwHeight * (1 + nRowBytes);
+    if (!(pPNG_->pbImage = new BYTE[pPNG_->uSize]))
         return false;
 
-    memset(png.pbImage, 0, png.uSize);
-    const COLOUR* pPal = IO::GetPalette();
-
+    // Unfiltered current and previous rows, plus a scratch row for trial filtering
+    std::vector<BYTE> vbRow(nRowBytes), vbPrev(nRowBytes), vbTrial(nRowBytes);
+    const COLOUR* pPal = pSnap_->asPalette;
 
-    BYTE* pb = png.pbImage;
+    BYTE* pb = pPNG_->pbImage;
 
-    for (UINT y = 0; y < png.dwHeight; y++)
+    for (UINT y = 0; y < pPNG_->dwHeight; y++)
     {
-        BYTE* pbS = pScreen_->GetLine(y >> 1);
+        const BYTE* pbS = &pSnap_->vbPixels[(y >> 1) * nPitch];
+        BYTE* pbRow = vbRow.data();
 
-        // Each image line begins with the filter type
-        *pb++ = PNG_FILTER_TYPE_DEFAULT;
-
-        for (UINT x = 0; x < png.dwWidth; x++)
+        for (UINT x = 0; x < pPNG_->dwWidth; x++)
         {
             // Map the image pixel back to the display pixel
             int n = fStretch ? (x * nNum / nDen) : x;
@@ -199,56 +249,224 @@ static bool SaveFile(FILE* f_, CScreen* pScreen_)
             if (nScanAdjust && (y & 1))
                 AdjustBrightness(red, green, blue, nScanAdjust);
 
-            // Add the pixel to the image data
-            *pb++ = red;
-            *pb++ = green;
-            *pb++ = blue;
+            // Add the pixel to the row data
+            *pbRow++ = red;
+            *pbRow++ = green;
+            *pbRow++ = blue;
+        }
+
+        // Each image line begins with the filter type
+        int nFilter = pSnap_->nFilter;
+
+        // In adaptive mode, pick the filter giving the smallest sum of absolute differences
+        if (nFilter == PNG_FILTER_VALUE_ADAPTIVE)
+        {
+            nFilter = PNG_FILTER_VALUE_NONE;
+            UINT uBest = RowCost(vbRow.data(), nRowBytes);
+
+            for (int f = PNG_FILTER_VALUE_SUB; f <= PNG_FILTER_VALUE_PAETH; f++)
+            {
+                FilterRow(vbTrial.data(), vbRow.data(), vbPrev.data(), nRowBytes, f);
+
+                UINT uCost = RowCost(vbTrial.data(), nRowBytes);
+                if (uCost < uBest)
+                {
+                    uBest = uCost;
+                    nFilter = f;
+                }
+            }
         }
+
+        *pb++ = static_cast<BYTE>(nFilter);
+        FilterRow(pb, vbRow.data(), vbPrev.data(), nRowBytes, nFilter);
+        pb += nRowBytes;
+
+        vbRow.swap(vbPrev);
+    }
+
+    return true;
+}
+
+
+// Encode a snapshot and write it to its file, returning the status message to report
+static bool EncodeSnapshot(const PNG_SNAPSHOT* pSnap_, char* pszStatus_, size_t cbStatus_)
+{
+    DWORD dwStart = OSD::GetTime();
+
+    FILE* f = fopen(pSnap_->szPath, "wb");
+    if (!f)
+    {
+        snprintf(pszStatus_, cbStatus_, "Failed to open %s for writing!", pSnap_->szPath);
+        return false;
     }
 
-    // Compress and write the image
-    bool fRet = CompressImageData(&png) && WriteFile(f_, &png);
+    PNG_INFO png{};
+    bool fRet = BuildImage(&png, pSnap_) && CompressImageData(&png, pSnap_->nLevel) && WriteFile(f, &png);
     delete[] png.pbImage; png.pbImage = nullptr;
 
+    if (fclose(f) != 0)
+        fRet = false;
+
+    if (fRet)
+        snprintf(pszStatus_, cbStatus_, "Saved %s (%ums)", pSnap_->pszFile, OSD::GetTime() - dwStart);
+    else
+        snprintf(pszStatus_, cbStatus_, "PNG save failed!?");
+
     return fRet;
 }
 
-#endif // HAVE_LIBZ
+////////////////////////////////////////////////////////////////////////////////
 
+const int SNAPSHOT_POOL_SIZE = 8;       // Snapshots that can be waiting or in progress
 
-// Process and save the supplied SAM image data to a file in PNG format
-bool Save(CScreen* pScreen_)
+static PNG_SNAPSHOT asSnapshots[SNAPSHOT_POOL_SIZE];
+static std::vector<PNG_SNAPSHOT*> vFree;
+static std::queue<PNG_SNAPSHOT*> qPending;
+static std::string strResult;           // Most recent status message from the worker
+
+static std::thread thWorker;
+static std::mutex mtxQueue;
+static std::condition_variable cvQueue;
+static bool fQuit;
+
+static int nBurstFrames;                // Frames remaining in the current burst
+static int nDropped;                    // Frames skipped due to the pool being full
+
+static void WorkerThread()
 {
-    bool fRet = false;
+    std::unique_lock<std::mutex> lock(mtxQueue);
 
-#ifdef HAVE_LIBZ
-    char szPath[MAX_PATH], * pszFile;
+    for (;;)
+    {
+        cvQueue.wait(lock, [] { return fQuit || !qPending.empty(); });
 
-    // Create a unique filename in the format snapNNNN.png
-    pszFile = Util::GetUniqueFile("png", szPath, sizeof(szPath));
+        // Finish any queued work before quitting
+        if (qPending.empty())
+            break;
 
-    // Create the new file
-    FILE* f = fopen(szPath, "wb");
-    if (!f)
+        PNG_SNAPSHOT* pSnap = qPending.front();
+        lock.unlock();
+
+        char szStatus[MAX_PATH + 32];
+        EncodeSnapshot(pSnap, szStatus, sizeof(szStatus));
+
+        lock.lock();
+        qPending.pop();
+        vFree.push_back(pSnap);
+        strResult = szStatus;
+    }
+}
+
+// Copy the screen into a pooled buffer and queue it for encoding
+static bool QueueSnapshot(CScreen* pScreen_)
+{
+    std::lock_guard<std::mutex> lock(mtxQueue);
+
+    // Start the worker on first use, filling the free pool
+    if (!thWorker.joinable())
     {
-        Frame::SetStatus("Failed to open %s for writing!", szPath);
-        return false;
+        fQuit = false;
+        vFree.clear();
+        for (auto& snap : asSnapshots)
+            vFree.push_back(&snap);
+
+        thWorker = std::thread(WorkerThread);
     }
 
-    // Perform the actual save
-    fRet = SaveFile(f, pScreen_);
-    fclose(f);
+    // Drop the frame rather than stall emulation if the worker can't keep up
+    if (vFree.empty())
+        return false;
 
-    // Report what happened
-    if (fRet)
-        Frame::SetStatus("Saved %s", pszFile);
-    else
-        Frame::SetStatus("PNG save failed!?");
+    PNG_SNAPSHOT* pSnap = vFree.back();
+    vFree.pop_back();
+
+    // Only the even lines are used, as odd lines are repeated (or dimmed for scanlines)
+    int nWidth = pScreen_->GetPitch(), nHeight = pScreen_->GetHeight();
+    int nLines = (nHeight + 1) >> 1, nPitch = nWidth + 1;
+    pSnap->nWidth = nWidth;
+    pSnap->nHeight = nHeight;
+    pSnap->vbPixels.assign(nLines * nPitch, 0);
+
+    for (int y = 0; y < nLines; y++)
+        memcpy(&pSnap->vbPixels[y * nPitch], pScreen_->GetLine(y), nWidth);
+
+    memcpy(pSnap->asPalette, IO::GetPalette(), sizeof(pSnap->asPalette));
+
+    // Capture the settings now, as the worker mustn't touch the options
+    pSnap->fStretch = GetOption(ratio5_4);
+    pSnap->nScanAdjust = (GetOption(scanlines) && !GetOption(scanhires)) ? (GetOption(scanlevel) - 100) : 0;
+    if (pSnap->nScanAdjust < -100) pSnap->nScanAdjust = -100;
+    pSnap->nLevel = std::min(std::max(GetOption(pnglevel), 0), 9);
+    pSnap->nFilter = std::min(std::max(GetOption(pngfilter), 0), static_cast<int>(PNG_FILTER_VALUE_ADAPTIVE));
+
+    // Create a unique filename in the format snapNNNN.png
+    pSnap->pszFile = Util::GetUniqueFile("png", pSnap->szPath, sizeof(pSnap->szPath));
+
+    qPending.push(pSnap);
+    cvQueue.notify_one();
+    return true;
+}
+
+#endif // HAVE_LIBZ
+
+
+// Start a screenshot, capturing the current frame and any further burst frames
+bool Save(CScreen* pScreen_)
+{
+#ifdef HAVE_LIBZ
+    nBurstFrames = std::max(GetOption(pngburst), 1);
+    nDropped = 0;
+    AddFrame(pScreen_);
+    return true;
 #else
     Frame::SetStatus("Screen saving requires zLib");
+    return false;
 #endif
+}
 
-    return fRet;
+// Called for each completed frame, to continue a burst and report finished shots
+void AddFrame(CScreen* pScreen_)
+{
+#ifdef HAVE_LIBZ
+    if (nBurstFrames > 0)
+    {
+        nBurstFrames--;
+        if (!QueueSnapshot(pScreen_))
+            nDropped++;
+    }
+
+    // Status messages can only be set from the emulation thread
+    std::lock_guard<std::mutex> lock(mtxQueue);
+    if (!strResult.empty())
+    {
+        if (nDropped)
+            Frame::SetStatus("%s, %d skipped", strResult.c_str(), nDropped);
+        else
+            Frame::SetStatus("%s", strResult.c_str());
+
+        strResult.clear();
+    }
+#endif
+}
+
+// Finish any outstanding encodes and stop the worker
+void Exit()
+{
+#ifdef HAVE_LIBZ
+    if (thWorker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxQueue);
+            fQuit = true;
+        }
+
+        cvQueue.notify_one();
+        thWorker.join();
+    }
+
+    nBurstFrames = 0;
+    strResult.clear();
+#endif
 }
 
 } // namespace PNG
@@ -21,10 +21,13 @@
 #pragma once
 
 #include "Screen.h"
+#include "SAMIO.h"
 
 namespace PNG
 {
 bool Save(CScreen* pScreen_);
+void AddFrame(CScreen* pScreen_);
+void Exit();
 }
 
 #ifdef HAVE_LIBZ
@@ -46,6 +49,13 @@ typedef unsigned char       UINT8;
 #define PNG_FILTER_TYPE_DEFAULT     0   // Single row per-byte filtering
 #define PNG_INTERLACE_NONE          0   // Non-interlaced image
 
+#define PNG_FILTER_VALUE_NONE       0   // Per-row filter types
+#define PNG_FILTER_VALUE_SUB        1
+#define PNG_FILTER_VALUE_UP         2
+#define PNG_FILTER_VALUE_AVG        3
+#define PNG_FILTER_VALUE_PAETH      4
+#define PNG_FILTER_VALUE_ADAPTIVE   5   // Not a PNG value: pick the best filter for each row
+
 
 // PNG header
 typedef struct
@@ -67,5 +77,18 @@ typedef struct
     ULONG uSize, uCompressedSize;
 } PNG_INFO;
 
+// Screen snapshot waiting to be encoded
+typedef struct
+{
+    int nWidth, nHeight;                // Display pixels and lines
+    std::vector<BYTE> vbPixels;         // Palette indices, one spare pixel per line for stretch blending
+    COLOUR asPalette[N_PALETTE_COLOURS];
+    bool fStretch;                      // Stretch to 5:4 ratio?
+    int nScanAdjust;                    // Odd line intensity adjustment (-100 to +100)
+    int nLevel, nFilter;                // Compression settings
+    char szPath[MAX_PATH];              // Output file path
+    char* pszFile;                      // Filename part of path
+} PNG_SNAPSHOT;
+
 
 #endif  // HAVE_LIBZ
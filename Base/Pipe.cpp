@@ -0,0 +1,568 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Pipe.cpp: Raw video and audio output for external encoders
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Video is written as YUV4MPEG2 (4:2:0, BT.601 limited range) and audio as
+//  headerless PCM in the native sample format, to the files or named pipes
+//  given by the PipeVideo and PipeAudio options. With neither set, both are
+//  written to simcNNNN.y4m and simcNNNN.pcm in the output directory.
+//  For example, with mkfifo'd pipes:
+//
+//    ffmpeg -i video.fifo -f s16le -ar 44100 -ac 2 -i audio.fifo out.mp4
+//
+//  The -ar value must match the output rate, which is shown in the status
+//  text while waiting for the pipes to be opened, and once recording starts.
+//
+//  Each stream has its own writer thread, so a consumer reading one input
+//  ahead of the other can't deadlock us. Frames are copied into a fixed
+//  pool of buffers, and nothing is allocated per frame. If the consumer
+//  falls behind, the previous video frame is repeated (or the frame dropped
+//  if the queue is also full) and the status line reports it, rather than
+//  emulation stalling. Nothing is queued until every output has a reader.
+//
+//  A video frame is queued for every emulated frame, repeating the last one
+//  when the frame wasn't drawn (frame skip, turbo) or the GUI is showing, so
+//  the video stays in step with the audio, which is never gated.
+//
+//  Stopping waits for the writers to deliver any queued data. Writes don't
+//  block indefinitely, so a consumer that has stopped reading is abandoned
+//  after STOP_TIMEOUT rather than hanging emulation.
+
+#include "SimCoupe.h"
+#include "Pipe.h"
+
+#include "Frame.h"
+#include "Options.h"
+#include "SAMIO.h"
+#include "Sound.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <poll.h>
+#endif
+
+namespace Pipe
+{
+
+const int MAX_QUEUED_FRAMES = 8;    // Video frames waiting for the writer, before repeats are used
+const int MAX_QUEUED_AUDIO = 16;    // Audio frames waiting for the writer, before they're dropped
+const int QUEUE_SIZE = 32;          // Queued items per stream, including video repeats
+const int STOP_TIMEOUT = 2000;      // Time allowed for queued data to be delivered on stop (in ms)
+
+const int MAX_AUDIO_FRAME = MAX_SAMPLES_PER_FRAME * SAMPLE_BLOCK * 2;
+
+// Queued output, referring to a pool buffer
+typedef struct
+{
+    int nSlot;                  // Pool buffer, or -1 to repeat the previous video frame
+    int nLen;                   // Data length
+} PIPE_ITEM;
+
+// Output stream, with the writer thread that feeds it
+typedef struct PIPE_STREAM
+{
+    char szPath[MAX_PATH];
+    const char* pszFile;
+    bool fEnabled;
+
+    std::vector<std::vector<BYTE>> vbSlots;     // Preallocated data buffers
+    std::vector<int> vFree;                     // Free buffer indices
+    PIPE_ITEM aQueue[QUEUE_SIZE];               // Ring of items waiting to be written
+    int nHead, nCount;
+
+    std::thread thWriter;
+    std::mutex mtxQueue;
+    std::condition_variable cvQueue, cvDone;
+    bool fQuit, fDone;
+    std::atomic<bool> fOpen, fFailed, fAbort;
+
+    DWORD dwWritten;
+} PIPE_STREAM;
+
+static PIPE_STREAM sVideo, sAudio;
+
+static bool fRecording, fStarted;
+static bool fHalfSize;
+static int width, height;
+static DWORD dwFrames, dwRepeated, dwDropped, dwLateReported;
+static int nSinceReport;
+
+static BYTE abY[256], abU[256], abV[256];   // Palette index to YUV
+static std::vector<BYTE> vbYUV;             // Converted frame (writer thread)
+
+// Build the YUV palette lookup, using BT.601 limited range
+static void PreparePalette()
+{
+    const COLOUR* pcPal = IO::GetPalette();
+
+    for (int i = 0; i < 256; i++)
+    {
+        const COLOUR& c = pcPal[i % N_PALETTE_COLOURS];
+        int r = c.bRed, g = c.bGreen, b = c.bBlue;
+
+        abY[i] = static_cast<BYTE>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        abU[i] = static_cast<BYTE>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        abV[i] = static_cast<BYTE>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+// Convert a frame of palette indices to planar 4:2:0, averaging chroma over each 2x2 block
+static void ConvertFrame(const BYTE* pb_)
+{
+    BYTE* pbY = vbYUV.data();
+    BYTE* pbU = pbY + width * height;
+    BYTE* pbV = pbU + (width / 2) * (height / 2);
+
+    for (int i = 0; i < width * height; i++)
+        pbY[i] = abY[pb_[i]];
+
+    for (int y = 0; y < height; y += 2)
+    {
+        const BYTE* pb0 = pb_ + width * y;
+        const BYTE* pb1 = pb0 + width;
+
+        for (int x = 0; x < width; x += 2)
+        {
+            *pbU++ = static_cast<BYTE>((abU[pb0[x]] + abU[pb0[x + 1]] + abU[pb1[x]] + abU[pb1[x + 1]] + 2) >> 2);
+            *pbV++ = static_cast<BYTE>((abV[pb0[x]] + abV[pb0[x + 1]] + abV[pb1[x]] + abV[pb1[x + 1]] + 2) >> 2);
+        }
+    }
+}
+
+// Write a block of data, giving up if the stream is aborted while the consumer isn't reading
+static bool WriteData(PIPE_STREAM* ps_, FILE* f_, const void* pv_, size_t uLen_)
+{
+#ifdef _WIN32
+    // A write blocked on a stalled consumer is cancelled by StopWriter
+    return !ps_->fAbort && fwrite(pv_, uLen_, 1, f_) == 1;
+#else
+    const BYTE* pb = reinterpret_cast<const BYTE*>(pv_);
+    int fd = fileno(f_);
+
+    while (uLen_)
+    {
+        ssize_t nWritten = write(fd, pb, uLen_);
+        if (nWritten > 0)
+        {
+            pb += nWritten;
+            uLen_ -= nWritten;
+        }
+        else if (nWritten < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return false;
+        else if (ps_->fAbort)
+            return false;
+        else
+        {
+            // Wait for the consumer to make room, checking regularly for an abort
+            pollfd pfd = { fd, POLLOUT, 0 };
+            poll(&pfd, 1, 100);
+        }
+    }
+
+    return true;
+#endif
+}
+
+static bool WriteItem(PIPE_STREAM* ps_, FILE* f_, const PIPE_ITEM& item_)
+{
+    if (ps_ == &sAudio)
+        return WriteData(ps_, f_, ps_->vbSlots[item_.nSlot].data(), item_.nLen);
+
+    // A repeat writes the previous converted frame again
+    if (item_.nSlot >= 0)
+        ConvertFrame(ps_->vbSlots[item_.nSlot].data());
+
+    static const char szFrame[] = "FRAME\n";
+    return WriteData(ps_, f_, szFrame, sizeof(szFrame) - 1) && WriteData(ps_, f_, vbYUV.data(), vbYUV.size());
+}
+
+// Flag the writer as finished, for StopWriter
+static void WriterDone(PIPE_STREAM* ps_)
+{
+    std::lock_guard<std::mutex> lock(ps_->mtxQueue);
+    ps_->fDone = true;
+    ps_->cvDone.notify_one();
+}
+
+static void WriterThread(PIPE_STREAM* ps_)
+{
+#ifndef _WIN32
+    // Report a closed pipe as a write error rather than a fatal signal
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &ss, nullptr);
+#endif
+
+    // Opening a named pipe blocks until the consumer connects
+    FILE* f = fopen(ps_->szPath, "wb");
+    if (!f)
+    {
+        ps_->fFailed = true;
+        WriterDone(ps_);
+        return;
+    }
+
+#ifndef _WIN32
+    // Write without blocking, so a stalled consumer can be abandoned
+    fcntl(fileno(f), F_SETFL, fcntl(fileno(f), F_GETFL) | O_NONBLOCK);
+#endif
+
+    bool fOK = true;
+
+    if (ps_ == &sVideo)
+    {
+        char szHeader[128];
+        int nLen = snprintf(szHeader, sizeof(szHeader), "YUV4MPEG2 W%d H%d F%lu:%d Ip A1:1 C420jpeg XYSCSS=420JPEG\n",
+            width, height, REAL_TSTATES_PER_SECOND, TSTATES_PER_FRAME);
+        fOK = WriteData(ps_, f, szHeader, nLen);
+
+        // Repeats before the first frame show black
+        memset(vbYUV.data(), 16, width * height);
+        memset(vbYUV.data() + width * height, 128, vbYUV.size() - width * height);
+    }
+
+    ps_->fOpen = true;
+    ps_->fFailed = !fOK;
+
+    std::unique_lock<std::mutex> lock(ps_->mtxQueue);
+
+    while (fOK)
+    {
+        ps_->cvQueue.wait(lock, [&] { return ps_->fQuit || ps_->nCount; });
+
+        // Finish any queued data before quitting
+        if (!ps_->nCount)
+            break;
+
+        PIPE_ITEM item = ps_->aQueue[ps_->nHead];
+        ps_->nHead = (ps_->nHead + 1) % QUEUE_SIZE;
+        ps_->nCount--;
+        lock.unlock();
+
+        fOK = WriteItem(ps_, f, item);
+
+        lock.lock();
+
+        // Return the buffer to the pool
+        if (item.nSlot >= 0)
+            ps_->vFree.push_back(item.nSlot);
+
+        if (!fOK)
+        {
+            ps_->fFailed = true;
+            break;
+        }
+
+        ps_->dwWritten++;
+    }
+
+    lock.unlock();
+    fclose(f);
+
+    WriterDone(ps_);
+}
+
+static void StartWriter(PIPE_STREAM* ps_, int nSlots_, int nSlotSize_)
+{
+    ps_->vbSlots.assign(nSlots_, std::vector<BYTE>(nSlotSize_));
+    ps_->vFree.clear();
+    ps_->vFree.reserve(nSlots_);
+    for (int i = nSlots_ - 1; i >= 0; i--)
+        ps_->vFree.push_back(i);
+
+    ps_->nHead = ps_->nCount = 0;
+    ps_->fQuit = ps_->fDone = false;
+    ps_->fOpen = ps_->fFailed = ps_->fAbort = false;
+    ps_->dwWritten = 0;
+    ps_->thWriter = std::thread(WriterThread, ps_);
+}
+
+static void StopWriter(PIPE_STREAM* ps_)
+{
+    if (!ps_->thWriter.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(ps_->mtxQueue);
+        ps_->fQuit = true;
+    }
+
+    ps_->cvQueue.notify_one();
+
+#ifndef _WIN32
+    // Connect to a named pipe ourselves if the consumer never did, to release the writer
+    int fd = -1;
+    if (!ps_->fOpen && !ps_->fFailed)
+        fd = open(ps_->szPath, O_RDONLY | O_NONBLOCK);
+#endif
+
+    // Give the writer a limited time to deliver queued data, then abandon a stalled consumer
+    {
+        std::unique_lock<std::mutex> lock(ps_->mtxQueue);
+        if (!ps_->cvDone.wait_for(lock, std::chrono::milliseconds(STOP_TIMEOUT), [&] { return ps_->fDone; }))
+        {
+            TRACE("!!! Pipe: abandoning stalled output to %s\n", ps_->pszFile);
+            ps_->fAbort = true;
+#ifdef _WIN32
+            CancelSynchronousIo(ps_->thWriter.native_handle());
+#endif
+        }
+    }
+
+    ps_->thWriter.join();
+
+#ifndef _WIN32
+    if (fd != -1)
+        close(fd);
+#endif
+
+    std::vector<std::vector<BYTE>>().swap(ps_->vbSlots);
+}
+
+// Take a free buffer from the pool, or -1 if the writer is behind
+static int AllocSlot(PIPE_STREAM* ps_)
+{
+    std::lock_guard<std::mutex> lock(ps_->mtxQueue);
+    if (ps_->vFree.empty())
+        return -1;
+
+    int nSlot = ps_->vFree.back();
+    ps_->vFree.pop_back();
+    return nSlot;
+}
+
+// Queue an item for the writer, returning false if the queue is full
+static bool QueueItem(PIPE_STREAM* ps_, int nSlot_, int nLen_)
+{
+    {
+        std::lock_guard<std::mutex> lock(ps_->mtxQueue);
+        if (ps_->nCount == QUEUE_SIZE)
+        {
+            if (nSlot_ >= 0)
+                ps_->vFree.push_back(nSlot_);
+            return false;
+        }
+
+        PIPE_ITEM& item = ps_->aQueue[(ps_->nHead + ps_->nCount++) % QUEUE_SIZE];
+        item.nSlot = nSlot_;
+        item.nLen = nLen_;
+    }
+
+    ps_->cvQueue.notify_one();
+    return true;
+}
+
+// Report any frames lost to a slow consumer, at most once a second
+static void ReportLate()
+{
+    DWORD dwLate = dwRepeated + dwDropped;
+
+    if (++nSinceReport >= EMULATED_FRAMES_PER_SECOND && dwLate != dwLateReported)
+    {
+        Frame::SetStatus("Pipe output behind (%u repeated, %u dropped)", dwRepeated, dwDropped);
+        dwLateReported = dwLate;
+        nSinceReport = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Start(bool fHalfSize_)
+{
+    if (fRecording)
+        return false;
+
+    strncpy(sVideo.szPath, GetOption(pipevideo), sizeof(sVideo.szPath) - 1);
+    sVideo.szPath[sizeof(sVideo.szPath) - 1] = '\0';
+    strncpy(sAudio.szPath, GetOption(pipeaudio), sizeof(sAudio.szPath) - 1);
+    sAudio.szPath[sizeof(sAudio.szPath) - 1] = '\0';
+    sVideo.pszFile = sVideo.szPath;
+    sAudio.pszFile = sAudio.szPath;
+
+    // With no outputs given, use unique files in the format simcNNNN.y4m and simcNNNN.pcm
+    if (!sVideo.szPath[0] && !sAudio.szPath[0])
+    {
+        sVideo.pszFile = Util::GetUniqueFile("y4m", sVideo.szPath, sizeof(sVideo.szPath));
+        sAudio.pszFile = Util::GetUniqueFile("pcm", sAudio.szPath, sizeof(sAudio.szPath));
+    }
+
+    sVideo.fEnabled = sVideo.szPath[0] != '\0';
+    sAudio.fEnabled = sAudio.szPath[0] != '\0';
+
+    dwFrames = dwRepeated = dwDropped = dwLateReported = 0;
+    nSinceReport = 0;
+
+    fHalfSize = fHalfSize_;
+    fRecording = true;
+    fStarted = false;
+
+    TRACE("Pipe: audio is %d-bit %d-channel PCM at %dHz\n", SAMPLE_BITS, SAMPLE_CHANNELS, Sound::GetSampleFreq());
+
+    // The PCM output has no header, so show the rate the consumer must be given
+    if (sAudio.fEnabled)
+        Frame::SetStatus("Waiting for pipe output (audio %dHz)", Sound::GetSampleFreq());
+    else
+        Frame::SetStatus("Waiting for pipe output");
+    return true;
+}
+
+void Stop()
+{
+    // Ignore if we're not recording
+    if (!fRecording)
+        return;
+
+    // Wait for the writers to deliver anything already queued
+    StopWriter(&sVideo);
+    StopWriter(&sAudio);
+    std::vector<BYTE>().swap(vbYUV);
+
+    fRecording = false;
+
+    TRACE("Pipe: %u frames, %u repeated, %u dropped\n", dwFrames, dwRepeated, dwDropped);
+
+    if (sVideo.fFailed || sAudio.fFailed)
+        Frame::SetStatus("Pipe output to %s failed", (sVideo.fFailed ? sVideo : sAudio).pszFile);
+    else if (dwRepeated || dwDropped)
+        Frame::SetStatus("Pipe output stopped (%u repeated, %u dropped)", dwRepeated, dwDropped);
+    else
+        Frame::SetStatus("Pipe output stopped");
+}
+
+void Toggle(bool fHalfSize_)
+{
+    if (!fRecording)
+        Start(fHalfSize_);
+    else
+        Stop();
+}
+
+bool IsRecording()
+{
+    return fRecording;
+}
+
+
+// Add a video frame to the output, or repeat the previous frame if none was drawn
+void AddFrame(CScreen* pScreen_)
+{
+    if (!fRecording)
+        return;
+
+    // Stop if a consumer has gone away
+    if (sVideo.fFailed || sAudio.fFailed)
+    {
+        Stop();
+        return;
+    }
+
+    // Start the writers on the first drawn frame, now the display size is known
+    if (!sVideo.thWriter.joinable() && !sAudio.thWriter.joinable())
+    {
+        if (!pScreen_)
+            return;
+
+        // The 4:2:0 chroma needs even dimensions
+        width = (pScreen_->GetPitch() >> (fHalfSize ? 1 : 0)) & ~1;
+        height = (pScreen_->GetHeight() >> (fHalfSize ? 1 : 0)) & ~1;
+
+        PreparePalette();
+        vbYUV.resize(width * height + (width / 2) * (height / 2) * 2);
+
+        if (sVideo.fEnabled)
+            StartWriter(&sVideo, MAX_QUEUED_FRAMES, width * height);
+
+        if (sAudio.fEnabled)
+            StartWriter(&sAudio, MAX_QUEUED_AUDIO, MAX_AUDIO_FRAME);
+    }
+
+    // Nothing is queued until every output has a reader, to keep the streams in sync
+    if (!fStarted)
+    {
+        if ((sVideo.fEnabled && !sVideo.fOpen) || (sAudio.fEnabled && !sAudio.fOpen))
+            return;
+
+        fStarted = true;
+
+        if (sAudio.fEnabled)
+            Frame::SetStatus("Recording to pipe (audio %dHz)", Sound::GetSampleFreq());
+        else
+            Frame::SetStatus("Recording to pipe");
+    }
+
+    if (!sVideo.fEnabled)
+        return;
+
+    int nSlot = pScreen_ ? AllocSlot(&sVideo) : -1;
+
+    if (nSlot >= 0)
+    {
+        // Decide if we should sample the odd pixel for mode 3 lines
+        int nMode3 = GetOption(mode3) ? 1 : 0;
+        BYTE* pbFrame = sVideo.vbSlots[nSlot].data();
+
+        for (int y = 0; y < height; y++)
+        {
+            const BYTE* pbLine = pScreen_->GetLine(y >> (fHalfSize ? 0 : 1));
+            BYTE* pb = pbFrame + width * y;
+
+            if (fHalfSize)
+            {
+                for (int i = 0; i < width; i++)
+                    pb[i] = pbLine[i * 2 + nMode3];
+            }
+            else
+                memcpy(pb, pbLine, width);
+        }
+    }
+
+    // If the writer is behind, repeat the previous frame, or drop it if the queue is also full
+    if (!QueueItem(&sVideo, nSlot, width * height))
+        dwDropped++;
+    else if (nSlot < 0 && pScreen_)
+        dwRepeated++;
+
+    dwFrames++;
+    ReportLate();
+}
+
+// Add an audio frame to the output
+void AddFrame(const BYTE* pb_, int nLen_)
+{
+    if (!fRecording || !fStarted || !sAudio.fEnabled)
+        return;
+
+    nLen_ = std::min(nLen_, MAX_AUDIO_FRAME);
+
+    int nSlot = AllocSlot(&sAudio);
+    if (nSlot < 0)
+    {
+        dwDropped++;
+        return;
+    }
+
+    memcpy(sAudio.vbSlots[nSlot].data(), pb_, nLen_);
+
+    if (!QueueItem(&sAudio, nSlot, nLen_))
+        dwDropped++;
+}
+
+} // namespace Pipe
@@ -0,0 +1,195 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Resampler.cpp: Band-limited streaming resampler for non-100% running speeds
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Each output sample is a dot product of the input history with one phase
+//  of a Blackman-windowed sinc filter, from a table of 256 phases between
+//  input samples. When running fast the cutoff is lowered to the output
+//  Nyquist frequency, and the filter lengthened to match, so the dropped
+//  frequencies don't alias back into the audible range. When running slow
+//  the filter interpolates the new samples instead of repeating them.
+//
+//  The history is kept as floats per channel so the dot product can use
+//  SSE or NEON 4 taps at a time, with the filter length a multiple of 8.
+
+#include "SimCoupe.h"
+#include "Resampler.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+const int FILTER_PHASES = 256;      // Filter phases between input samples
+const int BASE_HALF_TAPS = 8;       // Taps either side of the output point at 100% speed
+const double PASSBAND = 0.90;       // Proportion of the output Nyquist frequency kept
+
+static float DotProduct(const float* pf1_, const float* pf2_, int nLen_)
+{
+#if defined(USE_SSE)
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+
+    for (int i = 0; i < nLen_; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pf1_ + i), _mm_loadu_ps(pf2_ + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pf1_ + i + 4), _mm_loadu_ps(pf2_ + i + 4)));
+    }
+
+    float af[4];
+    _mm_storeu_ps(af, _mm_add_ps(sum0, sum1));
+    return af[0] + af[1] + af[2] + af[3];
+#elif defined(USE_NEON)
+    float32x4_t sum0 = vdupq_n_f32(0.0f), sum1 = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nLen_; i += 8)
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(pf1_ + i), vld1q_f32(pf2_ + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(pf1_ + i + 4), vld1q_f32(pf2_ + i + 4));
+    }
+
+    float32x4_t sum = vaddq_f32(sum0, sum1);
+    return vgetq_lane_f32(sum, 0) + vgetq_lane_f32(sum, 1) + vgetq_lane_f32(sum, 2) + vgetq_lane_f32(sum, 3);
+#else
+    float f = 0.0f;
+    for (int i = 0; i < nLen_; i++)
+        f += pf1_[i] * pf2_[i];
+    return f;
+#endif
+}
+
+
+// Set the input rate as a percentage of the output rate, which is the running speed
+void CResampler::SetRatio(int nPercent_)
+{
+    nPercent_ = std::min(std::max(nPercent_, 50), 1000);
+
+    if (nPercent_ != m_nPercent || m_vfFilter.empty())
+    {
+        m_nPercent = nPercent_;
+        BuildFilter();
+        Reset();
+    }
+}
+
+void CResampler::Reset()
+{
+    // Prime the history with silence, so the filter is full from the start
+    for (auto& vf : m_avHistory)
+        vf.assign(m_nTaps, 0.0f);
+
+    m_dPos = m_nTaps / 2;
+}
+
+void CResampler::BuildFilter()
+{
+    const double PI = 3.14159265358979323846;
+
+    // Lower the cutoff when decimating, lengthening the filter to keep the same transition steepness
+    double dScale = std::max(m_nPercent / 100.0, 1.0);
+    double dCutoff = 0.5 * PASSBAND / dScale;
+    int nHalf = static_cast<int>(std::ceil(BASE_HALF_TAPS * dScale));
+    m_nTaps = (nHalf * 2 + 7) & ~7;
+
+    m_vfFilter.resize((FILTER_PHASES + 1) * m_nTaps);
+
+    // Phase p is for an output point p/FILTER_PHASES after the centre tap
+    for (int p = 0; p <= FILTER_PHASES; p++)
+    {
+        float* pf = &m_vfFilter[p * m_nTaps];
+        double dSum = 0.0;
+
+        for (int k = 0; k < m_nTaps; k++)
+        {
+            double t = (k - m_nTaps / 2 + 1) - static_cast<double>(p) / FILTER_PHASES;
+            double x = 2.0 * dCutoff * t;
+            double dSinc = (t == 0.0) ? 1.0 : std::sin(PI * x) / (PI * x);
+
+            double w = t / (m_nTaps / 2);
+            double dWindow = (std::fabs(w) >= 1.0) ? 0.0 : 0.42 + 0.5 * std::cos(PI * w) + 0.08 * std::cos(2 * PI * w);
+
+            pf[k] = static_cast<float>(dSinc * dWindow);
+            dSum += pf[k];
+        }
+
+        // Normalise for unity gain at DC
+        for (int k = 0; k < m_nTaps; k++)
+            pf[k] = static_cast<float>(pf[k] / dSum);
+    }
+
+    TRACE("Resampler: %d%% speed, %d taps, cutoff %.3f\n", m_nPercent, m_nTaps, dCutoff);
+}
+
+// Resample interleaved 16-bit input, returning the number of frames written to psOut_
+int CResampler::Process(const int16_t* psIn_, int nFrames_, int16_t* psOut_, int nMaxFrames_)
+{
+    if (m_vfFilter.empty())
+        SetRatio(m_nPercent);
+
+    // Append the new samples to the history of each channel
+    for (int c = 0; c < m_nChannels; c++)
+    {
+        auto& vf = m_avHistory[c];
+        size_t uOld = vf.size();
+        vf.resize(uOld + nFrames_);
+
+        for (int i = 0; i < nFrames_; i++)
+            vf[uOld + i] = psIn_[i * m_nChannels + c];
+    }
+
+    int nHistory = static_cast<int>(m_avHistory[0].size());
+    double dStep = m_nPercent / 100.0;
+    int nOut = 0;
+
+    // Generate output while the filter has all the input it needs
+    for (; nOut < nMaxFrames_; nOut++, m_dPos += dStep)
+    {
+        int nIndex = static_cast<int>(m_dPos);
+        int nPhase = static_cast<int>((m_dPos - nIndex) * FILTER_PHASES + 0.5);
+        int nFirst = nIndex - m_nTaps / 2 + 1;
+
+        if (nFirst + m_nTaps > nHistory)
+            break;
+
+        const float* pfFilter = &m_vfFilter[nPhase * m_nTaps];
+
+        for (int c = 0; c < m_nChannels; c++)
+        {
+            float f = DotProduct(&m_avHistory[c][nFirst], pfFilter, m_nTaps);
+            *psOut_++ = static_cast<int16_t>(std::min(std::max(static_cast<int>(std::lround(f)), -32768), 32767));
+        }
+    }
+
+    // Discard history that's no longer needed
+    int nDiscard = std::min(static_cast<int>(m_dPos) - m_nTaps / 2 + 1, nHistory);
+    if (nDiscard > 0)
+    {
+        for (auto& vf : m_avHistory)
+            vf.erase(vf.begin(), vf.begin() + nDiscard);
+
+        m_dPos -= nDiscard;
+    }
+
+    return nOut;
+}
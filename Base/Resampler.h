@@ -0,0 +1,46 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Resampler.h: Band-limited streaming resampler for non-100% running speeds
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+class CResampler final
+{
+public:
+    CResampler(int nChannels_) : m_nChannels(nChannels_), m_avHistory(nChannels_) { }
+    CResampler(const CResampler&) = delete;
+    void operator= (const CResampler&) = delete;
+
+public:
+    void SetRatio(int nPercent_);
+    void Reset();
+    int Process(const int16_t* psIn_, int nFrames_, int16_t* psOut_, int nMaxFrames_);
+
+protected:
+    void BuildFilter();
+
+protected:
+    int m_nChannels = 0;
+    int m_nPercent = 100;               // Input rate as a percentage of output rate
+    int m_nTaps = 0;                    // Filter length, a multiple of 8
+    double m_dPos = 0.0;                // Next output position in the history
+
+    std::vector<float> m_vfFilter;      // Polyphase filter table
+    std::vector<std::vector<float>> m_avHistory;
+};
@@ -0,0 +1,503 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// SAABlip.cpp: Band-limited event-driven SAA 1099 synthesis
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Rather than ticking every generator once per output sample, this works
+//  out when each tone and noise generator will next change, and steps from
+//  one change to the next. Each change in the mixed output is passed to a
+//  Blip_Synth at its exact time, so the output is band-limited like the DAC.
+//
+//  Tone half-cycles last 192*(511-offset)/2^octave T-states, and the noise
+//  clock 192*2^mode, so times are kept in 1/128ths of a T-state to hold
+//  every period exactly. Generators whose changes can't currently be heard,
+//  and don't clock the noise or envelope, are skipped over in a single step
+//  when a register write next needs them to be up to date.
+//
+//  The register behaviour follows Dave Hooper's SAA1099.cpp, whose envelope
+//  generator is used as-is.
+
+#include "SimCoupe.h"
+#include "SAABlip.h"
+
+#include "SAA1099.h"
+
+const int TIME_SHIFT = 7;           // Event times are in 1/128ths of a T-state
+const int TONE_UNIT = 192;          // T-states per tone counter step at octave 0
+const int NOISE_UNIT = 192;         // T-states per noise clock in mode 0
+const int MAX_AMP_OUTPUT = 480;     // Maximum output level from each amplifier
+
+static inline void NextRand(uint32_t& uRand_)
+{
+    if ((uRand_ & 0x40000004) && ((uRand_ & 0x40000004) != 0x40000004))
+        uRand_ = (uRand_ << 1) + 1;
+    else
+        uRand_ <<= 1;
+}
+
+
+CSAABlip::CSAABlip(long lClockRate_, long lSampleRate_)
+{
+    m_bufLeft.clock_rate(lClockRate_);
+    m_bufRight.clock_rate(lClockRate_);
+    m_bufLeft.set_sample_rate(lSampleRate_);
+    m_bufRight.set_sample_rate(lSampleRate_);
+
+    m_synthLeft.output(&m_bufLeft);
+    m_synthRight.output(&m_bufRight);
+
+    // Match the level of the sample-based emulation, which scales its output by 10
+    m_synthLeft.volume(6 * MAX_AMP_OUTPUT * 10 / 65536.0);
+    m_synthRight.volume(6 * MAX_AMP_OUTPUT * 10 / 65536.0);
+
+    m_apEnv[0] = new CSAAEnv;
+    m_apEnv[1] = new CSAAEnv;
+
+    m_aNoise[0].uRand = 0x14af5209;
+    m_aNoise[1].uRand = 0x76a9b11e;
+
+    for (auto& osc : m_aOsc)
+        SetPeriod(osc);
+
+    for (auto& noise : m_aNoise)
+        noise.nPeriod = NOISE_UNIT << TIME_SHIFT;
+
+    Clear();
+}
+
+CSAABlip::~CSAABlip()
+{
+    delete m_apEnv[0];
+    delete m_apEnv[1];
+}
+
+
+// Reset to the power-on state, as CSAASound::Clear() does
+void CSAABlip::Clear()
+{
+    WriteAddress(0, 28);
+    WriteData(0, 0x02);
+
+    for (int i = 31; i >= 0; i--)
+    {
+        if (i != 28)
+        {
+            WriteAddress(0, i);
+            WriteData(0, 0x00);
+        }
+    }
+
+    WriteAddress(0, 28);
+    WriteData(0, 0x00);
+    WriteAddress(0, 0);
+}
+
+void CSAABlip::WriteAddress(DWORD dwTime_, BYTE bReg_)
+{
+    int nTime = static_cast<int>(std::min(dwTime_, static_cast<DWORD>(TSTATES_PER_FRAME))) << TIME_SHIFT;
+    RunTo(nTime);
+    CatchUp(nTime);
+
+    m_bReg = bReg_ & 0x1f;
+
+    // Selecting an envelope control register also clocks it, if it's externally clocked
+    if (m_bReg == 24 || m_bReg == 25)
+    {
+        m_apEnv[m_bReg - 24]->ExternalClock();
+        UpdateOutput(nTime);
+    }
+}
+
+void CSAABlip::WriteData(DWORD dwTime_, BYTE bData_)
+{
+    int nTime = static_cast<int>(std::min(dwTime_, static_cast<DWORD>(TSTATES_PER_FRAME))) << TIME_SHIFT;
+    RunTo(nTime);
+    CatchUp(nTime);
+
+    switch (m_bReg)
+    {
+    case 0: case 1: case 2: case 3: case 4: case 5:
+        m_abAmp[m_bReg] = bData_;
+        break;
+
+    case 8: case 9: case 10: case 11: case 12: case 13:
+        SetOffset(m_aOsc[m_bReg - 8], bData_);
+        break;
+
+    case 16: case 17: case 18:
+        SetOctave(m_aOsc[(m_bReg - 16) * 2], bData_ & 0x07);
+        SetOctave(m_aOsc[(m_bReg - 16) * 2 + 1], (bData_ >> 4) & 0x07);
+        break;
+
+    case 20:
+        m_bToneMix = bData_ & 0x3f;
+        break;
+
+    case 21:
+        m_bNoiseMix = bData_ & 0x3f;
+        break;
+
+    case 22:
+        SetNoiseSource(m_aNoise[0], bData_ & 0x03, nTime);
+        SetNoiseSource(m_aNoise[1], (bData_ >> 4) & 0x03, nTime);
+        break;
+
+    case 24: case 25:
+        m_apEnv[m_bReg - 24]->SetEnvControl(bData_);
+        break;
+
+    case 28:
+        if (bData_ & 0x02)
+        {
+            // Sync holds the generators at the start of a cycle, with any new frequency applied
+            for (auto& osc : m_aOsc)
+            {
+                osc.bLevel = 2;
+                osc.bOctave = osc.bNextOctave;
+                osc.bOffset = osc.bNextOffset;
+                SetPeriod(osc);
+            }
+        }
+        else if (m_fSync)
+        {
+            // Released generators start counting from now
+            for (auto& osc : m_aOsc)
+                osc.nNext = nTime + osc.nPeriod;
+
+            for (auto& noise : m_aNoise)
+                noise.nNext = nTime + noise.nPeriod;
+        }
+
+        m_fSync = (bData_ & 0x02) != 0;
+        m_fEnabled = (bData_ & 0x01) != 0;
+        break;
+    }
+
+    SetActive();
+    UpdateOutput(nTime);
+}
+
+// Complete the frame, reading up to the given number of stereo samples into the buffer, or discarding them if none
+int CSAABlip::EndFrame(DWORD dwTime_, BYTE* pb_, int nMaxSamples_)
+{
+    int nTime = static_cast<int>(dwTime_) << TIME_SHIFT;
+    RunTo(nTime);
+    CatchUp(nTime);
+
+    m_bufLeft.end_frame(dwTime_);
+    m_bufRight.end_frame(dwTime_);
+
+    // Event times are relative to the start of the frame
+    for (auto& osc : m_aOsc)
+        osc.nNext -= nTime;
+
+    for (auto& noise : m_aNoise)
+        noise.nNext -= nTime;
+
+    if (!pb_)
+    {
+        long lSamples = std::min(m_bufLeft.samples_avail(), static_cast<long>(nMaxSamples_));
+        m_bufLeft.remove_samples(lSamples);
+        m_bufRight.remove_samples(lSamples);
+        return 0;
+    }
+
+    blip_sample_t* ps = reinterpret_cast<blip_sample_t*>(pb_);
+    int nSamples = static_cast<int>(m_bufLeft.read_samples(ps, nMaxSamples_, 1));
+    m_bufRight.read_samples(ps + 1, nMaxSamples_, 1);
+
+    return nSamples;
+}
+
+
+// Process the changes from generators that need them, up to the given time
+void CSAABlip::RunTo(int nTime_)
+{
+    // Inactive generators are given an event time beyond the end of the frame
+    int anNext[8];
+    for (int i = 0; i < 6; i++)
+        anNext[i] = m_aOsc[i].fActive ? m_aOsc[i].nNext : INT_MAX;
+    for (int i = 0; i < 2; i++)
+        anNext[6 + i] = m_aNoise[i].fActive ? m_aNoise[i].nNext : INT_MAX;
+
+    for (;;)
+    {
+        int nNext = anNext[0], nWhich = 0;
+
+        for (int i = 1; i < 8; i++)
+        {
+            if (anNext[i] < nNext)
+            {
+                nNext = anNext[i];
+                nWhich = i;
+            }
+        }
+
+        if (nNext > nTime_)
+            break;
+
+        if (nWhich < 6)
+        {
+            int nAmps = Toggle(nWhich);
+            anNext[nWhich] = m_aOsc[nWhich].nNext;
+            UpdateOutput(nNext, nAmps);
+        }
+        else
+        {
+            auto& noise = m_aNoise[nWhich - 6];
+            uint32_t uOld = noise.uRand;
+            NextRand(noise.uRand);
+            anNext[nWhich] = noise.nNext += noise.nPeriod;
+
+            // Only the low bit is heard, and it's unchanged about half the time
+            if ((noise.uRand ^ uOld) & 1)
+                UpdateOutput(nNext, 0x07 << ((nWhich - 6) * 3));
+        }
+    }
+}
+
+// Bring the remaining generators up to date, without the work of visiting each change
+void CSAABlip::CatchUp(int nTime_)
+{
+    if (m_fSync)
+        return;
+
+    for (int i = 0; i < 6; i++)
+    {
+        auto& osc = m_aOsc[i];
+
+        while (!osc.fActive && osc.nNext <= nTime_)
+        {
+            // Pending frequency changes are applied at the next half-cycle
+            if (osc.fNewData)
+            {
+                Toggle(i);
+                continue;
+            }
+
+            int nToggles = (nTime_ - osc.nNext) / osc.nPeriod + 1;
+            if (nToggles & 1)
+                osc.bLevel = 2 - osc.bLevel;
+
+            osc.nNext += nToggles * osc.nPeriod;
+        }
+    }
+
+    // Unheard noise is just random, so only its timing is kept
+    for (auto& noise : m_aNoise)
+    {
+        if (!noise.fActive && noise.nSource != 3 && noise.nNext <= nTime_)
+            noise.nNext += ((nTime_ - noise.nNext) / noise.nPeriod + 1) * noise.nPeriod;
+    }
+}
+
+// Complete a tone half-cycle, clocking anything connected to it, and returning the amplifiers affected
+int CSAABlip::Toggle(int nOsc_)
+{
+    auto& osc = m_aOsc[nOsc_];
+    osc.bLevel = 2 - osc.bLevel;
+    int nAmps = 1 << nOsc_;
+
+    // Generators 0 and 3 can clock the noise, and 1 and 4 the envelopes
+    if (nOsc_ % 3 == 0 && m_aNoise[nOsc_ / 3].nSource == 3)
+    {
+        NextRand(m_aNoise[nOsc_ / 3].uRand);
+        nAmps |= 0x07 << nOsc_;
+    }
+    else if (nOsc_ % 3 == 1 && m_apEnv[nOsc_ / 3]->IsActive())
+    {
+        m_apEnv[nOsc_ / 3]->InternalClock();
+        nAmps |= 1 << (nOsc_ + 1);
+    }
+
+    // Octave data written after offset data takes effect first, with the offset a half-cycle later
+    if (osc.fNewData)
+    {
+        osc.bOctave = osc.bNextOctave;
+
+        if (!osc.fIgnoreOffset)
+        {
+            osc.bOffset = osc.bNextOffset;
+            osc.fNewData = false;
+        }
+
+        osc.fIgnoreOffset = false;
+        SetPeriod(osc);
+    }
+
+    osc.nNext += osc.nPeriod;
+    return nAmps;
+}
+
+void CSAABlip::SetPeriod(SAAOSC& osc_)
+{
+    osc_.nPeriod = (TONE_UNIT * (511 - osc_.bOffset)) << (TIME_SHIFT - osc_.bOctave);
+}
+
+void CSAABlip::SetOffset(SAAOSC& osc_, BYTE bOffset_)
+{
+    if (m_fSync)
+    {
+        // Changes are immediate during sync
+        osc_.fNewData = false;
+        osc_.bOffset = bOffset_;
+        osc_.bOctave = osc_.bNextOctave;
+        SetPeriod(osc_);
+    }
+    else
+    {
+        osc_.bNextOffset = bOffset_;
+        osc_.fNewData = true;
+
+        if (osc_.bNextOctave == osc_.bOctave)
+            osc_.fIgnoreOffset = true;
+    }
+}
+
+void CSAABlip::SetOctave(SAAOSC& osc_, BYTE bOctave_)
+{
+    if (m_fSync)
+    {
+        osc_.fNewData = false;
+        osc_.bOctave = bOctave_;
+        osc_.bOffset = osc_.bNextOffset;
+        SetPeriod(osc_);
+    }
+    else
+    {
+        osc_.bNextOctave = bOctave_;
+        osc_.fNewData = true;
+        osc_.fIgnoreOffset = false;
+    }
+}
+
+void CSAABlip::SetNoiseSource(SAANOISE& noise_, int nSource_, int nTime_)
+{
+    if (nSource_ == noise_.nSource)
+        return;
+
+    int nPeriod = (NOISE_UNIT << nSource_) << TIME_SHIFT;
+
+    // Scale the remainder of the current count to the new rate
+    if (nSource_ != 3)
+    {
+        if (noise_.nSource == 3 || m_fSync)
+            noise_.nNext = nTime_ + nPeriod;
+        else
+            noise_.nNext = nTime_ + static_cast<int>(static_cast<int64_t>(noise_.nNext - nTime_) * nPeriod / noise_.nPeriod);
+
+        noise_.nPeriod = nPeriod;
+    }
+
+    noise_.nSource = nSource_;
+}
+
+// Determine which generators must be stepped through each change
+void CSAABlip::SetActive()
+{
+    bool afNoiseUsed[2] = {};
+    BYTE bToneUsed = 0;
+
+    for (int i = 0; i < 6; i++)
+    {
+        // Channels with no amplitude in either side can't be heard
+        if (!m_fEnabled || !m_abAmp[i])
+            continue;
+
+        if (m_bToneMix & (1 << i))
+            bToneUsed |= (1 << i);
+
+        if (m_bNoiseMix & (1 << i))
+            afNoiseUsed[i / 3] = true;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        bool fNeeded = (bToneUsed & (1 << i)) != 0;
+
+        if (i % 3 == 0)
+            fNeeded |= afNoiseUsed[i / 3] && m_aNoise[i / 3].nSource == 3;
+        else if (i % 3 == 1)
+            fNeeded |= m_apEnv[i / 3]->IsActive();
+
+        m_aOsc[i].fActive = fNeeded && !m_fSync;
+    }
+
+    for (int i = 0; i < 2; i++)
+        m_aNoise[i].fActive = afNoiseUsed[i] && m_aNoise[i].nSource != 3 && !m_fSync;
+}
+
+// Update the output of the given amplifiers, passing any change in the mix to the synths
+void CSAABlip::UpdateOutput(int nTime_, int nAmps_)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (!(nAmps_ & (1 << i)))
+            continue;
+
+        int nTone = m_aOsc[i].bLevel;
+        int nNoise = m_aNoise[i / 3].uRand & 1;
+        int nOut = 0, nLeft = 0, nRight = 0;
+
+        // Mixer output is 0-2, with tone+noise giving 1 when the noise is high during a high tone
+        switch (((m_bToneMix >> i) & 1) | (((m_bNoiseMix >> i) & 1) << 1))
+        {
+        case 1: nOut = nTone; break;
+        case 2: nOut = nNoise << 1; break;
+        case 3: nOut = (nTone == 2 && nNoise) ? 1 : nTone; break;
+        }
+
+        BYTE bAmp = m_abAmp[i];
+        auto pEnv = m_apEnv[i / 3];
+
+        // Channels 2 and 5 use the envelope as their amplitude, when it's enabled
+        if (m_fEnabled && i % 3 == 2 && pEnv->IsActive())
+        {
+            if (nOut != 2)
+            {
+                int nShift = nOut ? 0 : 1;
+                nLeft = (pEnv->LeftLevel() * (bAmp & 0x0e)) << nShift;
+                nRight = (pEnv->RightLevel() * ((bAmp >> 4) & 0x0e)) << nShift;
+            }
+        }
+        else if (m_fEnabled && nOut)
+        {
+            nLeft = (bAmp & 0x0f) << (3 + nOut);
+            nRight = (bAmp >> 4) << (3 + nOut);
+        }
+
+        m_anLeft[i] = nLeft;
+        m_anRight[i] = nRight;
+    }
+
+    int nLeft = m_anLeft[0] + m_anLeft[1] + m_anLeft[2] + m_anLeft[3] + m_anLeft[4] + m_anLeft[5];
+    int nRight = m_anRight[0] + m_anRight[1] + m_anRight[2] + m_anRight[3] + m_anRight[4] + m_anRight[5];
+
+    if (nLeft != m_nLeft)
+    {
+        m_synthLeft.update(nTime_ >> TIME_SHIFT, nLeft);
+        m_nLeft = nLeft;
+    }
+
+    if (nRight != m_nRight)
+    {
+        m_synthRight.update(nTime_ >> TIME_SHIFT, nRight);
+        m_nRight = nRight;
+    }
+}
@@ -0,0 +1,85 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// SAABlip.h: Band-limited event-driven SAA 1099 synthesis
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include "BlipBuffer.h"
+
+class CSAAEnv;
+
+class CSAABlip final
+{
+public:
+    CSAABlip(long lClockRate_, long lSampleRate_);
+    CSAABlip(const CSAABlip&) = delete;
+    void operator= (const CSAABlip&) = delete;
+    ~CSAABlip();
+
+public:
+    void Clear();
+    void WriteAddress(DWORD dwTime_, BYTE bReg_);
+    void WriteData(DWORD dwTime_, BYTE bData_);
+    int EndFrame(DWORD dwTime_, BYTE* pb_, int nMaxSamples_);
+
+protected:
+    struct SAAOSC
+    {
+        int nNext = 0, nPeriod = 0;     // Next toggle time and half-cycle period
+        BYTE bLevel = 2;                // Output level (0 or 2)
+        BYTE bOctave = 0, bOffset = 0;  // Current frequency
+        BYTE bNextOctave = 0, bNextOffset = 0;
+        bool fNewData = false, fIgnoreOffset = false;
+        bool fActive = false;           // Toggles have side effects or are audible
+    };
+
+    struct SAANOISE
+    {
+        int nNext = 0, nPeriod = 0;
+        int nSource = 0;                // 0-2 for internal clock, 3 for tone generator
+        uint32_t uRand = 0;
+        bool fActive = false;
+    };
+
+    void RunTo(int nTime_);
+    void CatchUp(int nTime_);
+    int Toggle(int nOsc_);
+    void SetPeriod(SAAOSC& osc_);
+    void SetOffset(SAAOSC& osc_, BYTE bOffset_);
+    void SetOctave(SAAOSC& osc_, BYTE bOctave_);
+    void SetNoiseSource(SAANOISE& noise_, int nSource_, int nTime_);
+    void SetActive();
+    void UpdateOutput(int nTime_, int nAmps_ = 0x3f);
+
+protected:
+    SAAOSC m_aOsc[6];
+    SAANOISE m_aNoise[2];
+    CSAAEnv* m_apEnv[2] = {};
+
+    BYTE m_abAmp[6] = {};               // Amplitude register per channel
+    BYTE m_bToneMix = 0, m_bNoiseMix = 0;
+    BYTE m_bReg = 0;
+    bool m_fSync = false, m_fEnabled = false;
+
+    int m_anLeft[6] = {}, m_anRight[6] = {};  // Output level of each amplifier
+    int m_nLeft = 0, m_nRight = 0;      // Current mixed output levels
+
+    Blip_Buffer m_bufLeft{}, m_bufRight{};
+    Blip_Synth<blip_med_quality, 6 * 480> m_synthLeft{}, m_synthRight{};
+};
@@ -107,6 +107,15 @@ static BYTE abUnhandled[32];    // track unhandled port access in debug mode
 namespace IO
 {
 
+// Report the outcome of a disk image save made in the background
+static void DiskSaved(const char* pcszFile_, bool fSuccess_, size_t uWritten_)
+{
+    if (fSuccess_)
+        Frame::SetStatus("%s  changes saved (%u bytes)", pcszFile_, static_cast<UINT>(uWritten_));
+    else
+        Frame::SetStatus("Failed to save changes to %s", pcszFile_);
+}
+
 bool Init(bool fFirstInit_/*=false*/)
 {
     bool fRet = true;
@@ -159,6 +168,8 @@ bool Init(bool fFirstInit_/*=false*/)
 
         pSDIDE = new CSDIDEDevice;
 
+        CDisk::SetSaveCallback(DiskSaved);
+
         pFloppy1->LoadState(OSD::MakeFilePath(MFP_SETTINGS, "drive1"));
         pFloppy2->LoadState(OSD::MakeFilePath(MFP_SETTINGS, "drive2"));
         pDallas->LoadState(OSD::MakeFilePath(MFP_SETTINGS, "dallas"));
@@ -247,6 +258,9 @@ void Exit(bool fReInit_/*=false*/)
         delete pFloppy2; pFloppy2 = nullptr;
         delete pBootDrive; pBootDrive = nullptr;
 
+        // Finish writing any ejected disks
+        CDisk::WaitForSaves();
+
         delete pAtom; pAtom = nullptr;
         delete pAtomLite; pAtomLite = nullptr;
         delete pSDIDE; pSDIDE = nullptr;
@@ -928,6 +942,9 @@ void FrameUpdate()
     pAtomLite->FrameEnd();
     pPrinterFile->FrameEnd();
 
+    // Report any disk saves completed in the background
+    CDisk::CompleteSaves();
+
     Input::Update();
 
     if (!g_nTurbo)
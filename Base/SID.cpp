@@ -49,7 +49,8 @@ void CSID::Reset()
         m_pSID->set_chip_model((m_nChipType == 2) ? MOS8580 : MOS6581);
 
         m_pSID->reset();
-        m_pSID->adjust_sampling_frequency(SAMPLE_FREQ);
+        m_nSampleFreq = Sound::GetSampleFreq();
+        m_pSID->adjust_sampling_frequency(m_nSampleFreq);
     }
 #endif
 }
@@ -58,15 +59,24 @@ void CSID::Update(bool fFrameEnd_ = false)
 {
 #ifdef HAVE_LIBRESID
     int nSamplesSoFar = fFrameEnd_ ? pDAC->GetSampleCount() : pDAC->GetSamplesSoFar();
+    Generate(nSamplesSoFar, g_fReset); // no clock means no output
+#else
+    (void)fFrameEnd_;
+#endif
+}
 
-    int nNeeded = nSamplesSoFar - m_nSamplesThisFrame;
+// Generate output up to the given position in the frame
+void CSID::Generate(int nSamples_, bool fSilent_)
+{
+#ifdef HAVE_LIBRESID
+    int nNeeded = nSamples_ - m_nSamplesThisFrame;
     if (!m_pSID || nNeeded <= 0)
         return;
 
-    short* ps = reinterpret_cast<short*>(m_pbFrameSample + m_nSamplesThisFrame * SAMPLE_BLOCK);
+    short* ps = m_asFrameSample + m_nSamplesThisFrame * SAMPLE_CHANNELS;
 
-    if (g_fReset)
-        memset(ps, 0x00, nNeeded * SAMPLE_BLOCK); // no clock means no output
+    if (fSilent_)
+        memset(ps, 0x00, nNeeded * SAMPLE_BLOCK);
     else
     {
         int sid_clock = SID_CLOCK_PAL;
@@ -79,27 +89,67 @@ void CSID::Update(bool fFrameEnd_ = false)
             ps[1] = ps[0];
     }
 
-    m_nSamplesThisFrame = nSamplesSoFar;
+    m_nSamplesThisFrame = nSamples_;
 #else
-    (void)fFrameEnd_;
+    (void)nSamples_; (void)fSilent_;
 #endif
 }
 
 void CSID::FrameEnd()
 {
+    // Synthesise any logged writes, before changes that would have followed them
+    ReplayWrites(true);
+
     // Check for change of chip type
     if (GetOption(sid) != m_nChipType)
         Reset();
 
-    Update(true);
+#ifdef HAVE_LIBRESID
+    // Check for change of output rate, which keeps the chip state
+    if (m_pSID && Sound::GetSampleFreq() != m_nSampleFreq)
+    {
+        m_nSampleFreq = Sound::GetSampleFreq();
+        m_pSID->adjust_sampling_frequency(m_nSampleFreq);
+    }
+#endif
+
+    // Skip generation until the chip is written, once any earlier output has died away
+    m_fIdle = !m_fWritten && m_fSilent;
+
+    if (m_fIdle)
+        m_nIdleFrames++;
+    else
+    {
+        Update(true);
+        m_fSilent = IsSilent(pDAC->GetSampleCount());
+    }
+
+    m_fWritten = false;
     m_nSamplesThisFrame = 0;
+    m_fBatch = GetOption(soundbatch);
 }
 
 void CSID::Out(WORD wPort_, BYTE bVal_)
 {
+    m_fWritten = true;
+
 #ifdef HAVE_LIBRESID
-    Update();
+    // Log writes for synthesis in one batch at frame end
+    if (m_fBatch)
+        m_vWrites.push_back({ pDAC->GetSamplesSoFar(), wPort_, bVal_, g_fReset });
+    else
+    {
+        Update();
+        Write(wPort_, bVal_);
+    }
+#else
+    (void)wPort_; (void)bVal_;
+#endif
+}
 
+void CSID::Write(WORD wPort_, BYTE bVal_)
+{
+#ifdef HAVE_LIBRESID
     BYTE bReg = wPort_ >> 8;
 
     if (m_pSID)
@@ -45,11 +45,16 @@ public:
 
     void Out(WORD wPort_, BYTE bVal_) override;
 
+protected:
+    void Generate(int nSamples_, bool fSilent_) override;
+    void Write(WORD wPort_, BYTE bVal_) override;
+
 protected:
 #ifdef HAVE_LIBRESID
     SID* m_pSID = nullptr;
 #endif
     int m_nChipType = 0;
+    bool m_fWritten = false;    // Written to this frame
 };
 
 extern CSID* pSID;
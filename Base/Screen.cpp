@@ -25,6 +25,10 @@
 //  On-screen text and graphics are always drawn in high resolution mode
 //  (double with width of low), and any existing line data is simply
 //  converted first.
+//
+//  Lines may be exchanged between screens to avoid copying their data, so
+//  they must always be accessed through GetLine() rather than assuming a
+//  fixed pitch between them.
 
 #include "SimCoupe.h"
 #include "Screen.h"
@@ -64,7 +68,15 @@ CScreen::~CScreen()
 
 void CScreen::Clear()
 {
-    memset(m_pbFrame, 0, m_nPitch * m_nHeight);
+    for (int i = 0; i < m_nHeight; i++)
+        memset(m_ppbLines[i], 0, m_nPitch);
+}
+
+// Exchange a range of lines with another screen of the same size, without copying
+void CScreen::SwapLines(CScreen* pOther_, int nFrom_, int nTo_)
+{
+    for (int i = nFrom_; i < nTo_; i++)
+        std::swap(m_ppbLines[i], pOther_->m_ppbLines[i]);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -92,7 +104,13 @@ bool CScreen::Clip(int& rnX_, int& rnY_, int& rnWidth_, int& rnHeight_)
     if (rnY_ + rnHeight_ > b) rnHeight_ = b - rnY_;
 
     // Return if there's anything left to draw
-    return rnWidth_ > 0 && rnHeight_ > 0;
+    if (rnWidth_ <= 0 || rnHeight_ <= 0)
+        return false;
+
+    // Track the lines touched, for anyone who needs to restore them
+    m_nDrawnFrom = std::min(m_nDrawnFrom, rnY_);
+    m_nDrawnTo = std::max(m_nDrawnTo, rnY_ + rnHeight_ - 1);
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -281,11 +299,17 @@ int CScreen::DrawString(int nX_, int nY_, const char* pcsz_, BYTE bInk_/*=WHITE*
         // Only draw the character if it's not a space, and the entire width fits inside the clipping area
         if (bChar != ' ' && (nX_ >= nClipX) && (nX_ + nWidth <= nClipX + nClipWidth))
         {
-            BYTE* pLine = GetLine(nFrom) + nX_;
             pbData += (nFrom - nY_);
 
-            for (int i = nFrom; i < nTo; pLine += m_nPitch, i += 1)
+            if (nFrom < nTo)
+            {
+                m_nDrawnFrom = std::min(m_nDrawnFrom, nFrom);
+                m_nDrawnTo = std::max(m_nDrawnTo, nTo - 1);
+            }
+
+            for (int i = nFrom; i < nTo; i++)
             {
+                BYTE* pLine = GetLine(i) + nX_;
                 BYTE bData = *pbData++;
 
                 if (bData & 0x80) pLine[0] = bInk_;
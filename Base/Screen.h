@@ -59,6 +59,10 @@ public:
 
 public:
     void Clear();
+    void SwapLines(CScreen* pOther_, int nFrom_, int nTo_);
+
+    void ResetDrawnLines() { m_nDrawnFrom = m_nHeight; m_nDrawnTo = -1; }
+    bool IsLineDrawn(int nLine_) const { return nLine_ >= m_nDrawnFrom && nLine_ <= m_nDrawnTo; }
 
     void SetClip(int nX_ = 0, int nY_ = 0, int nWidth_ = 0, int nHeight_ = 0);
     bool Clip(int& rnX_, int& rnY_, int& rnWidth_, int& rnHeight_);
@@ -80,4 +84,6 @@ protected:
 
     BYTE* m_pbFrame = nullptr;          // Screen data block
     BYTE** m_ppbLines = nullptr;        // Look-up table from line number to pointer to start of the line
+
+    int m_nDrawnFrom = 0, m_nDrawnTo = -1; // Range of lines touched by drawing since the last reset
 };
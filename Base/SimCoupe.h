@@ -64,10 +64,15 @@ typedef unsigned long       ULONG;
 #include <sys/stat.h>
 
 #include <string>
+#include <vector>
 #include <map>
 #include <algorithm>
 #include <queue>
 #include <stack>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #ifdef HAVE_STD_FILESYSTEM
 #include <filesystem>
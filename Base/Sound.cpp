@@ -25,14 +25,81 @@
 #include "AVI.h"
 #include "CPU.h"
 #include "Frame.h"
+#include "Mixer.h"
 #include "Options.h"
+#include "Pipe.h"
+#include "Resampler.h"
+#include "SAABlip.h"
 #include "SID.h"
 #include "WAV.h"
 
-static BYTE* pbSampleBuffer;
+#include <chrono>
 
-static void MixAudio(BYTE* pDst_, const BYTE* pSrc_, int nLen_);
-static int AdjustSpeed(BYTE* pb_, int nSize_, int nSpeed_);
+const int SPEED_BUFFER_FRAMES = MAX_SAMPLES_PER_FRAME * 2 + 1;    // Needed for 50% running speed
+
+alignas(SAMPLE_ALIGN) static int16_t asSampleBuffer[MAX_SAMPLES_PER_FRAME * SAMPLE_CHANNELS];
+alignas(SAMPLE_ALIGN) static int16_t asSpeedBuffer[SPEED_BUFFER_FRAMES * SAMPLE_CHANNELS];
+static CResampler* pResampler;
+static int nSampleFreq = SAMPLE_FREQ_DEFAULT;
+
+// Worker to finish one device's frame alongside the emulation thread
+static std::thread thWorker;
+static std::mutex mtxWorker;
+static std::condition_variable cvWorker;
+static CSoundDevice* pWorkerDevice;     // Device being finished, or nullptr when done
+static bool fQuit;
+
+// Finish generating a device's frame, timing how long it takes
+static void FinishFrame(CSoundDevice* pDevice_)
+{
+    auto start = std::chrono::steady_clock::now();
+    pDevice_->FrameEnd();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    pDevice_->AddGenerateTime(static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+}
+
+static void WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(mtxWorker);
+
+    for (;;)
+    {
+        cvWorker.wait(lock, [] { return fQuit || pWorkerDevice; });
+
+        if (fQuit)
+            break;
+
+        // The emulation thread waits for us, so nothing else touches the device meanwhile
+        lock.unlock();
+        FinishFrame(pWorkerDevice);
+        lock.lock();
+
+        pWorkerDevice = nullptr;
+        cvWorker.notify_all();
+    }
+}
+
+static void StartWorker()
+{
+    fQuit = false;
+    pWorkerDevice = nullptr;
+    thWorker = std::thread(WorkerThread);
+}
+
+static void StopWorker()
+{
+    if (thWorker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxWorker);
+            fQuit = true;
+            cvWorker.notify_all();
+        }
+
+        thWorker.join();
+    }
+}
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -40,12 +107,24 @@ bool Sound::Init(bool fFirstInit_/*=false*/)
 {
     Exit();
 
-    int nMaxFrameSamples = 2; // Needed for 50% running speed
-    int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND) + 1;
-    pbSampleBuffer = new BYTE[nSamplesPerFrame * SAMPLE_BLOCK * nMaxFrameSamples];
+    pResampler = new CResampler(SAMPLE_CHANNELS);
+
+    // The worker only helps if there's a spare core to run it
+    if (GetOption(soundthread) && std::thread::hardware_concurrency() > 1)
+        StartWorker();
+
+    // Request the configured rate, or the default if the device is free to choose
+    int nFreq = GetOption(samplerate);
+    nSampleFreq = nFreq ? std::min(std::max(nFreq, SAMPLE_FREQ_MIN), SAMPLE_FREQ_MAX) : SAMPLE_FREQ_DEFAULT;
 
     bool fRet = Audio::Init(fFirstInit_);
     Audio::Silence();
+
+    // Generate at the rate the device opened with, so it needn't be converted again
+    if (Audio::GetSampleFreq())
+        nSampleFreq = Audio::GetSampleFreq();
+
+    TRACE("Sound output at %dHz\n", nSampleFreq);
     return fRet;
 }
 
@@ -54,8 +133,10 @@ void Sound::Exit(bool fReInit_/*=false*/)
     // Stop any recording
     WAV::Stop();
     AVI::Stop();
+    Pipe::Stop();
 
-    delete[] pbSampleBuffer; pbSampleBuffer = nullptr;
+    delete pResampler; pResampler = nullptr;
+    StopWorker();
     Audio::Exit(fReInit_);
 }
 
@@ -64,94 +145,365 @@ void Sound::Silence()
     Audio::Silence();
 }
 
+// Output rate for generated samples, picked up by each device at the end of a frame
+int Sound::GetSampleFreq()
+{
+    return nSampleFreq;
+}
+
+// Append the audio statistics for the last period to the log, as CSV or JSON lines depending on the extension
+// Each row also has the number of frames each device was idle for, as DAC/SAA/SID
+static void LogStats(const AUDIO_STATS& stats_, const int(&anIdle_)[3])
+{
+    auto pszPath = GetOption(audiolog);
+    bool fJson = !strcasecmp(fs::path(pszPath).extension().string().c_str(), ".json");
+
+    FILE* f = fopen(pszPath, "a");
+    if (!f)
+        return;
+
+    time_t tNow = time(nullptr);
+
+    if (fJson)
+    {
+        fprintf(f, "{\"time\":%ld,\"period_ms\":%.1f,\"fill_min_ms\":%.1f,\"fill_avg_ms\":%.1f,\"fill_max_ms\":%.1f,"
+            "\"underruns\":%d,\"overruns\":%d,\"callbacks\":%d,\"jitter_ms\":%.2f,\"sleep_ms\":%.1f,\"drift_ms\":%.1f,\"latency\":%d,"
+            "\"idle_dac\":%d,\"idle_saa\":%d,\"idle_sid\":%d}\n",
+            static_cast<long>(tNow), stats_.dPeriod, stats_.dFillMin, stats_.dFillAvg, stats_.dFillMax,
+            stats_.nUnderruns, stats_.nOverruns, stats_.nCallbacks, stats_.dJitter, stats_.dSleep, stats_.dDrift, GetOption(latency),
+            anIdle_[0], anIdle_[1], anIdle_[2]);
+    }
+    else
+    {
+        // Start a new file with a header row
+        fseek(f, 0, SEEK_END);
+        if (!ftell(f))
+            fprintf(f, "time,period_ms,fill_min_ms,fill_avg_ms,fill_max_ms,underruns,overruns,callbacks,jitter_ms,sleep_ms,drift_ms,latency,idle_dac,idle_saa,idle_sid\n");
+
+        fprintf(f, "%ld,%.1f,%.1f,%.1f,%.1f,%d,%d,%d,%.2f,%.1f,%.1f,%d,%d,%d,%d\n",
+            static_cast<long>(tNow), stats_.dPeriod, stats_.dFillMin, stats_.dFillAvg, stats_.dFillMax,
+            stats_.nUnderruns, stats_.nOverruns, stats_.nCallbacks, stats_.dJitter, stats_.dSleep, stats_.dDrift, GetOption(latency),
+            anIdle_[0], anIdle_[1], anIdle_[2]);
+    }
+
+    fclose(f);
+}
+
+// Add the device generation times and audio statistics to the profile text if enabled, and log the statistics if required
+void Sound::AddProfile(char* psz_, size_t uLen_)
+{
+    // Frames skipped by each idle device since the last call, allowing for devices being recreated
+    static int anLastIdle[3];
+    const CSoundDevice* apDevices[3] = { pDAC, pSAA, pSID };
+    int anIdle[3] = { };
+
+    for (int i = 0; i < 3; i++)
+    {
+        int nTotal = apDevices[i] ? apDevices[i]->GetIdleFrames() : 0;
+        anIdle[i] = (nTotal >= anLastIdle[i]) ? nTotal - anLastIdle[i] : nTotal;
+        anLastIdle[i] = nTotal;
+    }
+
+    // The statistics are only gathered when they're shown or logged
+    bool fShow = GetOption(profileaudio), fLog = *GetOption(audiolog) != '\0';
+    if (!fShow && !fLog)
+        return;
+
+    // Average time each device took to generate a frame over the last second, and the frames it was idle for
+    if (fShow && pDAC && pSAA && pSID)
+    {
+        size_t uUsed = strlen(psz_);
+        snprintf(psz_ + uUsed, uLen_ - uUsed, "  DAC %d SAA %d SID %dus I%d/%d/%d",
+            pDAC->GetGenerateTime(), pSAA->GetGenerateTime(), pSID->GetGenerateTime(), anIdle[0], anIdle[1], anIdle[2]);
+    }
+
+    AUDIO_STATS stats;
+    if (!Audio::GetStats(stats))
+        return;
+
+    // Fill min/avg/max, underruns, overruns, callback jitter and the proportion of time spent sleeping
+    if (fShow)
+    {
+        size_t uUsed = strlen(psz_);
+        snprintf(psz_ + uUsed, uLen_ - uUsed, "  %.0f/%.0f/%.0fms U%d O%d J%.1f S%.0f%%",
+            stats.dFillMin, stats.dFillAvg, stats.dFillMax, stats.nUnderruns, stats.nOverruns, stats.dJitter,
+            stats.dPeriod ? stats.dSleep * 100.0 / stats.dPeriod : 0.0);
+    }
+
+    if (fLog)
+        LogStats(stats, anIdle);
+}
+
 void Sound::FrameUpdate()
 {
-    static bool fSidUsed = false;
+    FinishFrame(pDAC);  // set the actual sample count
 
-    // Track whether SID has been used, to avoid unnecessary sample generation+mixing
-    fSidUsed |= pSID->GetSampleCount() != 0;
+    // SID generation is the most expensive, so run it on the worker while the SAA catches up here
+    bool fWorker = thWorker.joinable() && GetOption(sid) && !pSID->IsIdle();
 
-    pDAC->FrameEnd();   // set the actual sample count
-    pSAA->FrameEnd();   // catch-up to the DAC position
-    if (fSidUsed) pSID->FrameEnd();
+    if (fWorker)
+    {
+        std::lock_guard<std::mutex> lock(mtxWorker);
+        pWorkerDevice = pSID;
+        cvWorker.notify_all();
+    }
+
+    FinishFrame(pSAA);  // catch-up to the DAC position
+
+    if (fWorker)
+    {
+        std::unique_lock<std::mutex> lock(mtxWorker);
+        cvWorker.wait(lock, [] { return !pWorkerDevice; });
+    }
+    else
+        FinishFrame(pSID);
 
     // Use the DAC as the master clock for sample count
     int nSamples = pDAC->GetSampleCount();
     int nSize = nSamples * SAMPLE_BLOCK;
 
-    // Copy in the DAC samples, then mix SAA and possibly SID too
-    memcpy(pbSampleBuffer, pDAC->GetSampleBuffer(), nSize);
-    MixAudio(pbSampleBuffer, pSAA->GetSampleBuffer(), nSize);
-    if (fSidUsed && GetOption(sid)) MixAudio(pbSampleBuffer, pSID->GetSampleBuffer(), nSize);
+    // Mix the DAC, SAA and SID samples in a single pass, skipping idle devices
+    const int16_t* apsSources[3];
+    int anGains[3];
+    int nSources = 0;
+
+    if (!pDAC->IsIdle())
+    {
+        apsSources[nSources] = pDAC->GetSampleBuffer();
+        anGains[nSources++] = Mixer::UNITY_GAIN;
+    }
+
+    if (!pSAA->IsIdle())
+    {
+        apsSources[nSources] = pSAA->GetSampleBuffer();
+        anGains[nSources++] = Mixer::UNITY_GAIN;
+    }
+
+    if (!pSID->IsIdle() && GetOption(sid))
+    {
+        apsSources[nSources] = pSID->GetSampleBuffer();
+        anGains[nSources++] = Mixer::UNITY_GAIN;
+    }
+
+    Mixer::Mix(asSampleBuffer, apsSources, anGains, nSources, nSamples * SAMPLE_CHANNELS);
 
     // Add the frame to any recordings
-    WAV::AddFrame(pbSampleBuffer, nSize);
-    AVI::AddFrame(pbSampleBuffer, nSize);
+    auto pbSamples = reinterpret_cast<BYTE*>(asSampleBuffer);
+    WAV::AddFrame(pbSamples, nSize);
+    AVI::AddFrame(pbSamples, nSize);
+    Pipe::AddFrame(pbSamples, nSize);
 
-#if SAMPLE_FREQ == 44100 && SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2
-    // Scale the audio to fit the require running speed
-    nSize = AdjustSpeed(pbSampleBuffer, nSize, GetOption(speed));
-#endif
+    // Resample the audio to fit the required running speed
+    int nSpeed = GetOption(speed);
+    pResampler->SetRatio(nSpeed);
+
+    if (nSpeed != 100)
+    {
+        int nFrames = pResampler->Process(asSampleBuffer, nSamples, asSpeedBuffer, SPEED_BUFFER_FRAMES);
+        Audio::AddData(reinterpret_cast<BYTE*>(asSpeedBuffer), nFrames * SAMPLE_BLOCK);
+        return;
+    }
 
     // Queue the data for playback
-    Audio::AddData(pbSampleBuffer, nSize);
+    Audio::AddData(pbSamples, nSize);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+CSAA::~CSAA()
+{
+    delete m_pSAABlip;
+
+#ifdef HAVE_LIBSAASOUND
+    if (m_pSAASound)
+        DestroyCSAASound(m_pSAASound);
+#else
+    delete m_pSAASound;
+#endif
+}
+
 void CSAA::Update(bool fFrameEnd_ = false)
 {
+    // The band-limited engine is kept up to date by each write
+    if (m_pSAABlip)
+        return;
+
     int nSamplesSoFar = fFrameEnd_ ? pDAC->GetSampleCount() : pDAC->GetSamplesSoFar();
+    Generate(nSamplesSoFar, g_fReset || !m_fAudible); // no clock or no amplitude means no SAA output
+}
 
-    int nNeeded = nSamplesSoFar - m_nSamplesThisFrame;
+// Generate sample engine output up to the given position in the frame
+void CSAA::Generate(int nSamples_, bool fSilent_)
+{
+    int nNeeded = nSamples_ - m_nSamplesThisFrame;
     if (nNeeded <= 0)
         return;
 
-    BYTE* pb = m_pbFrameSample + m_nSamplesThisFrame * SAMPLE_BLOCK;
+    int16_t* ps = m_asFrameSample + m_nSamplesThisFrame * SAMPLE_CHANNELS;
 
-    if (g_fReset)
-        memset(pb, 0x00, nNeeded * SAMPLE_BLOCK); // no clock means no SAA output
+    if (fSilent_)
+        memset(ps, 0x00, nNeeded * SAMPLE_BLOCK);
     else
-        m_pSAASound->GenerateMany(pb, nNeeded);
+        m_pSAASound->GenerateMany(reinterpret_cast<BYTE*>(ps), nNeeded);
 
-    m_nSamplesThisFrame = nSamplesSoFar;
+    m_nSamplesThisFrame = nSamples_;
 }
 
 void CSAA::FrameEnd()
 {
-    Update(true);
+    int nSamples = pDAC->GetSampleCount();
+
+    // Skip generation while muted, once any earlier output has died away
+    m_fIdle = !m_fAudible && m_fSilent;
+
+    if (m_fIdle)
+    {
+        if (m_pSAABlip)
+            m_pSAABlip->EndFrame(TSTATES_PER_FRAME, nullptr, nSamples);
+        else
+            ReplayWrites(false); // silent throughout, so only the register state is needed
+
+        m_nIdleFrames++;
+    }
+    else
+    {
+        if (m_pSAABlip)
+        {
+            int nDone = m_pSAABlip->EndFrame(TSTATES_PER_FRAME, reinterpret_cast<BYTE*>(m_asFrameSample), nSamples);
+
+            if (g_fReset)
+                nDone = 0; // no clock means no SAA output
+
+            memset(m_asFrameSample + nDone * SAMPLE_CHANNELS, 0x00, (nSamples - nDone) * SAMPLE_BLOCK);
+        }
+        else
+        {
+            ReplayWrites(true);
+            Update(true);
+        }
+
+        m_fSilent = !m_fAudible && IsSilent(nSamples);
+    }
+
     m_nSamplesThisFrame = 0;
+    m_fAudible = !IsMuted();
+    m_fBatch = GetOption(soundbatch);
+
+#ifdef HAVE_LIBSAASOUND
+    // SAASound only generates at 44.1kHz, so other rates need the band-limited engine
+    bool fBlip = GetOption(saablip) || Sound::GetSampleFreq() != 44100;
+#else
+    bool fBlip = GetOption(saablip);
+#endif
+
+    // Check for change of engine or output rate
+    if (fBlip != (m_pSAABlip != nullptr) || Sound::GetSampleFreq() != m_nSampleFreq)
+        SetEngine(fBlip);
 }
 
 void CSAA::Out(WORD wPort_, BYTE bVal_)
 {
-    Update();
+    // Log sample engine writes for synthesis in one batch at frame end
+    if (m_fBatch && !m_pSAABlip)
+        m_vWrites.push_back({ pDAC->GetSamplesSoFar(), wPort_, bVal_, g_fReset || !m_fAudible });
+    else
+    {
+        Update();
+        Write(wPort_, bVal_);
+    }
 
     if ((wPort_ & SOUND_MASK) == SOUND_ADDR)
-        m_pSAASound->WriteAddress(bVal_);
+        m_bReg = bVal_ & 0x1f;
     else
-        m_pSAASound->WriteData(bVal_);
+    {
+        m_abRegs[m_bReg] = bVal_;
+        m_fAudible |= !IsMuted();
+    }
+}
+
+// Pass a register write to the active engine
+void CSAA::Write(WORD wPort_, BYTE bVal_)
+{
+    if ((wPort_ & SOUND_MASK) == SOUND_ADDR)
+    {
+        if (m_pSAABlip)
+            m_pSAABlip->WriteAddress(g_dwCycleCounter, bVal_);
+        else
+            m_pSAASound->WriteAddress(bVal_);
+    }
+    else
+    {
+        if (m_pSAABlip)
+            m_pSAABlip->WriteData(g_dwCycleCounter, bVal_);
+        else
+            m_pSAASound->WriteData(bVal_);
+    }
+}
+
+// The output is silent with sound disabled, or no amplitude on any channel
+bool CSAA::IsMuted() const
+{
+    return !(m_abRegs[28] & 0x01) || std::all_of(m_abRegs, m_abRegs + 6, [](BYTE b) { return !b; });
+}
+
+// Switch between the sample-based and band-limited engines at the current output rate, at the start of a frame
+void CSAA::SetEngine(bool fBlip_)
+{
+    m_nSampleFreq = Sound::GetSampleFreq();
+
+    delete m_pSAABlip;
+    m_pSAABlip = fBlip_ ? new CSAABlip(REAL_TSTATES_PER_SECOND, m_nSampleFreq) : nullptr;
+
+#ifndef HAVE_LIBSAASOUND
+    // The sample-based engine is recreated for the current rate, with the registers restored below
+    if (!fBlip_)
+    {
+        delete m_pSAASound;
+        m_pSAASound = new CSAASound(m_nSampleFreq);
+    }
+#endif
+
+    auto fnWrite = [&](BYTE bReg_, BYTE bVal_)
+    {
+        if (m_pSAABlip)
+        {
+            m_pSAABlip->WriteAddress(0, bReg_);
+            m_pSAABlip->WriteData(0, bVal_);
+        }
+        else
+        {
+            m_pSAASound->WriteAddress(bReg_);
+            m_pSAASound->WriteData(bVal_);
+        }
+    };
+
+    // Load the registers under sync, releasing it with the final control value
+    fnWrite(28, 0x02);
+
+    for (int i = 0; i < 32; i++)
+    {
+        if (i != 28)
+            fnWrite(i, m_abRegs[i]);
+    }
+
+    fnWrite(28, m_abRegs[28]);
+
+    if (m_pSAABlip)
+        m_pSAABlip->WriteAddress(0, m_bReg);
+    else
+        m_pSAASound->WriteAddress(m_bReg);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 CDAC::CDAC()
 {
-    buf_left.clock_rate(REAL_TSTATES_PER_SECOND);
-    buf_right.clock_rate(REAL_TSTATES_PER_SECOND);
-    buf_left.set_sample_rate(SAMPLE_FREQ);
-    buf_right.set_sample_rate(SAMPLE_FREQ);
-
-    synth_left.output(&buf_left);
-    synth_left2.output(&buf_left);
-    synth_right.output(&buf_right);
-    synth_right2.output(&buf_right);
+    buf.clock_rate(REAL_TSTATES_PER_SECOND);
 
-    synth_left.volume(1.0);
-    synth_left2.volume(1.0);
-    synth_right.volume(1.0);
-    synth_right2.volume(1.0);
+    synth.output(&buf);
+    synth.volume(1.0);
 
+    SetSampleFreq(Sound::GetSampleFreq());
     Reset();
 }
 
@@ -163,52 +515,93 @@ void CDAC::Reset()
 
 void CDAC::FrameEnd()
 {
-    buf_left.end_frame(TSTATES_PER_FRAME);
-    buf_right.end_frame(TSTATES_PER_FRAME);
+    // Check for change of output rate, which gives a silent frame at the new rate
+    if (Sound::GetSampleFreq() != m_nSampleFreq)
+        SetSampleFreq(Sound::GetSampleFreq());
 
-    blip_sample_t* ps = reinterpret_cast<blip_sample_t*>(m_pbFrameSample);
-    m_nSamplesThisFrame = static_cast<int>(buf_left.samples_avail());
+    buf.end_frame(TSTATES_PER_FRAME);
 
-    buf_left.read_samples(ps, m_nSamplesThisFrame, 1);
-    buf_right.read_samples(ps + 1, m_nSamplesThisFrame, 1);
+    blip_sample_t* ps = m_asFrameSample;
+    m_nSamplesThisFrame = static_cast<int>(buf.samples_avail());
+
+    // Without changes since a silent frame the buffers hold only silence, so can be discarded
+    m_fIdle = !m_fChanged && !m_fChangedLast && m_fSilent;
+    m_fChangedLast = m_fChanged;
+    m_fChanged = false;
+
+    if (m_fIdle)
+    {
+        buf.remove_samples(m_nSamplesThisFrame);
+        m_nIdleFrames++;
+        return;
+    }
+
+    buf.read_samples(ps, m_nSamplesThisFrame);
+
+    m_fSilent = IsSilent(m_nSamplesThisFrame);
 }
 
 void CDAC::OutputLeft(BYTE bVal_)
 {
-    synth_left.update(g_dwCycleCounter, bVal_);
+    SetLevels(bVal_, m_bRight, m_bLeft2, m_bRight2);
 }
 
 void CDAC::OutputLeft2(BYTE bVal_)
 {
-    synth_left2.update(g_dwCycleCounter, bVal_);
+    SetLevels(m_bLeft, m_bRight, bVal_, m_bRight2);
 }
 
 void CDAC::OutputRight(BYTE bVal_)
 {
-    synth_right.update(g_dwCycleCounter, bVal_);
+    SetLevels(m_bLeft, bVal_, m_bLeft2, m_bRight2);
 }
 
 void CDAC::OutputRight2(BYTE bVal_)
 {
-    synth_right2.update(g_dwCycleCounter, bVal_);
+    SetLevels(m_bLeft, m_bRight, m_bLeft2, bVal_);
 }
 
 void CDAC::Output(BYTE bVal_)
 {
-    synth_left.update(g_dwCycleCounter, bVal_);
-    synth_right.update(g_dwCycleCounter, bVal_);
+    SetLevels(bVal_, bVal_, m_bLeft2, m_bRight2);
 }
 
 void CDAC::Output2(BYTE bVal_)
 {
-    synth_left2.update(g_dwCycleCounter, bVal_);
-    synth_right2.update(g_dwCycleCounter, bVal_);
+    SetLevels(m_bLeft, m_bRight, bVal_, bVal_);
+}
+
+// Update the output levels, noting whether they changed. Both DACs share the same volume, so
+// the synth is given their combined levels, with a change to both sides added in a single pass.
+void CDAC::SetLevels(BYTE bLeft_, BYTE bRight_, BYTE bLeft2_, BYTE bRight2_)
+{
+    if (bLeft_ != m_bLeft || bRight_ != m_bRight || bLeft2_ != m_bLeft2 || bRight2_ != m_bRight2)
+    {
+        m_bLeft = bLeft_;
+        m_bRight = bRight_;
+        m_bLeft2 = bLeft2_;
+        m_bRight2 = bRight2_;
+
+        synth.update(g_dwCycleCounter, m_bLeft + m_bLeft2, m_bRight + m_bRight2);
+        m_fChanged = true;
+    }
+}
+
+// Change the buffer output rate, which also discards the current frame
+void CDAC::SetSampleFreq(int nSampleFreq_)
+{
+    m_nSampleFreq = nSampleFreq_;
+    buf.set_sample_rate(m_nSampleFreq);
+
+    // Restore the current output levels in the cleared buffer, which must be read rather than skipped
+    synth.offset(0, m_bLeft + m_bLeft2, m_bRight + m_bRight2);
+    m_fChanged = true;
 }
 
 int CDAC::GetSamplesSoFar()
 {
     UINT uCycles = std::min(g_dwCycleCounter, static_cast<DWORD>(TSTATES_PER_FRAME));
-    return static_cast<int>(buf_left.count_samples(uCycles));
+    return static_cast<int>(buf.count_samples(uCycles));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -221,77 +614,35 @@ void CBeeperDevice::Out(WORD /*wPort_*/, BYTE bVal_)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-CSoundDevice::CSoundDevice()
+// Add the time taken to generate a frame, updating the average once a second
+void CSoundDevice::AddGenerateTime(int nMicroseconds_)
 {
-    int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND) + 1;
-    int nSize = nSamplesPerFrame * SAMPLE_BLOCK;
+    m_nGenerateTotal += nMicroseconds_;
 
-    m_pbFrameSample = new BYTE[nSize];
-    memset(m_pbFrameSample, 0x00, nSize);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-// Basic audio mixing
-static void MixAudio(BYTE* pDst_, const BYTE* pSrc_, int nLen_)
-{
-    for (nLen_ /= 2; nLen_-- > 0; pSrc_ += 2, pDst_ += 2)
+    if (++m_nGenerateFrames == EMULATED_FRAMES_PER_SECOND)
     {
-        // Add two 16-bit samples
-        short s1 = (pSrc_[1] << 8) | pSrc_[0];
-        short s2 = (pDst_[1] << 8) | pDst_[0];
-        int samp = s1 + s2;
-
-        // Clip to signed range
-        samp = std::min(samp, 32767);
-        samp = std::max(-32768, samp);
-
-        // Write new sample
-        pDst_[0] = samp & 0xff;
-        pDst_[1] = samp >> 8;
+        m_nGenerateTime = m_nGenerateTotal / m_nGenerateFrames;
+        m_nGenerateTotal = m_nGenerateFrames = 0;
     }
 }
 
-
-// Scale audio data to fit the current emulator speed setting
-static int AdjustSpeed(BYTE* pb_, int nSize_, int nSpeed_)
+// Synthesise the logged writes in order, each at the sample position it was made
+void CSoundDevice::ReplayWrites(bool fGenerate_)
 {
-    // Limit speed range
-    nSpeed_ = std::max(nSpeed_, 50);
-    nSpeed_ = std::min(nSpeed_, 1000);
-
-    // Slow?
-    if (nSpeed_ < 100)
+    for (auto& write : m_vWrites)
     {
-        DWORD* pdwS = reinterpret_cast<DWORD*>(pb_ + nSize_) - 1;
-        DWORD* pdwD = reinterpret_cast<DWORD*>(pb_ + nSize_ * 2) - 1;
-
-        // Double samples in reverse order
-        for (int i = 0; i < nSize_; i += SAMPLE_BLOCK, pdwS--)
-        {
-            *pdwD-- = *pdwS;
-            *pdwD-- = *pdwS;
-        }
+        if (fGenerate_)
+            Generate(write.nSample, write.fSilent);
 
-        nSize_ *= 2;
-    }
-    else if (nSpeed_ == 100)
-    {
-        // Nothing to do
+        Write(write.wPort, write.bVal);
     }
-    // Fast?
-    else if (nSpeed_ > 100)
-    {
-        int nScale = nSpeed_ / 100;
-        nSize_ = (nSize_ / nScale) & ~(SAMPLE_BLOCK - 1);
-
-        DWORD* pdwS = reinterpret_cast<DWORD*>(pb_);
-        DWORD* pdwD = pdwS;
 
-        // Skip the required number of samples
-        for (int i = 0; i < nSize_; i += SAMPLE_BLOCK, pdwS += nScale)
-            *pdwD++ = *pdwS;
-    }
+    m_vWrites.clear();
+}
 
-    return nSize_;
+// Check whether the generated stereo samples are all silent
+bool CSoundDevice::IsSilent(int nSamples_) const
+{
+    auto ps = m_asFrameSample;
+    return std::all_of(ps, ps + nSamples_ * SAMPLE_CHANNELS, [](int16_t s) { return !s; });
 }
@@ -29,11 +29,28 @@
 #include "SAA1099.h"
 #endif
 
-#define SAMPLE_FREQ         44100
+#define SAMPLE_FREQ_DEFAULT 44100       // Output rate unless the option or device picks another
+#define SAMPLE_FREQ_MIN     11025
+#define SAMPLE_FREQ_MAX     96000
 #define SAMPLE_BITS         16
 #define SAMPLE_CHANNELS     2
 #define SAMPLE_BLOCK        (SAMPLE_BITS*SAMPLE_CHANNELS/8)
 
+#define MAX_SAMPLES_PER_FRAME   ((SAMPLE_FREQ_MAX / EMULATED_FRAMES_PER_SECOND) + 1)
+#define SAMPLE_ALIGN            16  // Sample buffer alignment, for the vector mixer
+
+
+// Audio output statistics over a reporting period, with times in milliseconds
+struct AUDIO_STATS
+{
+    double dPeriod = 0.0;                           // Length of the period
+    double dFillMin = 0.0, dFillAvg = 0.0, dFillMax = 0.0;  // Buffered audio queued for the device
+    int nUnderruns = 0, nOverruns = 0;              // Device starved, or buffer full when adding
+    int nCallbacks = 0;                             // Device callbacks
+    double dJitter = 0.0;                           // Largest error in the callback interval
+    double dSleep = 0.0;                            // Time spent sleeping to pace frames
+    double dDrift = 0.0;                            // Host time minus time of audio generated
+};
 
 class Sound
 {
@@ -43,25 +60,61 @@ public:
 
     static void Silence();
     static void FrameUpdate();
+
+    static int GetSampleFreq();
+    static void AddProfile(char* psz_, size_t uLen_);
+};
+
+// Register write logged for synthesis at the end of the frame
+struct SOUND_WRITE
+{
+    int nSample;                    // Output sample position of the write
+    WORD wPort;
+    BYTE bVal;
+    bool fSilent;                   // Output up to the write is silent
 };
 
 class CSoundDevice : public CIoDevice
 {
 public:
-    CSoundDevice();
+    CSoundDevice() = default;
     CSoundDevice(const CSoundDevice&) = delete;
     void operator= (const CSoundDevice&) = delete;
-    virtual ~CSoundDevice() { delete[] m_pbFrameSample; }
+    virtual ~CSoundDevice() = default;
 
 public:
     int GetSampleCount() { return m_nSamplesThisFrame; }
-    BYTE* GetSampleBuffer() { return m_pbFrameSample; }
+    const int16_t* GetSampleBuffer() const { return m_asFrameSample; }
+    bool IsIdle() const { return m_fIdle; }
+    int GetIdleFrames() const { return m_nIdleFrames; }
+    int GetGenerateTime() const { return m_nGenerateTime; }
+    void AddGenerateTime(int nMicroseconds_);
+
+protected:
+    bool IsSilent(int nSamples_) const;
+    void ReplayWrites(bool fGenerate_);
+
+    virtual void Generate(int /*nSamples_*/, bool /*fSilent_*/) { }
+    virtual void Write(WORD /*wPort_*/, BYTE /*bVal_*/) { }
 
 protected:
     int m_nSamplesThisFrame = 0;
-    BYTE* m_pbFrameSample = nullptr;
+    alignas(SAMPLE_ALIGN) int16_t m_asFrameSample[MAX_SAMPLES_PER_FRAME * SAMPLE_CHANNELS]{};  // Sized for the highest output rate
+    int m_nSampleFreq = 0;          // Output rate the device is generating at
+
+    bool m_fIdle = false;           // Nothing generated this frame, as there's nothing to hear
+    bool m_fSilent = true;          // Last generated frame was silent
+    int m_nIdleFrames = 0;          // Number of idle frames skipped
+
+    int m_nGenerateTime = 0;        // Average frame generation time over the last second, in microseconds
+    int m_nGenerateTotal = 0, m_nGenerateFrames = 0;
+
+    bool m_fBatch = false;          // Log writes for synthesis at frame end
+    std::vector<SOUND_WRITE> m_vWrites;
 };
 
+class CSAABlip;
+
 class CSAA final : public CSoundDevice
 {
 public:
@@ -70,22 +123,16 @@ public:
 #ifdef HAVE_LIBSAASOUND
         m_pSAASound = CreateCSAASound();
         m_pSAASound->SetSoundParameters(SAAP_NOFILTER | SAAP_44100 | SAAP_16BIT | SAAP_STEREO);
-        static_assert(SAMPLE_FREQ == 44100 && SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2, "SAA parameter mismatch");
+        static_assert(SAMPLE_BITS == 16 && SAMPLE_CHANNELS == 2, "SAA parameter mismatch");
+        m_nSampleFreq = 44100;
 #else
-        m_pSAASound = new CSAASound(SAMPLE_FREQ);
+        m_nSampleFreq = Sound::GetSampleFreq();
+        m_pSAASound = new CSAASound(m_nSampleFreq);
 #endif
     }
     CSAA(const CSAA&) = delete;
     void operator= (const CSAA&) = delete;
-    ~CSAA()
-    {
-#ifdef HAVE_LIBSAASOUND
-        if (m_pSAASound)
-            DestroyCSAASound(m_pSAASound);
-#else
-        delete m_pSAASound;
-#endif
-    }
+    ~CSAA();
 
 public:
     void Update(bool fFrameEnd_);
@@ -93,8 +140,17 @@ public:
 
     void Out(WORD wPort_, BYTE bVal_) override;
 
+protected:
+    void Generate(int nSamples_, bool fSilent_) override;
+    void Write(WORD wPort_, BYTE bVal_) override;
+    bool IsMuted() const;
+    void SetEngine(bool fBlip_);
+
 protected:
     CSAASound* m_pSAASound = nullptr;
+    CSAABlip* m_pSAABlip = nullptr;     // Band-limited engine, when selected
+    BYTE m_bReg = 0, m_abRegs[32]{};    // Register copy, for changing engine
+    bool m_fAudible = false;            // Unmuted at some point this frame
 };
 
 
@@ -118,8 +174,14 @@ public:
     int GetSamplesSoFar();
 
 protected:
-    Blip_Buffer buf_left{}, buf_right{};
-    Blip_Synth<blip_med_quality, 256> synth_left{}, synth_right{}, synth_left2{}, synth_right2{};
+    void SetLevels(BYTE bLeft_, BYTE bRight_, BYTE bLeft2_, BYTE bRight2_);
+    void SetSampleFreq(int nSampleFreq_);
+
+protected:
+    Blip_Stereo_Buffer buf{};
+    Blip_Stereo_Synth<blip_med_quality, 256> synth{};   // Combined levels of both DACs
+    BYTE m_bLeft = 0, m_bRight = 0, m_bLeft2 = 0, m_bRight2 = 0;  // Current output levels
+    bool m_fChanged = false, m_fChangedLast = false;            // Output changed this frame and last
 };
 
 // Spectrum-style BEEPer
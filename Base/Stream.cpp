@@ -22,6 +22,25 @@
 //  Currently supports read-write access of uncompressed files, gzipped
 //  files, and read-only zip archive access.
 //
+//  Files are opened once, with the first read identifying the container
+//  from its signature. The start of the data is cached for disk format
+//  detection, so probing each format doesn't go back to the file.
+//
+//  Uncompressed files can also be memory-mapped, for disk images that only
+//  read sectors on first use and save just the modified ones. Unmodified
+//  pages are still read from the file, so it mustn't be truncated while
+//  mapped. Windows refuses to truncate a mapped file. On POSIX systems we
+//  only map a file we can take an exclusive lock on, and otherwise fall back
+//  to reading it into memory. The lock is advisory, so it keeps out other
+//  instances but not every program. Unmap before replacing the file.
+//
+//  Rewritten files are written to a temporary file, which is only renamed
+//  over the original once it's complete and flushed to disk, so a crash or
+//  failed write mid-save can't leave a truncated image. Symlinks are
+//  resolved first, so the link target is replaced rather than the link.
+//  Files with other hard links, an owner we can't give the new file, or in
+//  a directory we can't create files in, are rewritten in place as before.
+//
 //  Access to real standard format disks is also supported where a
 //  Floppy.cpp implementation exists.
 
@@ -36,6 +55,11 @@
 #include "Floppy.h"
 #include "Util.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CStream::CStream(const char* pcszPath_, bool fReadOnly_/*=false*/)
@@ -63,17 +87,25 @@ CStream::~CStream()
     if (CFloppyStream::IsRecognised(pcszPath_))
         return new CFloppyStream(pcszPath_, fReadOnly_);
 
+    // Open the file just once, reading enough to identify both the container and the disk format
+    FILE* hf = fopen(pcszPath_, "rb");
+    if (!hf)
+        return nullptr;
+
+    BYTE abHeader[HEADER_SIZE];
+    size_t uHeader = fread(abHeader, 1, sizeof(abHeader), hf);
+
     // If the file is read-only, the stream will be read-only
-    FILE* file = fopen(pcszPath_, "r+b");
-    fReadOnly_ |= !file;
-    if (file)
-        fclose(file);
+    fReadOnly_ |= access(pcszPath_, W_OK) != 0;
 
 #ifdef HAVE_LIBZ
-    // Try and open it as a zip file
+    // Zip archives start with a local file header
     unzFile hfZip;
-    if ((hfZip = unzOpen(pcszPath_)))
+    if (uHeader >= sizeof(ZIP_SIGNATURE) && !memcmp(abHeader, ZIP_SIGNATURE, sizeof(ZIP_SIGNATURE)) &&
+        (hfZip = unzOpen(pcszPath_)))
     {
+        fclose(hf);
+
         // Iterate through the contents of the zip looking for a file with a suitable size
         for (int nRet = unzGoToFirstFile(hfZip); nRet == UNZ_OK; nRet = unzGoToNextFile(hfZip))
         {
@@ -93,43 +125,63 @@ CStream::~CStream()
 
         // Failed to open the first file, so close the zip
         unzClose(hfZip);
+        return nullptr;
     }
-    else
-#endif
+
+    if (uHeader >= sizeof(GZ_SIGNATURE) && !memcmp(abHeader, GZ_SIGNATURE, sizeof(GZ_SIGNATURE)))
     {
-        // Open the file using the regular CRT file functions
-        FILE* hf;
-        if ((hf = fopen(pcszPath_, "rb")))
-        {
-#ifdef HAVE_LIBZ
-            BYTE abSig[sizeof(GZ_SIGNATURE)];
-            if ((fread(abSig, 1, sizeof(abSig), hf) != sizeof(abSig)) || memcmp(abSig, GZ_SIGNATURE, sizeof(abSig)))
-#endif
-                return new CFileStream(hf, pcszPath_, fReadOnly_);
-#ifdef HAVE_LIBZ
-            else
-            {
-                BYTE ab[4] = {};
-                size_t uSize = 0;
+        BYTE ab[4] = {};
+        size_t uSize = 0;
 
-                // Read the uncompressed size from the end of the file (if under 4GiB)
-                if (fseek(hf, -4, SEEK_END) == 0 && fread(ab, 1, sizeof(ab), hf) == sizeof(ab))
-                    uSize = ((size_t)ab[3] << 24) | ((size_t)ab[2] << 16) | ((size_t)ab[1] << 8) | (size_t)ab[0];
+        // Read the uncompressed size from the end of the file (if under 4GiB)
+        if (fseek(hf, -4, SEEK_END) == 0 && fread(ab, 1, sizeof(ab), hf) == sizeof(ab))
+            uSize = ((size_t)ab[3] << 24) | ((size_t)ab[2] << 16) | ((size_t)ab[1] << 8) | (size_t)ab[0];
 
-                // Close the file so we can open it through ZLib
-                fclose(hf);
+        // Hand a duplicate of the file descriptor to ZLib, rather than opening the file again
+        int fd = dup(fileno(hf));
+        fclose(hf);
 
-                // Try to open it as a gzipped file
-                gzFile hfGZip;
-                if ((hfGZip = gzopen(pcszPath_, "rb")))
-                    return new CZLibStream(hfGZip, pcszPath_, uSize, fReadOnly_);
-            }
+        // The CRT may have left the descriptor anywhere, so start ZLib from the beginning
+        gzFile hfGZip = nullptr;
+        if (fd != -1 && (lseek(fd, 0, SEEK_SET) != 0 || !(hfGZip = gzdopen(fd, "rb"))))
+            close(fd);
+
+        return hfGZip ? new CZLibStream(hfGZip, pcszPath_, uSize, fReadOnly_) : nullptr;
+    }
 #endif  // HAVE_LIBZ
-        }
+
+    // Use the regular CRT file functions for anything else, keeping the header we've already read
+    if (fseek(hf, 0, SEEK_SET) != 0)
+    {
+        fclose(hf);
+        return nullptr;
+    }
+
+    CFileStream* pStream = new CFileStream(hf, pcszPath_, fReadOnly_);
+    pStream->SetHeader(abHeader, uHeader);
+    return pStream;
+}
+
+// Fetch the start of the stream, reading it only on first use
+size_t CStream::GetHeader(void* pv_, size_t uLen_)
+{
+    if (!m_fHeader)
+    {
+        BYTE abHeader[HEADER_SIZE];
+        size_t uHeader = Rewind() ? Read(abHeader, sizeof(abHeader)) : 0;
+        SetHeader(abHeader, uHeader);
     }
 
-    // Couldn't handle what we were given :-/
-    return nullptr;
+    uLen_ = std::min(uLen_, m_uHeader);
+    memcpy(pv_, m_abHeader, uLen_);
+    return uLen_;
+}
+
+void CStream::SetHeader(const void* pv_, size_t uLen_)
+{
+    m_uHeader = std::min(uLen_, sizeof(m_abHeader));
+    memcpy(m_abHeader, pv_, m_uHeader);
+    m_fHeader = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -139,8 +191,14 @@ CFileStream::CFileStream(FILE* hFile_, const char* pcszPath_, bool fReadOnly_/*=
 {
     struct stat st;
 
-    if (hFile_ && !stat(pcszPath_, &st))
-        m_uSize = static_cast<size_t>(st.st_size);
+    // An open file is ready for reading, without needing to reopen it
+    if (hFile_)
+    {
+        m_nMode = modeReading;
+
+        if (!fstat(fileno(hFile_), &st))
+            m_uSize = static_cast<size_t>(st.st_size);
+    }
 
     for (const char* p = pcszPath_; *p; p++)
     {
@@ -151,18 +209,37 @@ CFileStream::CFileStream(FILE* hFile_, const char* pcszPath_, bool fReadOnly_/*=
     m_pszFile = strdup(pcszPath_);
 }
 
+CFileStream::~CFileStream()
+{
+    Close();
+    Unmap();
+}
+
 void CFileStream::Close()
 {
     if (m_hFile)
     {
+        // Keep in-place updates safe on disk, as there's no temporary file to fall back on
+        if (m_nMode == modeUpdating)
+            Util::SyncFile(m_hFile);
+
         fclose(m_hFile);
         m_hFile = nullptr;
+
+        // Discard any uncommitted writes, unless they were made in place
+        if (m_nMode == modeWriting && !m_strTemp.empty())
+            unlink(m_strTemp.c_str());
+
         m_nMode = modeClosed;
     }
 }
 
 bool CFileStream::Rewind()
 {
+    // Seek back to the start if reading, to save reopening the file
+    if (m_nMode == modeReading)
+        return !fseek(m_hFile, 0, SEEK_SET);
+
     if (IsOpen())
         Close();
 
@@ -192,14 +269,113 @@ size_t CFileStream::Write(void* pvBuffer_, size_t uLen_)
         // Close the file, if open for reading
         Close();
 
-        // Open the file for writing, using compression if the source file did
-        if ((m_hFile = fopen(m_pszPath, "wb")))
+        // Open a temporary file for writing to replace the original when committed, or the original if it can't be
+        if ((m_hFile = Util::OpenForRewrite(m_pszPath, m_strTemp)))
             m_nMode = modeWriting;
     }
 
     return m_hFile ? fwrite(pvBuffer_, 1, uLen_, m_hFile) : 0;
 }
 
+bool CFileStream::Commit()
+{
+    if (!m_hFile)
+        return true;
+
+    // Flush the new data to disk through the handle that wrote it
+    int nMode = m_nMode;
+    bool fSuccess = nMode == modeReading || Util::SyncFile(m_hFile);
+    fSuccess &= !fclose(m_hFile);
+    m_hFile = nullptr;
+    m_nMode = modeClosed;
+
+    // Replace the original with a rewritten file
+    if (nMode == modeWriting)
+    {
+        if (fSuccess)
+            return Util::CommitFile(m_strTemp.c_str(), m_pszPath);
+
+        if (!m_strTemp.empty())
+            unlink(m_strTemp.c_str());
+    }
+
+    return fSuccess;
+}
+
+// Map the file as private copy-on-write pages, so changes only reach the file if saved
+BYTE* CFileStream::Map()
+{
+    if (!m_pbMap && m_uSize)
+    {
+        // Map through the file we have open, if any, rather than opening it again
+#ifdef _WIN32
+        HANDLE hFile = m_hFile ? reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(m_hFile))) :
+            CreateFileA(m_pszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (hMapping)
+            {
+                m_pbMap = reinterpret_cast<BYTE*>(MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, m_uSize));
+                CloseHandle(hMapping);
+            }
+
+            if (!m_hFile)
+                CloseHandle(hFile);
+        }
+#else
+        // Only map a file we can lock, as unmodified pages would fault if another instance truncated it
+        int fd = m_hFile ? dup(fileno(m_hFile)) : open(m_pszPath, O_RDONLY);
+        if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == 0)
+        {
+            void* pv = mmap(nullptr, m_uSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (pv != MAP_FAILED)
+            {
+                m_pbMap = reinterpret_cast<BYTE*>(pv);
+                m_nMapLock = fd;
+            }
+        }
+
+        if (fd != -1 && !m_pbMap)
+            close(fd);
+#endif
+    }
+
+    return m_pbMap;
+}
+
+// Release the mapped view, and any lock held for it
+void CFileStream::Unmap()
+{
+    if (m_pbMap)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_pbMap);
+#else
+        munmap(m_pbMap, m_uSize);
+        close(m_nMapLock);
+        m_nMapLock = -1;
+#endif
+        m_pbMap = nullptr;
+    }
+}
+
+// Overwrite part of the existing file, leaving the rest untouched
+bool CFileStream::Update(size_t uOffset_, const void* pv_, size_t uLen_)
+{
+    if (m_nMode != modeUpdating)
+    {
+        // Close the file, if open for reading or writing
+        Close();
+
+        if ((m_hFile = fopen(m_pszPath, "r+b")))
+            m_nMode = modeUpdating;
+    }
+
+    return m_hFile && fseek(m_hFile, static_cast<long>(uOffset_), SEEK_SET) == 0 &&
+        fwrite(pv_, 1, uLen_, m_hFile) == uLen_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CMemStream::CMemStream(void* pv_, size_t uLen_, const char* pcszPath_)
@@ -249,6 +425,9 @@ size_t CMemStream::Write(void* /*pvBuffer_*/, size_t /*uLen_*/)
 CZLibStream::CZLibStream(gzFile hFile_, const char* pcszPath_, size_t uSize_, bool fReadOnly_/*=false*/)
     : CStream(pcszPath_, fReadOnly_), m_hFile(hFile_), m_uSize(uSize_)
 {
+    if (hFile_)
+        m_nMode = modeReading;
+
     for (const char* p = pcszPath_; *p; p++)
     {
         if (*p == PATH_SEPARATOR)
@@ -267,6 +446,17 @@ void CZLibStream::Close()
     {
         gzclose(m_hFile);
         m_hFile = nullptr;
+
+        if (m_hTemp)
+        {
+            fclose(m_hTemp);
+            m_hTemp = nullptr;
+        }
+
+        // Discard any uncommitted writes, unless they were made in place
+        if (m_nMode == modeWriting && !m_strTemp.empty())
+            unlink(m_strTemp.c_str());
+
         m_nMode = modeClosed;
     }
 }
@@ -321,14 +511,60 @@ size_t CZLibStream::Write(void* pvBuffer_, size_t uLen_)
         // Close the file, if open for reading
         Close();
 
-        // Open the file for writing, using compression if the source file did
-        if ((m_hFile = gzopen(m_pszPath, "wb9")))
-            m_nMode = modeWriting;
+        // Open a temporary file for compressed writing to replace the original when committed, or the original if it
+        // can't be. ZLib gets its own descriptor, leaving us a handle to flush the file to disk afterwards
+        if ((m_hTemp = Util::OpenForRewrite(m_pszPath, m_strTemp)))
+        {
+            int fd = dup(fileno(m_hTemp));
+            if (fd != -1 && !(m_hFile = gzdopen(fd, "wb9")))
+                close(fd);
+
+            if (m_hFile)
+                m_nMode = modeWriting;
+            else
+            {
+                fclose(m_hTemp);
+                m_hTemp = nullptr;
+
+                if (!m_strTemp.empty())
+                    unlink(m_strTemp.c_str());
+            }
+        }
     }
 
     return m_hFile ? gzwrite(m_hFile, pvBuffer_, static_cast<unsigned>(uLen_)) : 0;
 }
 
+bool CZLibStream::Commit()
+{
+    if (!m_hFile)
+        return true;
+
+    int nMode = m_nMode;
+    bool fSuccess = gzclose(m_hFile) == Z_OK;
+    m_hFile = nullptr;
+    m_nMode = modeClosed;
+
+    // Flush the compressed data to disk, now ZLib has written it all
+    if (m_hTemp)
+    {
+        fSuccess = fSuccess && Util::SyncFile(m_hTemp);
+        fSuccess &= !fclose(m_hTemp);
+        m_hTemp = nullptr;
+    }
+
+    if (nMode == modeWriting)
+    {
+        if (fSuccess)
+            return Util::CommitFile(m_strTemp.c_str(), m_pszPath);
+
+        if (!m_strTemp.empty())
+            unlink(m_strTemp.c_str());
+    }
+
+    return fSuccess;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CZipStream::CZipStream(unzFile hFile_, const char* pcszPath_, bool fReadOnly_/*=false*/)
@@ -38,19 +38,42 @@ public:
     virtual size_t GetSize() { return m_uSize; }
     virtual bool IsOpen() const = 0;
 
+    // Copy of the start of the stream data, read once to identify the contents
+    size_t GetHeader(void* pv_, size_t uLen_);
+
     virtual void Close() = 0;
     virtual bool Rewind() = 0;
     virtual size_t Read(void* pvBuffer_, size_t uLen_) = 0;
     virtual size_t Write(void* pvBuffer_, size_t uLen_) = 0;
 
+    // Writes go to a temporary file until committed, which replaces the original (Close discards them)
+    virtual bool Commit() { Close(); return true; }
+
+    // Copy-on-write view of the stream contents, with in-place updates of modified ranges
+    virtual BYTE* Map() { return nullptr; }
+    virtual void Unmap() { }
+    virtual bool CanUpdate() const { return false; }
+    virtual bool Update(size_t /*uOffset_*/, const void* /*pv_*/, size_t /*uLen_*/) { return false; }
+
+protected:
+    void SetHeader(const void* pv_, size_t uLen_);
+
 protected:
-    enum { modeClosed, modeReading, modeWriting };
+    static const size_t HEADER_SIZE = 256;  // Enough for any disk image header
+
+    enum { modeClosed, modeReading, modeWriting, modeUpdating };
     int m_nMode = modeClosed;
 
     char* m_pszPath = nullptr;
     char* m_pszFile = nullptr;
     bool m_fReadOnly = false;
     size_t m_uSize = 0;
+
+    std::string m_strTemp;      // Temporary file receiving writes, alongside the original
+
+    BYTE m_abHeader[HEADER_SIZE];
+    size_t m_uHeader = 0;
+    bool m_fHeader = false;     // Header cached?
 };
 
 class CFileStream final : public CStream
@@ -59,7 +82,7 @@ public:
     CFileStream(FILE* hFile_, const char* pcszPath_, bool fReadOnly_ = false);
     CFileStream(const CFileStream&) = delete;
     void operator= (const CFileStream&) = delete;
-    ~CFileStream() { Close(); }
+    ~CFileStream();
 
 public:
     bool IsOpen() const override { return m_hFile != nullptr; }
@@ -69,9 +92,17 @@ public:
     bool Rewind() override;
     size_t Read(void* pvBuffer_, size_t uLen_) override;
     size_t Write(void* pvBuffer_, size_t uLen_) override;
+    bool Commit() override;
+
+    BYTE* Map() override;
+    void Unmap() override;
+    bool CanUpdate() const override { return true; }
+    bool Update(size_t uOffset_, const void* pv_, size_t uLen_) override;
 
 protected:
     FILE* m_hFile = nullptr;
+    BYTE* m_pbMap = nullptr;    // Mapped file view, if any
+    int m_nMapLock = -1;        // Descriptor holding a lock on the mapped file (POSIX)
 };
 
 class CMemStream final : public CStream
@@ -100,6 +131,7 @@ protected:
 #ifdef HAVE_LIBZ
 
 const BYTE GZ_SIGNATURE[] = { 0x1f, 0x8b };
+const BYTE ZIP_SIGNATURE[] = { 'P', 'K', 0x03, 0x04 };
 
 class CZLibStream final : public CStream
 {
@@ -118,9 +150,11 @@ public:
     bool Rewind() override;
     size_t Read(void* pvBuffer_, size_t uLen_) override;
     size_t Write(void* pvBuffer_, size_t uLen_) override;
+    bool Commit() override;
 
 protected:
     gzFile m_hFile = nullptr;
+    FILE* m_hTemp = nullptr;    // Temporary file beneath the compressed writes, kept to flush it
     size_t m_uSize = 0;
 };
 
@@ -78,6 +78,99 @@ char* GetUniqueFile(const char* pcszExt_, char* psz_, int cb_)
     return psz_ + strlen(pcszPath);
 }
 
+// Flush the buffered contents of an open file all the way to disk
+bool SyncFile(FILE* hFile_)
+{
+    if (fflush(hFile_))
+        return false;
+
+#ifdef _WIN32
+    return !_commit(_fileno(hFile_));
+#else
+    return !fsync(fileno(hFile_));
+#endif
+}
+
+// Real file behind a path, so replacing a symlinked file updates the link target
+static std::string ResolvePath(const char* pcszPath_)
+{
+    std::error_code ec;
+    auto path = fs::canonical(pcszPath_, ec);
+    return ec ? pcszPath_ : path.string();
+}
+
+// Open a file to be rewritten, preferring a temporary file alongside it to replace it when committed.
+// If the original can't be replaced without losing its other hard links or its owner, or the temporary
+// file can't be created, the original is rewritten in place instead and strTemp_ is left empty.
+FILE* OpenForRewrite(const char* pcszPath_, std::string& strTemp_)
+{
+    std::string strPath = ResolvePath(pcszPath_);
+    strTemp_.clear();
+
+    struct stat st;
+    bool fExists = !::stat(strPath.c_str(), &st);
+
+    if (!fExists || st.st_nlink == 1)
+    {
+        std::string strTemp = strPath + ".tmp";
+        FILE* f = fopen(strTemp.c_str(), "wb");
+        if (f)
+        {
+#ifndef _WIN32
+            // Keep the permissions, owner and group of any file being replaced
+            if (!fExists || (!fchmod(fileno(f), st.st_mode & 07777) && !fchown(fileno(f), st.st_uid, st.st_gid)))
+#endif
+            {
+                strTemp_ = strTemp;
+                return f;
+            }
+
+            fclose(f);
+            unlink(strTemp.c_str());
+        }
+    }
+
+    return fopen(strPath.c_str(), "wb");
+}
+
+// Rename a completed temporary file from OpenForRewrite() over the original, or remove it on failure
+// The temporary file should already have been flushed with SyncFile() before closing
+bool CommitFile(const char* pcszTemp_, const char* pcszPath_)
+{
+    // Nothing to do if the original was rewritten in place
+    if (!*pcszTemp_)
+        return true;
+
+    std::string strPath = ResolvePath(pcszPath_);
+    bool fRet = true;
+
+#ifdef _WIN32
+    fRet = fRet && MoveFileExA(pcszTemp_, strPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    fRet = fRet && !rename(pcszTemp_, strPath.c_str());
+
+    // Flush the directory entry, so the rename survives a crash too
+    if (fRet)
+    {
+        std::string strDir(strPath);
+        size_t nSep = strDir.rfind(PATH_SEPARATOR);
+        strDir = (nSep == std::string::npos) ? "." : strDir.substr(0, nSep + 1);
+
+        int fd = open(strDir.c_str(), O_RDONLY);
+        if (fd != -1)
+        {
+            fsync(fd);
+            close(fd);
+        }
+    }
+#endif
+
+    if (!fRet)
+        unlink(pcszTemp_);
+
+    return fRet;
+}
+
 } // namespace Util
 
 //////////////////////////////////////////////////////////////////////////////
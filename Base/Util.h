@@ -26,6 +26,9 @@ bool Init();
 void Exit();
 
 char* GetUniqueFile(const char* pcszExt_, char* pszPath_, int cbPath_);
+bool SyncFile(FILE* hFile_);
+FILE* OpenForRewrite(const char* pcszPath_, std::string& strTemp_);
+bool CommitFile(const char* pcszTemp_, const char* pcszPath_);
 }
 
 
@@ -31,6 +31,7 @@ namespace Video
 
 static VideoBase* pVideo;
 static bool afDirty[HEIGHT_LINES * 2];
+static int anDirtyLeft[HEIGHT_LINES * 2], anDirtyRight[HEIGHT_LINES * 2];    // changed pixel range on dirty lines
 
 
 bool Init(bool fFirstInit_)
@@ -54,15 +55,38 @@ bool IsLineDirty(int nLine_)
     return afDirty[nLine_];
 }
 
+// Fetch the changed pixel range [left,right) of a dirty line
+void GetDirtySpan(int nLine_, int* pnLeft_, int* pnRight_)
+{
+    *pnLeft_ = anDirtyLeft[nLine_];
+    *pnRight_ = anDirtyRight[nLine_];
+}
+
 void SetLineDirty(int nLine_)
 {
-    afDirty[nLine_] = true;
+    SetLineDirty(nLine_, 0, Frame::GetWidth());
+}
+
+// Mark part of a line as changed, extending any existing change on it
+void SetLineDirty(int nLine_, int nLeft_, int nRight_)
+{
+    if (!afDirty[nLine_])
+    {
+        afDirty[nLine_] = true;
+        anDirtyLeft[nLine_] = nLeft_;
+        anDirtyRight[nLine_] = nRight_;
+    }
+    else
+    {
+        anDirtyLeft[nLine_] = std::min(anDirtyLeft[nLine_], nLeft_);
+        anDirtyRight[nLine_] = std::max(anDirtyRight[nLine_], nRight_);
+    }
 }
 
 void SetDirty()
 {
     for (int i = 0, nHeight = Frame::GetHeight(); i < nHeight; i++)
-        afDirty[i] = true;
+        SetLineDirty(i);
 }
 
 
@@ -30,7 +30,9 @@ bool Init(bool fFirstInit_ = false);
 void Exit(bool fReInit_ = false);
 
 bool IsLineDirty(int nLine_);
+void GetDirtySpan(int nLine_, int* pnLeft_, int* pnRight_);
 void SetLineDirty(int nLine_);
+void SetLineDirty(int nLine_, int nLeft_, int nRight_);
 void SetDirty();
 
 bool CheckCaps(int nCaps_);
@@ -18,9 +18,18 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
+// Notes:
+//  Frames are copied into a preallocated ring and written by a worker thread,
+//  so slow disk writes don't stall emulation. The header is refreshed every
+//  second, leaving a playable file if the recording is interrupted.
+//
+//  RIFF sizes are 32-bit, so long recordings are split into a new file before
+//  reaching 4GB. FLAC output is lossless and has no such size limit.
+
 #include "SimCoupe.h"
 #include "WAV.h"
 
+#include "FLAC.h"
 #include "Frame.h"
 #include "Options.h"
 #include "Sound.h"
@@ -28,10 +37,37 @@
 namespace WAV
 {
 
+const int MAX_QUEUED_FRAMES = EMULATED_FRAMES_PER_SECOND;   // Frames waiting to be written, before emulation waits
+const int REFRESH_FRAMES = EMULATED_FRAMES_PER_SECOND;      // Frames between header updates
+
 static char szPath[MAX_PATH], * pszFile;
 static FILE* f;
 static int nFrames, nSilent = 0;
-static bool fSegment;
+static bool fSegment, fFLAC;
+static int64_t llQueued;        // Data bytes queued for the current file
+
+typedef struct
+{
+    std::vector<BYTE> vData;    // Sample data, sized for the largest frame
+    int nLen;                   // Bytes of sample data
+    int nSilent;                // Silent frames preceding the data
+} WAV_FRAME;
+
+static WAV_FRAME asFrames[MAX_QUEUED_FRAMES];
+static std::vector<WAV_FRAME*> vFree;
+static std::queue<WAV_FRAME*> qPending;
+
+static std::thread thWorker;
+static std::mutex mtxQueue;
+static std::condition_variable cvQueue, cvFree;
+static bool fQuit;
+static std::atomic<bool> fWriteError;
+
+// Writer thread state, only used by the main thread when the worker isn't running
+static CFLACEncoder* pFLAC;
+static std::vector<BYTE> vEncoded, vSilence;
+static int64_t llWritten;
+static int nUnrefreshed;
 
 
 // RIFF header must be byte-packed
@@ -76,12 +112,118 @@ struct tagRIFF
 
 #pragma pack()
 
+// Largest whole-sample data size that keeps the RIFF length within 32 bits
+const int64_t MAX_DATA_SIZE = (0xffffffffLL - sizeof(riff.wave)) / SAMPLE_BLOCK * SAMPLE_BLOCK;
+
 ////////////////////////////////////////////////////////////////////////////////
 
-static void WriteWaveValue(long lVal_, BYTE* pb_, int nSize_)
+// 64-bit file seek, as recordings are split just short of 4GB
+static bool FileSeek(FILE* f_, int64_t llOffset_, int nOrigin_)
+{
+#ifdef _MSC_VER
+    return _fseeki64(f_, llOffset_, nOrigin_) == 0;
+#else
+    return fseeko(f_, llOffset_, nOrigin_) == 0;
+#endif
+}
+
+static void WriteWaveValue(DWORD dwVal_, BYTE* pb_, int nSize_)
 {
     for (int i = 0; i < nSize_; i++)
-        *pb_++ = static_cast<BYTE>((lVal_ >> (i << 3)) & 0xff);
+        *pb_++ = static_cast<BYTE>((dwVal_ >> (i << 3)) & 0xff);
+}
+
+// Rewrite the file header for the data written so far
+static bool WriteHeader()
+{
+    if (!FileSeek(f, 0, SEEK_SET))
+        return false;
+
+    bool fOK;
+
+    if (pFLAC)
+    {
+        std::vector<BYTE> vHeader;
+        pFLAC->EncodeHeader(vHeader);
+        fOK = fwrite(vHeader.data(), 1, vHeader.size(), f) == vHeader.size();
+    }
+    else
+    {
+        WriteWaveValue(static_cast<DWORD>(llWritten), riff.wave.pcmdata.datalen, sizeof(int32_t));
+        WriteWaveValue(static_cast<DWORD>(llWritten + sizeof(riff.wave)), riff.abWaveLen, sizeof(int32_t));
+        fOK = fwrite(&riff, 1, sizeof(riff), f) == sizeof(riff);
+    }
+
+    // Return to the end of the data, and push everything out to the file
+    return FileSeek(f, 0, SEEK_END) && fOK && fflush(f) == 0;
+}
+
+static bool WriteFrame(const WAV_FRAME* pFrame_)
+{
+    if (pFLAC)
+    {
+        // Silence must be encoded as samples
+        vSilence.resize(pFrame_->nLen);
+        for (int i = 0; i < pFrame_->nSilent; i++)
+            pFLAC->AddSamples(vEncoded, reinterpret_cast<const int16_t*>(vSilence.data()), pFrame_->nLen / SAMPLE_BLOCK);
+
+        pFLAC->AddSamples(vEncoded, reinterpret_cast<const int16_t*>(pFrame_->vData.data()), pFrame_->nLen / SAMPLE_BLOCK);
+
+        if (!vEncoded.empty() && fwrite(vEncoded.data(), 1, vEncoded.size(), f) != vEncoded.size())
+            return false;
+
+        vEncoded.clear();
+    }
+    else
+    {
+        // Skip over any silence, which leaves zeroed data in the file
+        int64_t llSilence = static_cast<int64_t>(pFrame_->nLen) * pFrame_->nSilent;
+        if (llSilence && !FileSeek(f, llSilence, SEEK_CUR))
+            return false;
+
+        if (fwrite(pFrame_->vData.data(), pFrame_->nLen, 1, f) != 1)
+            return false;
+
+        llWritten += llSilence + pFrame_->nLen;
+    }
+
+    // Keep the header current, so an interrupted recording is still valid
+    nUnrefreshed += pFrame_->nSilent + 1;
+    if (nUnrefreshed >= REFRESH_FRAMES)
+    {
+        nUnrefreshed = 0;
+        return WriteHeader();
+    }
+
+    return true;
+}
+
+static void WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(mtxQueue);
+
+    for (;;)
+    {
+        // Wait for a frame to write, finishing the queue before quitting
+        cvQueue.wait(lock, [] { return fQuit || !qPending.empty(); });
+        if (qPending.empty())
+            break;
+
+        WAV_FRAME* pFrame = qPending.front();
+        qPending.pop();
+        lock.unlock();
+
+        // Discard frames after a write failure, leaving the main thread to stop
+        if (!fWriteError && !WriteFrame(pFrame))
+        {
+            TRACE("!!! WAV::WorkerThread(): write failed\n");
+            fWriteError = true;
+        }
+
+        lock.lock();
+        vFree.push_back(pFrame);
+        cvFree.notify_one();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -92,27 +234,53 @@ bool Start(bool fSegment_)
     if (f)
         return false;
 
-    // Find a unique filename to use, in the format sndNNNN.wav
-    pszFile = Util::GetUniqueFile("wav", szPath, sizeof(szPath));
+    // Find a unique filename to use, in the format sndNNNN.wav or sndNNNN.flac
+    fFLAC = GetOption(wavflac);
+    pszFile = Util::GetUniqueFile(fFLAC ? "flac" : "wav", szPath, sizeof(szPath));
 
     // Create the file
     f = fopen(szPath, "wb");
     if (!f)
         return false;
 
-    // Write the RIFF header
-    WriteWaveValue(SAMPLE_CHANNELS, riff.wave.fmt.Channels, sizeof(riff.wave.fmt.Channels));
-    WriteWaveValue(SAMPLE_FREQ, riff.wave.fmt.SamplesPerSec, sizeof(riff.wave.fmt.SamplesPerSec));
-    WriteWaveValue(SAMPLE_FREQ * SAMPLE_BLOCK, riff.wave.fmt.AvgBytesPerSec, sizeof(riff.wave.fmt.AvgBytesPerSec));
-    WriteWaveValue(SAMPLE_BLOCK, riff.wave.fmt.BlockAlign, sizeof(riff.wave.fmt.BlockAlign));
-    WriteWaveValue(SAMPLE_BITS, riff.wave.fmt.BitsPerSample, sizeof(riff.wave.fmt.BitsPerSample));
-    fwrite(&riff, sizeof(riff), 1, f);
+    // Write the initial file header
+    if (fFLAC)
+    {
+        pFLAC = new CFLACEncoder(Sound::GetSampleFreq(), SAMPLE_CHANNELS);
+        pFLAC->EncodeHeader(vEncoded);
+        fwrite(vEncoded.data(), 1, vEncoded.size(), f);
+        vEncoded.clear();
+    }
+    else
+    {
+        WriteWaveValue(SAMPLE_CHANNELS, riff.wave.fmt.Channels, sizeof(riff.wave.fmt.Channels));
+        WriteWaveValue(Sound::GetSampleFreq(), riff.wave.fmt.SamplesPerSec, sizeof(riff.wave.fmt.SamplesPerSec));
+        WriteWaveValue(Sound::GetSampleFreq() * SAMPLE_BLOCK, riff.wave.fmt.AvgBytesPerSec, sizeof(riff.wave.fmt.AvgBytesPerSec));
+        WriteWaveValue(SAMPLE_BLOCK, riff.wave.fmt.BlockAlign, sizeof(riff.wave.fmt.BlockAlign));
+        WriteWaveValue(SAMPLE_BITS, riff.wave.fmt.BitsPerSample, sizeof(riff.wave.fmt.BitsPerSample));
+        WriteWaveValue(0, riff.wave.pcmdata.datalen, sizeof(riff.wave.pcmdata.datalen));
+        WriteWaveValue(sizeof(riff.wave), riff.abWaveLen, sizeof(riff.abWaveLen));
+        fwrite(&riff, sizeof(riff), 1, f);
+    }
 
     // Reset the frame counters and store the fragment flag
     nFrames = nSilent = 0;
+    llQueued = llWritten = 0;
+    nUnrefreshed = 0;
     fSegment = fSegment_;
 
-    Frame::SetStatus("Recording WAV%s", fSegment_ ? " segment" : "");
+    // Prepare the frame ring and start the writer
+    vFree.clear();
+    for (auto& frame : asFrames)
+    {
+        frame.vData.resize(MAX_SAMPLES_PER_FRAME * SAMPLE_BLOCK);
+        vFree.push_back(&frame);
+    }
+
+    fQuit = fWriteError = false;
+    thWorker = std::thread(WorkerThread);
+
+    Frame::SetStatus("Recording %s%s", fFLAC ? "FLAC" : "WAV", fSegment_ ? " segment" : "");
     return true;
 }
 
@@ -122,28 +290,40 @@ void Stop()
     if (!f)
         return;
 
-    // Update the data length in the header
-    long lDataSize = ftell(f) - sizeof(riff);
-    WriteWaveValue(lDataSize, riff.wave.pcmdata.datalen, sizeof(int32_t));
-    WriteWaveValue(lDataSize + sizeof(riff.wave), riff.abWaveLen, sizeof(int32_t));
+    // Wait for the writer to finish the queued frames
+    {
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        fQuit = true;
+    }
+    cvQueue.notify_one();
+    thWorker.join();
 
-    // Rewrite the completed file header
-    if (fseek(f, 0, SEEK_SET) == 0)
+    // Write the final partial FLAC block
+    if (pFLAC)
     {
-        if (fwrite(&riff, 1, sizeof(riff), f) != sizeof(riff))
-            TRACE("!!! WAV::Stop(): Failed to write RIFF header\n");
+        pFLAC->Flush(vEncoded);
+        if (!vEncoded.empty() && fwrite(vEncoded.data(), 1, vEncoded.size(), f) != vEncoded.size())
+            fWriteError = true;
+        vEncoded.clear();
     }
 
+    // Rewrite the completed file header
+    if (!WriteHeader())
+        TRACE("!!! WAV::Stop(): Failed to write file header\n");
+
     // Close the recording
     fclose(f);
     f = nullptr;
+    delete pFLAC; pFLAC = nullptr;
 
     // Report what happened
-    if (nFrames)
+    if (fWriteError)
+        Frame::SetStatus("Failed to write %s", pszFile);
+    else if (nFrames)
         Frame::SetStatus("Saved %s", pszFile);
     else
     {
-        Frame::SetStatus("WAV cancelled");
+        Frame::SetStatus("%s cancelled", fFLAC ? "FLAC" : "WAV");
         unlink(szPath);
     }
 }
@@ -168,6 +348,13 @@ void AddFrame(const BYTE* pb_, int nLen_)
     if (!f)
         return;
 
+    // Stop if the writer has failed
+    if (fWriteError)
+    {
+        Stop();
+        return;
+    }
+
     // Check for a full frame of repeated samples (silence)
     if (!memcmp(pb_, pb_ + SAMPLE_BLOCK, nLen_ - SAMPLE_BLOCK))
     {
@@ -176,25 +363,44 @@ void AddFrame(const BYTE* pb_, int nLen_)
         // If we're recording a segment, stop if the silence threshold has been exceeded
         if (fSegment && nFrames && nSilent > 2 * EMULATED_FRAMES_PER_SECOND)
             Stop();
+
+        return;
     }
-    else
+
+    // Add any accumulated silence, unless we're at the start of the recording
+    int nSilentFrames = nFrames ? nSilent : 0;
+    nSilent = 0;
+
+    // Continue in a new file if the RIFF size limit would be exceeded, carrying over any silence
+    int64_t llSize = static_cast<int64_t>(nLen_) * (nSilentFrames + 1);
+    if (!fFLAC && llQueued + llSize > MAX_DATA_SIZE)
     {
-        // Do we have any frames of buffered silence?
-        if (nSilent)
-        {
-            // Add the accumulated silence, unless we're at the start of the recording
-            if (nFrames && fseek(f, nLen_ * nSilent, SEEK_CUR) == 0)
-                nFrames += nSilent;
+        Stop();
+        if (!Start(fSegment))
+            return;
+    }
 
-            nSilent = 0;
-        }
+    WAV_FRAME* pFrame;
+    {
+        // Wait for a free buffer if the writer has fallen behind, as audio can't be dropped
+        std::unique_lock<std::mutex> lock(mtxQueue);
+        cvFree.wait(lock, [] { return !vFree.empty(); });
+        pFrame = vFree.back();
+        vFree.pop_back();
+    }
 
-        // Write the new frame data
-        if (fwrite(pb_, nLen_, 1, f))
-            nFrames++;
-        else
-            Stop();
+    memcpy(pFrame->vData.data(), pb_, nLen_);
+    pFrame->nLen = nLen_;
+    pFrame->nSilent = nSilentFrames;
+
+    nFrames += nSilentFrames + 1;
+    llQueued += llSize;
+
+    {
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        qPending.push(pFrame);
     }
+    cvQueue.notify_one();
 }
 
 } // namespace WAV
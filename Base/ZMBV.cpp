@@ -0,0 +1,225 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// ZMBV.cpp: Zip Motion Blocks Video encoder, for AVI recording
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  This is the 8-bit paletted subset of the format used by DOSBox, which
+//  is supported by ffmpeg/libavcodec players as well as the DOSBox VfW codec.
+//
+//  Each frame starts with a flags byte (bit 0 set for key frames). Key frames
+//  follow it with a short header, then a deflated RGB palette and the full
+//  image. Delta frames have a deflated table of block motion vectors, each
+//  block optionally followed by its XOR difference from the previous frame.
+//  The deflate stream continues across frames, and is reset at key frames.
+
+#include "SimCoupe.h"
+#include "ZMBV.h"
+
+#ifdef HAVE_LIBZ
+
+const int BLOCK_WIDTH = 16;         // Block dimensions used for motion vectors
+const int BLOCK_HEIGHT = 16;
+const int MAX_VECTOR = 16;          // Maximum motion vector search distance
+
+const BYTE FLAG_KEYFRAME = 0x01;
+const BYTE VERSION_HIGH = 0, VERSION_LOW = 1;
+const BYTE COMPRESSION_ZLIB = 1;
+const BYTE FORMAT_8BPP = 4;
+
+CZMBVEncoder::CZMBVEncoder(int nWidth_, int nHeight_, int nLevel_)
+    : m_nWidth(nWidth_), m_nHeight(nHeight_)
+{
+    m_nBlocksX = (m_nWidth + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+    m_nBlocksY = (m_nHeight + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
+
+    m_vbPrev.resize(m_nWidth * m_nHeight);
+    m_vbCurr.resize(m_nWidth * m_nHeight);
+    m_vbWork.reserve(256 * 3 + m_nBlocksX * m_nBlocksY * (2 + BLOCK_WIDTH * BLOCK_HEIGHT) + 4);
+
+    m_fValid = deflateInit(&m_zs, std::min(std::max(nLevel_, 1), 9)) == Z_OK;
+}
+
+CZMBVEncoder::~CZMBVEncoder()
+{
+    if (m_fValid)
+        deflateEnd(&m_zs);
+}
+
+
+// Count differing pixels between the current block and the previous frame at the given offset, stopping at nLimit_
+int CZMBVEncoder::CompareBlock(int nX_, int nY_, int nWidth_, int nHeight_, int nDX_, int nDY_, int nLimit_)
+{
+    int nDiffs = 0;
+
+    for (int y = 0; y < nHeight_; y++)
+    {
+        const BYTE* pbC = &m_vbCurr[(nY_ + y) * m_nWidth + nX_];
+        const BYTE* pbP = &m_vbPrev[(nY_ + y + nDY_) * m_nWidth + nX_ + nDX_];
+
+        for (int x = 0; x < nWidth_; x++)
+            nDiffs += (pbC[x] != pbP[x]);
+
+        if (nDiffs >= nLimit_)
+            break;
+    }
+
+    return nDiffs;
+}
+
+// Find the best motion vector for a block, returning true if the block differs from its reference
+bool CZMBVEncoder::FindVector(int nX_, int nY_, int nWidth_, int nHeight_, int* pnDX_, int* pnDY_)
+{
+    int nBest = CompareBlock(nX_, nY_, nWidth_, nHeight_, 0, 0, INT_MAX);
+    *pnDX_ = *pnDY_ = 0;
+
+    // Unchanged blocks are the most common case
+    if (!nBest)
+        return false;
+
+    // Try scrolling offsets along each axis, which suits most SAM software
+    int anCandidates[4 * MAX_VECTOR + 1][2];
+    int nCandidates = 0;
+
+    for (int i = 1; i <= MAX_VECTOR; i++)
+    {
+        anCandidates[nCandidates][0] = 0; anCandidates[nCandidates++][1] = -i;
+        anCandidates[nCandidates][0] = 0; anCandidates[nCandidates++][1] = i;
+        anCandidates[nCandidates][0] = -i; anCandidates[nCandidates++][1] = 0;
+        anCandidates[nCandidates][0] = i; anCandidates[nCandidates++][1] = 0;
+    }
+
+    for (int i = 0; i < nCandidates && nBest; i++)
+    {
+        int nDX = anCandidates[i][0], nDY = anCandidates[i][1];
+
+        // The reference block must lie entirely within the frame
+        if (nX_ + nDX < 0 || nX_ + nDX + nWidth_ > m_nWidth || nY_ + nDY < 0 || nY_ + nDY + nHeight_ > m_nHeight)
+            continue;
+
+        int nDiffs = CompareBlock(nX_, nY_, nWidth_, nHeight_, nDX, nDY, nBest);
+        if (nDiffs < nBest)
+        {
+            nBest = nDiffs;
+            *pnDX_ = nDX;
+            *pnDY_ = nDY;
+        }
+    }
+
+    return nBest != 0;
+}
+
+// Append the deflated data, flushed to a byte boundary so the frame can be decoded alone
+void CZMBVEncoder::Deflate(std::vector<BYTE>& vOut_, const BYTE* pb_, size_t uLen_)
+{
+    size_t uStart = vOut_.size();
+    vOut_.resize(uStart + deflateBound(&m_zs, static_cast<uLong>(uLen_)) + 16);
+
+    m_zs.next_in = const_cast<BYTE*>(pb_);
+    m_zs.avail_in = static_cast<uInt>(uLen_);
+    m_zs.next_out = vOut_.data() + uStart;
+    m_zs.avail_out = static_cast<uInt>(vOut_.size() - uStart);
+
+    deflate(&m_zs, Z_SYNC_FLUSH);
+    vOut_.resize(vOut_.size() - m_zs.avail_out);
+}
+
+
+// Encode a top-down frame of palette indices, or nullptr to repeat the previous frame.
+// The palette is 256 RGB triplets, and is only stored in key frames.
+void CZMBVEncoder::EncodeFrame(std::vector<BYTE>& vOut_, const BYTE* pbFrame_, const BYTE* pbPalette_, bool fKeyFrame_)
+{
+    m_vbWork.clear();
+
+    // A repeated frame is a delta frame with no changes
+    if (!pbFrame_)
+        fKeyFrame_ = false;
+    else
+        memcpy(m_vbCurr.data(), pbFrame_, m_vbCurr.size());
+
+    if (fKeyFrame_)
+    {
+        vOut_.push_back(FLAG_KEYFRAME);
+        vOut_.push_back(VERSION_HIGH);
+        vOut_.push_back(VERSION_LOW);
+        vOut_.push_back(COMPRESSION_ZLIB);
+        vOut_.push_back(FORMAT_8BPP);
+        vOut_.push_back(BLOCK_WIDTH);
+        vOut_.push_back(BLOCK_HEIGHT);
+
+        // Key frames start a new deflate stream
+        deflateReset(&m_zs);
+
+        m_vbWork.insert(m_vbWork.end(), pbPalette_, pbPalette_ + 256 * 3);
+        m_vbWork.insert(m_vbWork.end(), m_vbCurr.begin(), m_vbCurr.end());
+    }
+    else
+    {
+        vOut_.push_back(0x00);
+
+        // The vector table is padded to a 4-byte boundary, with the XOR data following it
+        size_t uVectors = (m_nBlocksX * m_nBlocksY * 2 + 3) & ~3;
+        m_vbWork.resize(uVectors);
+
+        if (pbFrame_)
+        {
+            BYTE* pbVector = m_vbWork.data();
+
+            for (int y = 0; y < m_nHeight; y += BLOCK_HEIGHT)
+            {
+                int nHeight = std::min(BLOCK_HEIGHT, m_nHeight - y);
+
+                for (int x = 0; x < m_nWidth; x += BLOCK_WIDTH, pbVector += 2)
+                {
+                    int nWidth = std::min(BLOCK_WIDTH, m_nWidth - x);
+                    int nDX, nDY;
+
+                    bool fChanged = FindVector(x, y, nWidth, nHeight, &nDX, &nDY);
+
+                    // Bit 0 of the first byte flags that XOR data follows
+                    pbVector[0] = static_cast<BYTE>((nDX << 1) | (fChanged ? 1 : 0));
+                    pbVector[1] = static_cast<BYTE>(nDY << 1);
+
+                    if (!fChanged)
+                        continue;
+
+                    // Vector table may be reallocated by the insertion below
+                    size_t uVector = pbVector - m_vbWork.data();
+
+                    for (int i = 0; i < nHeight; i++)
+                    {
+                        const BYTE* pbC = &m_vbCurr[(y + i) * m_nWidth + x];
+                        const BYTE* pbP = &m_vbPrev[(y + i + nDY) * m_nWidth + x + nDX];
+
+                        for (int j = 0; j < nWidth; j++)
+                            m_vbWork.push_back(pbC[j] ^ pbP[j]);
+                    }
+
+                    pbVector = m_vbWork.data() + uVector;
+                }
+            }
+        }
+    }
+
+    Deflate(vOut_, m_vbWork.data(), m_vbWork.size());
+
+    if (pbFrame_)
+        m_vbPrev.swap(m_vbCurr);
+}
+
+#endif // HAVE_LIBZ
@@ -0,0 +1,55 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// ZMBV.h: Zip Motion Blocks Video encoder, for AVI recording
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#ifdef HAVE_LIBZ
+
+#include "zlib.h"
+
+class CZMBVEncoder final
+{
+public:
+    CZMBVEncoder(int nWidth_, int nHeight_, int nLevel_);
+    CZMBVEncoder(const CZMBVEncoder&) = delete;
+    void operator= (const CZMBVEncoder&) = delete;
+    ~CZMBVEncoder();
+
+public:
+    bool IsValid() const { return m_fValid; }
+    void EncodeFrame(std::vector<BYTE>& vOut_, const BYTE* pbFrame_, const BYTE* pbPalette_, bool fKeyFrame_);
+
+protected:
+    bool FindVector(int nX_, int nY_, int nWidth_, int nHeight_, int* pnDX_, int* pnDY_);
+    int CompareBlock(int nX_, int nY_, int nWidth_, int nHeight_, int nDX_, int nDY_, int nLimit_);
+    void Deflate(std::vector<BYTE>& vOut_, const BYTE* pb_, size_t uLen_);
+
+protected:
+    int m_nWidth = 0, m_nHeight = 0;
+    int m_nBlocksX = 0, m_nBlocksY = 0;
+
+    std::vector<BYTE> m_vbPrev, m_vbCurr;   // Previous and current frames
+    std::vector<BYTE> m_vbWork;             // Uncompressed frame data
+
+    z_stream m_zs{};
+    bool m_fValid = false;
+};
+
+#endif // HAVE_LIBZ
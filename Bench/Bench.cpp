@@ -0,0 +1,125 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Bench.cpp: Microbenchmarks for performance-sensitive emulator code
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Built only with -DBUILD_BENCHMARKS=ON, as simcoupe-bench. With no
+//  arguments every benchmark is run, otherwise just those named. Timings
+//  are the fastest of several batches, to reduce noise from other load.
+//
+//  The stream benchmark generates its own images, unless a directory of
+//  real ones is given with --images=<dir>.
+//
+//  Some benchmarks also check their results against a reference, such as
+//  the portable code path or an earlier mode of operation. Any failed check
+//  gives a non-zero exit code, so they can be scripted.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "Options.h"
+
+typedef struct
+{
+    const char* pcszName;
+    const char* pcszDesc;
+    void (*pfnRun)();
+}
+BENCHMARK;
+
+static const BENCHMARK asBenchmarks[] =
+{
+    { "blip",       "Stereo DAC band-limited synthesis",    Bench::BlipDac },
+    { "blit",       "Display line palette conversion",      Bench::Blit },
+    { "frame",      "Debugger frame completion and GUI copy", Bench::FrameLines },
+    { "gif",        "GIF recording LZW compression",        Bench::Gif },
+    { "mixer",      "Sound device mixing",                  Bench::MixFrame },
+    { "resampler",  "Running speed audio resampling",       Bench::Resampler },
+    { "sound",      "Sound frame generation by output rate", Bench::SoundRate },
+    { "soundbatch", "Batched SAA/SID register writes",      Bench::SoundBatch },
+    { "stream",     "Disk image stream opening",            Bench::StreamOpen },
+};
+
+static int nFailed;
+
+namespace Bench
+{
+std::string strImageDir;
+
+void Report(const char* pcszTest_, double dValue_, const char* pcszUnit_/*="us"*/)
+{
+    printf("  %-48s %10.2f %s\n", pcszTest_, dValue_, pcszUnit_);
+}
+
+void Check(const char* pcszTest_, bool fPassed_)
+{
+    printf("  %-48s %10s\n", pcszTest_, fPassed_ ? "ok" : "FAILED");
+
+    if (!fPassed_)
+        nFailed++;
+}
+
+} // namespace Bench
+
+
+int main(int argc_, char* argv_[])
+{
+    static const char IMAGES_OPTION[] = "--images=";
+    std::vector<const char*> vpcszNames;
+
+    Options::SetDefaults();
+
+    for (int i = 1; i < argc_; i++)
+    {
+        if (!strncmp(argv_[i], IMAGES_OPTION, sizeof(IMAGES_OPTION) - 1))
+            Bench::strImageDir = argv_[i] + sizeof(IMAGES_OPTION) - 1;
+        else
+            vpcszNames.push_back(argv_[i]);
+    }
+
+    for (auto& bench : asBenchmarks)
+    {
+        bool fRun = vpcszNames.empty();
+
+        for (auto pcszName : vpcszNames)
+            fRun |= !strcasecmp(pcszName, bench.pcszName);
+
+        if (fRun)
+        {
+            printf("%s: %s\n", bench.pcszName, bench.pcszDesc);
+            bench.pfnRun();
+        }
+    }
+
+    // Unknown names list what's available
+    for (auto pcszName : vpcszNames)
+    {
+        if (std::none_of(std::begin(asBenchmarks), std::end(asBenchmarks),
+            [&](const BENCHMARK& b) { return !strcasecmp(pcszName, b.pcszName); }))
+        {
+            fprintf(stderr, "Unknown benchmark: %s\nAvailable:", pcszName);
+            for (auto& bench : asBenchmarks)
+                fprintf(stderr, " %s", bench.pcszName);
+            fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Bench.h: Microbenchmarks for performance-sensitive emulator code
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <chrono>
+
+namespace Bench
+{
+const int TIMING_BATCHES = 5;   // Batches timed for each result, keeping the fastest
+
+// Time repeated calls to fn_, returning the best average over several batches, in microseconds
+template <typename F>
+double Time(F fn_, int nIterations_)
+{
+    double dBest = 0.0;
+
+    for (int nBatch = 0; nBatch < TIMING_BATCHES; nBatch++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < nIterations_; i++)
+            fn_();
+
+        double dTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nIterations_;
+        if (!nBatch || dTime < dBest)
+            dBest = dTime;
+    }
+
+    return dBest;
+}
+
+void Report(const char* pcszTest_, double dValue_, const char* pcszUnit_ = "us");
+void Check(const char* pcszTest_, bool fPassed_);
+
+extern std::vector<BYTE> vbAudioOut;    // Sound output captured by the Audio stub...
+extern bool fCaptureAudio;              // ...while this is set
+extern std::string strImageDir;         // Images for the stream benchmark, from --images=<dir>
+
+// Individual benchmarks
+void BlipDac();
+void Blit();
+void FrameLines();
+void Gif();
+void MixFrame();
+void Resampler();
+void SoundRate();
+void SoundBatch();
+void StreamOpen();
+}
@@ -0,0 +1,203 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// BlipBench.cpp: Stereo band-limited DAC synthesis benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Models a 4-channel MOD player mixing in software at about 15.6kHz, with
+//  the output written to the DACs in three styles: SAMVox (four ports in
+//  turn), Paula-style (paired nibble writes per channel) and pre-mixed mono
+//  to both sides of the parallel DAC.
+//
+//  Each frame goes through the DAC's Blip_Stereo_Buffer/Synth pair, and the
+//  separate left/right Blip_Buffers with a Blip_Synth per DAC side that it
+//  replaced. The output of the two must be identical.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "BlipBuffer.h"
+#include "SAM.h"
+#include "Sound.h"
+
+namespace Bench
+{
+
+const int MOD_CHANNELS = 4;
+const int MOD_SAMPLE_TSTATES = 384;         // ~15.6kHz mixing rate
+const int BLIP_FREQ = SAMPLE_FREQ_DEFAULT;
+
+enum { MOD_SAMVOX, MOD_PAULA, MOD_MONO };
+
+// Previous DAC synthesis, with separate buffers for each side and a synth for each DAC output
+class CMonoPairDac
+{
+public:
+    CMonoPairDac()
+    {
+        for (auto pbuf : { &m_bufLeft, &m_bufRight })
+        {
+            pbuf->clock_rate(REAL_TSTATES_PER_SECOND);
+            pbuf->set_sample_rate(BLIP_FREQ);
+        }
+
+        m_asynth[0].output(&m_bufLeft);
+        m_asynth[1].output(&m_bufRight);
+        m_asynth[2].output(&m_bufLeft);
+        m_asynth[3].output(&m_bufRight);
+
+        for (auto& synth : m_asynth)
+            synth.volume(1.0);
+    }
+
+    void Output(int nDac_, DWORD dwTime_, BYTE bVal_) { m_asynth[nDac_].update(dwTime_, bVal_); }
+
+    int EndFrame(int16_t* ps_)
+    {
+        m_bufLeft.end_frame(TSTATES_PER_FRAME);
+        m_bufRight.end_frame(TSTATES_PER_FRAME);
+
+        int nSamples = static_cast<int>(m_bufLeft.samples_avail());
+        m_bufLeft.read_samples(ps_, nSamples, 1);
+        m_bufRight.read_samples(ps_ + 1, nSamples, 1);
+        return nSamples;
+    }
+
+protected:
+    Blip_Buffer m_bufLeft{}, m_bufRight{};
+    Blip_Synth<blip_med_quality, 256> m_asynth[4]{};   // Left, right, left2, right2
+};
+
+// Current DAC synthesis, with the combined levels of both DACs given to a single stereo synth
+class CStereoDac
+{
+public:
+    CStereoDac()
+    {
+        m_buf.clock_rate(REAL_TSTATES_PER_SECOND);
+        m_buf.set_sample_rate(BLIP_FREQ);
+        m_synth.output(&m_buf);
+        m_synth.volume(1.0);
+    }
+
+    void Output(int nDac_, DWORD dwTime_, BYTE bVal_)
+    {
+        m_abLevels[nDac_] = bVal_;
+        m_synth.update(dwTime_, m_abLevels[0] + m_abLevels[2], m_abLevels[1] + m_abLevels[3]);
+    }
+
+    int EndFrame(int16_t* ps_)
+    {
+        m_buf.end_frame(TSTATES_PER_FRAME);
+
+        int nSamples = static_cast<int>(m_buf.samples_avail());
+        m_buf.read_samples(ps_, nSamples);
+        return nSamples;
+    }
+
+protected:
+    Blip_Stereo_Buffer m_buf{};
+    Blip_Stereo_Synth<blip_med_quality, 256> m_synth{};
+    BYTE m_abLevels[4]{};
+};
+
+// Mix and output one frame from the MOD channels, returning the samples generated
+template <typename DAC>
+static int ModFrame(DAC& dac_, int nStyle_, int nFrame_, int16_t* ps_)
+{
+    static const DWORD adwSteps[MOD_CHANNELS] = { 0x1234, 0x2345, 0x0f00, 0x3100 };
+    DWORD adwPhase[MOD_CHANNELS];
+
+    for (int c = 0; c < MOD_CHANNELS; c++)
+        adwPhase[c] = adwSteps[c] * nFrame_ * (TSTATES_PER_FRAME / MOD_SAMPLE_TSTATES);
+
+    for (DWORD t = 0; t < TSTATES_PER_FRAME - 400; t += MOD_SAMPLE_TSTATES)
+    {
+        BYTE ab[MOD_CHANNELS];
+        for (int c = 0; c < MOD_CHANNELS; c++)
+        {
+            adwPhase[c] += adwSteps[c] + (nFrame_ & 7);
+            ab[c] = static_cast<BYTE>(0x80 + ((adwPhase[c] >> 10) & 0x3f) - ((adwPhase[c] >> 14) & 0x1f));
+        }
+
+        switch (nStyle_)
+        {
+            case MOD_SAMVOX:
+                for (int c = 0; c < MOD_CHANNELS; c++)
+                    dac_.Output(c, t + c * 24, ab[c]);
+                break;
+
+            case MOD_PAULA:
+                dac_.Output(0, t, ab[0] & 0xf0);
+                dac_.Output(2, t, (ab[0] & 0x0f) << 4);
+                dac_.Output(1, t + 40, ab[1] & 0xf0);
+                dac_.Output(3, t + 40, (ab[1] & 0x0f) << 4);
+                break;
+
+            default:
+            {
+                BYTE bMix = static_cast<BYTE>((ab[0] + ab[1] + ab[2] + ab[3]) / 4);
+                dac_.Output(0, t, bMix);
+                dac_.Output(1, t, bMix);
+                break;
+            }
+        }
+    }
+
+    return dac_.EndFrame(ps_);
+}
+
+void BlipDac()
+{
+    static const struct { int nStyle; const char* pcszName; } asStyles[] =
+    {
+        { MOD_SAMVOX, "SAMVox" },
+        { MOD_PAULA, "Paula" },
+        { MOD_MONO, "mono" },
+    };
+
+    for (auto& style : asStyles)
+    {
+        alignas(SAMPLE_ALIGN) static int16_t asRef[MAX_SAMPLES_PER_FRAME * SAMPLE_CHANNELS], asOut[MAX_SAMPLES_PER_FRAME * SAMPLE_CHANNELS];
+        char sz[64];
+        int nFrame = 0;
+
+        CMonoPairDac refDac;
+        CStereoDac dac;
+
+        // Both must produce the same samples, frame after frame
+        bool fMatch = true;
+        for (int i = 0; i < 50; i++)
+        {
+            int nRef = ModFrame(refDac, style.nStyle, i, asRef);
+            int nOut = ModFrame(dac, style.nStyle, i, asOut);
+            fMatch &= nRef == nOut && !memcmp(asRef, asOut, nOut * SAMPLE_BLOCK);
+        }
+
+        snprintf(sz, sizeof(sz), "%s frame, separate Blip_Buffers", style.pcszName);
+        Report(sz, Time([&] { ModFrame(refDac, style.nStyle, nFrame++, asRef); }, 1000));
+
+        snprintf(sz, sizeof(sz), "%s frame, Blip_Stereo_Buffer", style.pcszName);
+        Report(sz, Time([&] { ModFrame(dac, style.nStyle, nFrame++, asOut); }, 1000));
+
+        snprintf(sz, sizeof(sz), "%s output matches separate buffers", style.pcszName);
+        Check(sz, fMatch);
+    }
+}
+
+} // namespace Bench
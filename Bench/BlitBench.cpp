@@ -0,0 +1,83 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// BlitBench.cpp: Display line palette conversion benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Converts a full frame of random high-resolution lines with the kernels
+//  Blit selects for this CPU (AVX2 where available), and with a plain
+//  per-pixel loop matching the portable scalar code. The outputs must be
+//  identical.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "Blit.h"
+#include "SAMIO.h"
+
+namespace Bench
+{
+
+const int BLIT_WIDTH = WIDTH_PIXELS * 2;    // High resolution pixels per line
+const int BLIT_LINES = HEIGHT_LINES;
+
+static void Line16Reference(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    for (int x = 0; x < nWidth_; x += 2)
+        *pdw_++ = (pdwPalette_[pb_[x + 1]] << 16) | pdwPalette_[pb_[x]];
+}
+
+static void Line32Reference(DWORD* pdw_, const BYTE* pb_, int nWidth_, const DWORD* pdwPalette_)
+{
+    for (int x = 0; x < nWidth_; x++)
+        pdw_[x] = pdwPalette_[pb_[x]];
+}
+
+void Blit()
+{
+    std::vector<BYTE> vbFrame(BLIT_WIDTH * BLIT_LINES);
+    std::vector<DWORD> vdwOut(BLIT_WIDTH * BLIT_LINES), vdwRef(BLIT_WIDTH * BLIT_LINES);
+    DWORD adwPalette32[N_PALETTE_COLOURS], adwPalette16[N_PALETTE_COLOURS];
+
+    for (int i = 0; i < N_PALETTE_COLOURS; i++)
+    {
+        adwPalette32[i] = i * 0x01020304;
+        adwPalette16[i] = (i * 517) & 0xffff;
+    }
+
+    srand(1);
+    for (auto& b : vbFrame)
+        b = static_cast<BYTE>(rand() % N_PALETTE_COLOURS);
+
+    // Convert every line of the frame into the output, as the display update does
+    auto Frame = [&](void (*pfnLine_)(DWORD*, const BYTE*, int, const DWORD*), std::vector<DWORD>& vdw_, const DWORD* pdwPalette_, int nPitch_)
+    {
+        for (int y = 0; y < BLIT_LINES; y++)
+            pfnLine_(vdw_.data() + y * nPitch_, vbFrame.data() + y * BLIT_WIDTH, BLIT_WIDTH, pdwPalette_);
+    };
+
+    Report("32-bit frame, reference", Time([&] { Frame(Line32Reference, vdwRef, adwPalette32, BLIT_WIDTH); }, 100));
+    Report("32-bit frame, Blit::Line32", Time([&] { Frame(Blit::Line32, vdwOut, adwPalette32, BLIT_WIDTH); }, 100));
+    Check("32-bit output matches reference", vdwOut == vdwRef);
+
+    Report("16-bit frame, reference", Time([&] { Frame(Line16Reference, vdwRef, adwPalette16, BLIT_WIDTH / 2); }, 100));
+    Report("16-bit frame, Blit::Line16", Time([&] { Frame(Blit::Line16, vdwOut, adwPalette16, BLIT_WIDTH / 2); }, 100));
+    Check("16-bit output matches reference", vdwOut == vdwRef);
+}
+
+} // namespace Bench
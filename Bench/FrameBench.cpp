@@ -0,0 +1,143 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// FrameBench.cpp: Frame line completion and GUI copy benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Measures the per-frame work Frame::Begin/End do while the debugger is
+//  stepping, using the same CScreen operations:
+//
+//  - completing a frame stopped mid-way, by copying every line the raster
+//    didn't reach from the previous frame, or exchanging them with it.
+//  - refreshing the double-height GUI copy of a static frame with a dialog
+//    drawn over it, copying every line or only the lines that need it.
+//
+//  The copying versions are what Frame.cpp did before lines were exchanged,
+//  and give the same screen contents.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "SAM.h"
+#include "Screen.h"
+
+namespace Bench
+{
+
+const int FRAME_WIDTH = WIDTH_PIXELS * 2;   // High resolution pixels per line
+const int FRAME_LINES = HEIGHT_LINES;
+
+static void Randomise(CScreen& screen_)
+{
+    for (int i = 0; i < screen_.GetHeight(); i++)
+    {
+        BYTE* pb = screen_.GetLine(i);
+        for (int x = 0; x < screen_.GetPitch(); x++)
+            pb[x] = static_cast<BYTE>(rand());
+    }
+}
+
+static bool SameLines(CScreen& screen1_, CScreen& screen2_)
+{
+    for (int i = 0; i < screen1_.GetHeight(); i++)
+    {
+        if (memcmp(screen1_.GetLine(i), screen2_.GetLine(i), screen1_.GetPitch()))
+            return false;
+    }
+
+    return true;
+}
+
+// Complete the lines either side of the raster line from the previous frame
+static void CompleteByCopy(CScreen& screen_, CScreen& last_, int nRasterLine_)
+{
+    for (int i = 0; i < screen_.GetHeight(); i++)
+    {
+        if (i != nRasterLine_)
+            memcpy(screen_.GetLine(i), last_.GetLine(i), screen_.GetPitch());
+    }
+}
+
+static void CompleteBySwap(CScreen& screen_, CScreen& last_, int nRasterLine_)
+{
+    screen_.SwapLines(&last_, 0, nRasterLine_);
+    screen_.SwapLines(&last_, nRasterLine_ + 1, screen_.GetHeight());
+}
+
+// Refresh the double-height GUI copy of the frame, then draw a dialog over it
+static void GuiByCopy(CScreen& gui_, CScreen& screen_)
+{
+    for (int i = 0; i < gui_.GetHeight(); i += 2)
+    {
+        BYTE* pbLine = screen_.GetLine(i >> 1);
+        memcpy(gui_.GetLine(i), pbLine, screen_.GetPitch());
+        memcpy(gui_.GetLine(i + 1), pbLine, screen_.GetPitch());
+    }
+
+    gui_.FillRect(FRAME_WIDTH / 4, gui_.GetHeight() / 3, FRAME_WIDTH / 2, gui_.GetHeight() / 3, BLUE_2);
+}
+
+static void GuiSelective(CScreen& gui_, CScreen& screen_)
+{
+    for (int i = 0; i < gui_.GetHeight(); i += 2)
+    {
+        BYTE* pbLine = screen_.GetLine(i >> 1);
+        BYTE* pbGui0 = gui_.GetLine(i);
+        BYTE* pbGui1 = gui_.GetLine(i + 1);
+        int nWidth = screen_.GetPitch();
+
+        if (gui_.IsLineDrawn(i) || gui_.IsLineDrawn(i + 1) || memcmp(pbGui0, pbLine, nWidth))
+        {
+            memcpy(pbGui0, pbLine, nWidth);
+            memcpy(pbGui1, pbLine, nWidth);
+        }
+    }
+
+    gui_.ResetDrawnLines();
+    gui_.FillRect(FRAME_WIDTH / 4, gui_.GetHeight() / 3, FRAME_WIDTH / 2, gui_.GetHeight() / 3, BLUE_2);
+}
+
+void FrameLines()
+{
+    CScreen screen(FRAME_WIDTH, FRAME_LINES), last(FRAME_WIDTH, FRAME_LINES), check(FRAME_WIDTH, FRAME_LINES);
+    int nRasterLine = FRAME_LINES / 2;
+
+    srand(1);
+    Randomise(screen);
+    Randomise(last);
+
+    // Both methods must leave the same completed frame
+    CompleteByCopy(check, last, -1);
+    memcpy(check.GetLine(nRasterLine), screen.GetLine(nRasterLine), FRAME_WIDTH);
+    CompleteBySwap(screen, last, nRasterLine);
+    Check("Exchanged frame matches copied frame", SameLines(screen, check));
+
+    Report("Mid-frame completion, copy lines", Time([&] { CompleteByCopy(screen, last, nRasterLine); }, 1000));
+    Report("Mid-frame completion, swap lines", Time([&] { CompleteBySwap(screen, last, nRasterLine); }, 1000));
+
+    CScreen gui(FRAME_WIDTH, FRAME_LINES * 2), guiCheck(FRAME_WIDTH, FRAME_LINES * 2);
+    GuiByCopy(guiCheck, screen);
+    GuiSelective(gui, screen);
+    GuiSelective(gui, screen);
+    Check("Selective GUI copy matches full copy", SameLines(gui, guiCheck));
+
+    Report("GUI frame refresh, copy all lines", Time([&] { GuiByCopy(guiCheck, screen); }, 1000));
+    Report("GUI frame refresh, copy changed lines", Time([&] { GuiSelective(gui, screen); }, 1000));
+}
+
+} // namespace Bench
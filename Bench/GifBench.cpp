@@ -0,0 +1,165 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// GifBench.cpp: GIF LZW compression benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Compresses full frames of differing content with the GifCompressor used
+//  for recordings, reporting the throughput in frames per second. Each
+//  result is decoded again with a plain GIF LZW decoder, which must give
+//  back the original pixels.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "GIF.h"
+#include "SAM.h"
+
+namespace Bench
+{
+
+const int GIF_WIDTH = WIDTH_PIXELS;
+const int GIF_LINES = HEIGHT_LINES;
+const WORD GIF_CODE_SIZE = 7;               // 128 colours
+
+// Content like an emulated display: solid areas, a repeating pattern, and detailed noise
+static void FillScreen(BYTE* pb_)
+{
+    DWORD dwRand = 1;
+
+    for (int y = 0; y < GIF_LINES; y++)
+    {
+        for (int x = 0; x < GIF_WIDTH; x++)
+        {
+            dwRand = dwRand * 1103515245 + 12345;
+
+            if (y < GIF_LINES / 3)
+                *pb_++ = static_cast<BYTE>(x / 48);
+            else if (x < GIF_WIDTH / 2)
+                *pb_++ = static_cast<BYTE>(((x / 7) ^ (y / 5)) & 0x7f);
+            else
+                *pb_++ = static_cast<BYTE>((dwRand >> 16) & 0x7f);
+        }
+    }
+}
+
+static void FillNoise(BYTE* pb_)
+{
+    DWORD dwRand = 1;
+
+    for (int i = 0; i < GIF_WIDTH * GIF_LINES; i++)
+    {
+        dwRand = dwRand * 1103515245 + 12345;
+        *pb_++ = static_cast<BYTE>((dwRand >> 16) & 0x7f);
+    }
+}
+
+// Decode GIF image data (code size then data blocks) back to pixels
+static std::vector<BYTE> Decode(const std::vector<BYTE>& vData_)
+{
+    std::vector<BYTE> vCodes, vPixels;
+    WORD awPrefix[4096];
+    BYTE abSuffix[4096], abString[4096];
+
+    // Join the data blocks into a single code stream
+    for (size_t i = 1; i < vData_.size() && vData_[i]; i += vData_[i] + 1)
+        vCodes.insert(vCodes.end(), vData_.begin() + i + 1, vData_.begin() + i + 1 + vData_[i]);
+
+    int nCodeSize = vData_[0], nClear = 1 << nCodeSize, nEnd = nClear + 1;
+    int nBits = nCodeSize + 1, nNext = nEnd + 1, nPrev = -1;
+    size_t uBit = 0;
+
+    while (uBit + nBits <= vCodes.size() * 8)
+    {
+        int nCode = 0;
+        for (int i = 0; i < nBits; i++, uBit++)
+            nCode |= ((vCodes[uBit >> 3] >> (uBit & 7)) & 1) << i;
+
+        if (nCode == nClear)
+        {
+            nBits = nCodeSize + 1;
+            nNext = nEnd + 1;
+            nPrev = -1;
+            continue;
+        }
+        else if (nCode == nEnd || (nCode > nNext) || (nCode == nNext && nPrev < 0))
+            break;
+
+        // Expand the string, which may be the previous string plus its own first pixel
+        int nLen = 0, nFirst;
+        for (int c = (nCode == nNext) ? nPrev : nCode; ; c = awPrefix[c])
+        {
+            if (c < nClear)
+            {
+                abString[nLen++] = nFirst = c;
+                break;
+            }
+
+            abString[nLen++] = abSuffix[c];
+        }
+
+        std::reverse(abString, abString + nLen);
+        if (nCode == nNext)
+            abString[nLen++] = nFirst;
+
+        vPixels.insert(vPixels.end(), abString, abString + nLen);
+
+        if (nPrev >= 0 && nNext < 4096)
+        {
+            awPrefix[nNext] = nPrev;
+            abSuffix[nNext] = nFirst;
+
+            if (++nNext == (1 << nBits) && nBits < 12)
+                nBits++;
+        }
+
+        nPrev = nCode;
+    }
+
+    return vPixels;
+}
+
+void Gif()
+{
+    static GifCompressor gc;
+    std::vector<BYTE> vbFrame(GIF_WIDTH * GIF_LINES), vbOut;
+    vbOut.reserve(vbFrame.size() * 2);
+
+    static const struct { const char* pcszName; void (*pfnFill)(BYTE*); } asContent[] =
+    {
+        { "display", FillScreen },
+        { "noise", FillNoise },
+    };
+
+    for (auto& content : asContent)
+    {
+        char sz[64];
+        content.pfnFill(vbFrame.data());
+
+        auto Compress = [&] { vbOut.clear(); gc.WriteDataBlocks(vbOut, vbFrame.data(), static_cast<DWORD>(vbFrame.size()), GIF_CODE_SIZE); };
+        double dTime = Time(Compress, 50);
+
+        snprintf(sz, sizeof(sz), "%s frame, %d%% of original size", content.pcszName, static_cast<int>(vbOut.size() * 100 / vbFrame.size()));
+        Report(sz, 1000000.0 / dTime, "frames/s");
+
+        snprintf(sz, sizeof(sz), "%s frame decodes to the original", content.pcszName);
+        Check(sz, Decode(vbOut) == vbFrame);
+    }
+}
+
+} // namespace Bench
@@ -0,0 +1,98 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// MixerBench.cpp: Sound device mixing benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Mixes one frame of DAC, SAA and SID output at the highest supported
+//  rate, as Sound::FrameUpdate does. The reference is the byte-wise
+//  saturating add that Sound.cpp used before the Mixer module, applied
+//  once per extra device. At unity gain the outputs must match exactly,
+//  and with other gains each sample must match a simple scaled sum.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "Mixer.h"
+#include "Sound.h"
+
+namespace Bench
+{
+
+const int MIX_SOURCES = 3;
+const int MIX_SAMPLES = MAX_SAMPLES_PER_FRAME * SAMPLE_CHANNELS;
+
+// Previous per-device mixing, adding a source into the destination buffer
+static void MixAudio(BYTE* pDst_, const BYTE* pSrc_, int nLen_)
+{
+    for (nLen_ /= 2; nLen_-- > 0; pSrc_ += 2, pDst_ += 2)
+    {
+        short s1 = (pSrc_[1] << 8) | pSrc_[0];
+        short s2 = (pDst_[1] << 8) | pDst_[0];
+        int samp = s1 + s2;
+
+        samp = std::min(samp, 32767);
+        samp = std::max(-32768, samp);
+
+        pDst_[0] = samp & 0xff;
+        pDst_[1] = samp >> 8;
+    }
+}
+
+void MixFrame()
+{
+    alignas(SAMPLE_ALIGN) static int16_t asSources[MIX_SOURCES][MIX_SAMPLES];
+    alignas(SAMPLE_ALIGN) static int16_t asRef[MIX_SAMPLES], asOut[MIX_SAMPLES];
+    const int16_t* apsSources[MIX_SOURCES] = { asSources[0], asSources[1], asSources[2] };
+    int anUnity[MIX_SOURCES] = { Mixer::UNITY_GAIN, Mixer::UNITY_GAIN, Mixer::UNITY_GAIN };
+    int anGains[MIX_SOURCES] = { 128, 300, 77 };
+
+    // Loud sources, so clipping is exercised
+    srand(1);
+    for (auto& as : asSources)
+    {
+        for (auto& s : as)
+            s = static_cast<int16_t>((rand() & 0xffff) - 0x8000);
+    }
+
+    auto Reference = [&]
+    {
+        memcpy(asRef, asSources[0], sizeof(asRef));
+        for (int i = 1; i < MIX_SOURCES; i++)
+            MixAudio(reinterpret_cast<BYTE*>(asRef), reinterpret_cast<const BYTE*>(asSources[i]), sizeof(asRef));
+    };
+
+    Report("Frame mix, byte-wise reference", Time(Reference, 10000));
+    Report("Frame mix, Mixer::Mix at unity gain", Time([&] { Mixer::Mix(asOut, apsSources, anUnity, MIX_SOURCES, MIX_SAMPLES); }, 10000));
+    Check("Unity gain output matches reference", !memcmp(asOut, asRef, sizeof(asOut)));
+
+    Report("Frame mix, Mixer::Mix with gains", Time([&] { Mixer::Mix(asOut, apsSources, anGains, MIX_SOURCES, MIX_SAMPLES); }, 10000));
+
+    bool fMatch = true;
+    for (int i = 0; i < MIX_SAMPLES; i++)
+    {
+        int nSum = 0;
+        for (int j = 0; j < MIX_SOURCES; j++)
+            nSum += asSources[j][i] * anGains[j];
+
+        fMatch &= asOut[i] == std::min(std::max(nSum >> 8, -32768), 32767);
+    }
+    Check("Gain output matches scaled sum", fMatch);
+}
+
+} // namespace Bench
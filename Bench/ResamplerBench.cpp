@@ -0,0 +1,106 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// ResamplerBench.cpp: Running speed resampler benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Times resampling one frame of stereo audio at the default output rate,
+//  for a range of running speeds. At each speed a 1kHz tone must pass with
+//  unity gain. Above 100% a tone beyond the filter transition band, which
+//  starts just below the new Nyquist frequency, must also be rejected rather
+//  than aliasing back into the audible range.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "Resampler.h"
+#include "Sound.h"
+
+#include <cmath>
+
+namespace Bench
+{
+
+const int RESAMPLE_FRAMES = SAMPLE_FREQ_DEFAULT / EMULATED_FRAMES_PER_SECOND;
+const int RESAMPLE_MAX_OUT = RESAMPLE_FRAMES * 2 + 16;  // 50% speed doubles the output
+const int TONE_FRAMES = 50;                             // One second of tone, of which...
+const int TONE_SETTLE_FRAMES = 5;                       // ...the start is ignored
+
+// Fill frames of a stereo sine tone, continuing from the phase of the previous call
+static void Tone(int16_t* ps_, double dFreq_, double& rdPhase_)
+{
+    const double PI = 3.14159265358979323846;
+
+    for (int i = 0; i < RESAMPLE_FRAMES; i++, rdPhase_ += 2 * PI * dFreq_ / SAMPLE_FREQ_DEFAULT)
+        ps_[i * 2] = ps_[i * 2 + 1] = static_cast<int16_t>(16000 * std::sin(rdPhase_));
+}
+
+// Gain in dB of a resampled tone, relative to its input level
+static double ToneGain(CResampler& resampler_, double dFreq_)
+{
+    int16_t asIn[RESAMPLE_FRAMES * 2], asOut[RESAMPLE_MAX_OUT * 2];
+    double dPhase = 0.0, dSumSq = 0.0;
+    int nCount = 0;
+
+    resampler_.Reset();
+
+    for (int i = 0; i < TONE_FRAMES; i++)
+    {
+        Tone(asIn, dFreq_, dPhase);
+        int nOut = resampler_.Process(asIn, RESAMPLE_FRAMES, asOut, RESAMPLE_MAX_OUT);
+
+        for (int j = 0; i >= TONE_SETTLE_FRAMES && j < nOut; j++, nCount++)
+            dSumSq += static_cast<double>(asOut[j * 2]) * asOut[j * 2];
+    }
+
+    double dRms = std::sqrt(dSumSq / std::max(nCount, 1));
+    return 20.0 * std::log10(std::max(dRms, 1e-3) / (16000 / std::sqrt(2.0)));
+}
+
+void Resampler()
+{
+    static const int anSpeeds[] = { 50, 150, 200, 500, 1000 };
+    int16_t asIn[RESAMPLE_FRAMES * 2], asOut[RESAMPLE_MAX_OUT * 2];
+    double dPhase = 0.0;
+
+    Tone(asIn, 1000.0, dPhase);
+
+    for (auto nSpeed : anSpeeds)
+    {
+        CResampler resampler(SAMPLE_CHANNELS);
+        resampler.SetRatio(nSpeed);
+        char sz[64];
+
+        snprintf(sz, sizeof(sz), "%d%% speed, frame of %d samples", nSpeed, RESAMPLE_FRAMES);
+        Report(sz, Time([&] { resampler.Process(asIn, RESAMPLE_FRAMES, asOut, RESAMPLE_MAX_OUT); }, 1000));
+
+        snprintf(sz, sizeof(sz), "%d%% speed, 1kHz tone within 0.1dB", nSpeed);
+        Check(sz, std::fabs(ToneGain(resampler, 1000.0)) < 0.1);
+
+        if (nSpeed > 100)
+        {
+            // A tone 30% past the output Nyquist frequency (as seen at the input rate), beyond the transition band
+            double dFreq = SAMPLE_FREQ_DEFAULT / 2 * 1.3 * 100 / nSpeed;
+
+            snprintf(sz, sizeof(sz), "%d%% speed, %.0fHz tone rejected by 70dB", nSpeed, dFreq);
+            Check(sz, ToneGain(resampler, dFreq) < -70.0);
+        }
+    }
+}
+
+} // namespace Bench
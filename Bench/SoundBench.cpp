@@ -0,0 +1,265 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// SoundBench.cpp: Sound frame generation benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Runs whole sound frames through Sound::FrameUpdate, with the output
+//  captured from the Audio::AddData stub rather than played.
+//
+//  The busy frame has all six SAA tone channels running at mixed octaves,
+//  with noise on one, and DAC output toggling throughout the frame. It's
+//  timed at 44.1kHz and 48kHz with both SAA engines. A single SAA tone is
+//  also captured at each rate, and its pitch must not depend on the rate
+//  beyond the rounding of the band-limited engine's resampling ratio.
+//
+//  The batch test plays tracker-style frames of SAA and SID writes with
+//  the sample-based SAA engine, synthesising before each write or from the
+//  frame-end log. The mean time spent in the emulation loop, where writes
+//  land, is shown separately from the frame end. Captured output from the
+//  two modes must be identical.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "CPU.h"
+#include "Options.h"
+#include "SAM.h"
+#include "SAMIO.h"
+#include "SID.h"
+#include "Sound.h"
+
+#include <chrono>
+#include <cmath>
+
+namespace Bench
+{
+
+const int DAC_WRITES_PER_FRAME = 40;
+const int TRACKER_FRAMES = 500;
+const double PITCH_TOLERANCE = 0.0015;  // Blip_Buffer rounds its rate ratio to 16 bits, ~0.06% at these rates
+
+static void SaaWrite(BYTE bReg_, BYTE bVal_)
+{
+    pSAA->Out(SOUND_ADDR, bReg_);
+    pSAA->Out(SOUND_DATA, bVal_);
+}
+
+// All six tones at mixed octaves, plus noise on one channel
+static void SaaBusy()
+{
+    for (BYTE c = 0; c < 6; c++)
+    {
+        SaaWrite(c, 0x77);
+        SaaWrite(8 + c, 40 * c + 20);
+    }
+
+    SaaWrite(16, 0x31); SaaWrite(17, 0x42); SaaWrite(18, 0x53);
+    SaaWrite(20, 0x3f); SaaWrite(21, 0x04); SaaWrite(28, 0x01);
+}
+
+// A single pure tone on channel 0
+static void SaaTone()
+{
+    SaaWrite(28, 0x00);
+    for (BYTE c = 0; c < 6; c++)
+        SaaWrite(c, 0x00);
+
+    SaaWrite(21, 0x00); SaaWrite(20, 0x01);
+    SaaWrite(0, 0xff); SaaWrite(8, 0x00); SaaWrite(16, 0x04);
+    SaaWrite(28, 0x01);
+}
+
+static void SaaOff()
+{
+    SaaWrite(28, 0x00);
+}
+
+// Run a frame, with optional DAC writes spread across it
+static void SoundFrame(bool fDac_)
+{
+    for (int i = 0; fDac_ && i < DAC_WRITES_PER_FRAME; i++)
+    {
+        g_dwCycleCounter = i * (TSTATES_PER_FRAME / DAC_WRITES_PER_FRAME);
+        pDAC->Output((i & 1) ? 0xa0 : 0x60);
+    }
+
+    Sound::FrameUpdate();
+}
+
+// Open sound at the given rate and engine, with new devices settled into it
+static void SoundInit(int nSampleFreq_, bool fSaaBlip_, bool fBatch_ = true)
+{
+    SetOption(samplerate, nSampleFreq_);
+    SetOption(saablip, fSaaBlip_);
+    SetOption(soundbatch, fBatch_);
+    SetOption(speed, 100);
+
+    delete pDAC; pDAC = new CDAC;
+    delete pSAA; pSAA = new CSAA;
+    delete pSID; pSID = new CSID;
+
+    Sound::Init();
+
+    g_dwCycleCounter = 0;
+    pDAC->Output(0x80);
+
+    for (int i = 0; i < 2; i++)
+        Sound::FrameUpdate();
+}
+
+// Frequency of the left channel of captured audio, from its rising mean crossings
+static double CapturedPitch(int nSampleFreq_)
+{
+    auto ps = reinterpret_cast<const int16_t*>(vbAudioOut.data());
+    int nFrames = static_cast<int>(vbAudioOut.size() / SAMPLE_BLOCK);
+    double dMean = 0.0;
+
+    for (int i = 0; i < nFrames; i++)
+        dMean += ps[i * SAMPLE_CHANNELS];
+    dMean /= std::max(nFrames, 1);
+
+    int nCrossings = 0, nFirst = -1, nLast = 0;
+    for (int i = 1; i < nFrames; i++)
+    {
+        if (ps[(i - 1) * SAMPLE_CHANNELS] < dMean && ps[i * SAMPLE_CHANNELS] >= dMean)
+        {
+            if (nFirst < 0)
+                nFirst = i;
+
+            nLast = i;
+            nCrossings++;
+        }
+    }
+
+    return (nCrossings > 1) ? (nCrossings - 1) * static_cast<double>(nSampleFreq_) / (nLast - nFirst) : 0.0;
+}
+
+void SoundRate()
+{
+    for (bool fBlip : { false, true })
+    {
+        double adPitch[2]{};
+        int i = 0;
+
+        for (int nFreq : { 44100, 48000 })
+        {
+            char sz[64];
+            SoundInit(nFreq, fBlip);
+
+            SaaBusy();
+            snprintf(sz, sizeof(sz), "%s SAA, %dHz, busy frame", fBlip ? "Blip" : "Sample", nFreq);
+            Report(sz, Time([] { SoundFrame(true); }, 200));
+
+            SaaTone();
+            for (int j = 0; j < 10; j++)
+                SoundFrame(false);
+
+            vbAudioOut.clear();
+            fCaptureAudio = true;
+            for (int j = 0; j < 250; j++)
+                SoundFrame(false);
+            fCaptureAudio = false;
+
+            adPitch[i++] = CapturedPitch(nFreq);
+            SaaOff();
+            Sound::Exit();
+        }
+
+        char sz[64];
+        snprintf(sz, sizeof(sz), "%s SAA, %.1fHz tone same pitch at both rates", fBlip ? "Blip" : "Sample", adPitch[0]);
+        Check(sz, adPitch[0] > 0.0 && std::fabs(adPitch[1] / adPitch[0] - 1.0) < PITCH_TOLERANCE);
+    }
+}
+
+// A tracker-style frame: SAA and SID writes spread across it, with memory-touching work standing in for the CPU
+static void TrackerFrame(int nWrites_, DWORD& rdwRand_, std::vector<BYTE>& vbMem_, double& rdEmulate_, double& rdFrameEnd_)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < nWrites_; i++)
+    {
+        g_dwCycleCounter = i * (TSTATES_PER_FRAME / nWrites_);
+
+        for (int j = 0; j < 16; j++)
+            vbMem_[(rdwRand_ + j * 4099) & (vbMem_.size() - 1)] += static_cast<BYTE>(j);
+
+        rdwRand_ = rdwRand_ * 1103515245 + 12345;
+        BYTE bReg = static_cast<BYTE>((rdwRand_ >> 16) % 22), bVal = static_cast<BYTE>(rdwRand_ >> 24);
+
+        SaaWrite(bReg, bVal);
+
+        if (!(i & 3))
+            pSID->Out((bReg << 8) | SID_PORT, bVal);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    Sound::FrameUpdate();
+
+    rdEmulate_ += std::chrono::duration<double, std::micro>(end - start).count();
+    rdFrameEnd_ += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - end).count();
+}
+
+void SoundBatch()
+{
+    static const int anWrites[] = { 100, 3000 };
+    std::vector<BYTE> vbMem(0x10000);
+
+    for (auto nWrites : anWrites)
+    {
+        std::vector<BYTE> avbOutput[2];
+
+        for (bool fBatch : { false, true })
+        {
+            char sz[64];
+            DWORD dwRand = 1;
+            double dEmulate = 0.0, dFrameEnd = 0.0;
+
+            SoundInit(SAMPLE_FREQ_DEFAULT, false, fBatch);
+            SaaWrite(28, 0x01);
+
+            // Both modes must give identical output from the same writes
+            vbAudioOut.clear();
+            fCaptureAudio = true;
+            for (int i = 0; i < 50; i++)
+                TrackerFrame(nWrites, dwRand, vbMem, dEmulate, dFrameEnd);
+            fCaptureAudio = false;
+            avbOutput[fBatch] = vbAudioOut;
+
+            // Mean times, as the two parts can't be timed separately as best batches
+            dEmulate = dFrameEnd = 0.0;
+            for (int i = 0; i < TRACKER_FRAMES; i++)
+                TrackerFrame(nWrites, dwRand, vbMem, dEmulate, dFrameEnd);
+
+            snprintf(sz, sizeof(sz), "%d writes/frame, %s, emulation", nWrites, fBatch ? "batch" : "immediate");
+            Report(sz, dEmulate / TRACKER_FRAMES);
+
+            snprintf(sz, sizeof(sz), "%d writes/frame, %s, frame end", nWrites, fBatch ? "batch" : "immediate");
+            Report(sz, dFrameEnd / TRACKER_FRAMES);
+
+            SaaOff();
+            Sound::Exit();
+        }
+
+        char sz[64];
+        snprintf(sz, sizeof(sz), "%d writes/frame, batch output identical", nWrites);
+        Check(sz, !avbOutput[0].empty() && avbOutput[0] == avbOutput[1]);
+    }
+}
+
+} // namespace Bench
@@ -0,0 +1,382 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// StreamBench.cpp: Disk image stream opening benchmark
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  Opens a directory of mixed images as the file browser does, timing the
+//  stream open and format identification alone, then a full CDisk::Open.
+//  Results are the mean per image, grouped by format and container.
+//
+//  The images come from --images=<dir> if given, otherwise MGT, SAD and
+//  EDSK images are generated in the temporary directory, each raw, gzipped
+//  and zipped, alongside a text file that should be rejected. Generated
+//  images must be identified correctly and read back unchanged.
+
+#include "SimCoupe.h"
+#include "Bench.h"
+
+#include "Disk.h"
+
+#include <map>
+
+namespace Bench
+{
+
+const int IDENTIFY_ITERATIONS = 200;    // Spread across the images in each group
+const int DISK_OPEN_ITERATIONS = 20;
+
+typedef struct
+{
+    std::string strPath;
+    int nType;
+    std::vector<BYTE> vbData;   // Expected contents, for generated images only
+}
+IMAGE;
+
+static const char* TypeName(int nType_)
+{
+    switch (nType_)
+    {
+        case dtEDSK:    return "EDSK";
+        case dtSAD:     return "SAD";
+        case dtMGT:     return "MGT";
+        case dtSBT:     return "SBT";
+        case dtUnknown: return "Unknown";
+        default:        return "Other";
+    }
+}
+
+// Container type, from the file signature
+static const char* ContainerName(const std::string& strPath_)
+{
+    BYTE ab[4]{};
+
+    if (FILE* hf = fopen(strPath_.c_str(), "rb"))
+    {
+        if (fread(ab, 1, sizeof(ab), hf) != sizeof(ab))
+            ab[0] = 0;
+        fclose(hf);
+    }
+
+    if (ab[0] == 'P' && ab[1] == 'K' && ab[2] == 0x03 && ab[3] == 0x04)
+        return "zip";
+    else if (ab[0] == 0x1f && ab[1] == 0x8b)
+        return "gzip";
+
+    return "raw";
+}
+
+static int IdentifyStream(const char* pcszPath_)
+{
+    CStream* pStream = CStream::Open(pcszPath_, true);
+    int nType = pStream ? CDisk::GetType(pStream) : dtNone;
+    delete pStream;
+    return nType;
+}
+
+// Read the full contents of a stream, as the disk classes would
+static std::vector<BYTE> ReadStream(const char* pcszPath_)
+{
+    std::vector<BYTE> vb;
+    BYTE ab[16384];
+
+    if (CStream* pStream = CStream::Open(pcszPath_, true))
+    {
+        for (size_t uRead; (uRead = pStream->Read(ab, sizeof(ab))) > 0; )
+            vb.insert(vb.end(), ab, ab + uRead);
+
+        delete pStream;
+    }
+
+    return vb;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sector data for a part-used disk: a quarter random, the rest freshly formatted
+static std::vector<BYTE> DiskData(size_t uSize_)
+{
+    std::vector<BYTE> vb(uSize_);
+    DWORD dwRand = 1;
+
+    for (size_t i = 0; i < uSize_ / 4; i++)
+    {
+        dwRand = dwRand * 1103515245 + 12345;
+        vb[i] = static_cast<BYTE>(dwRand >> 16);
+    }
+
+    return vb;
+}
+
+static std::vector<BYTE> MgtImage()
+{
+    return DiskData(MGT_IMAGE_SIZE);
+}
+
+static std::vector<BYTE> SadImage()
+{
+    SAD_HEADER sh{};
+    memcpy(sh.abSignature, SAD_SIGNATURE, sizeof(sh.abSignature));
+    sh.bSides = NORMAL_DISK_SIDES;
+    sh.bTracks = NORMAL_DISK_TRACKS;
+    sh.bSectors = NORMAL_DISK_SECTORS;
+    sh.bSectorSizeDiv64 = NORMAL_SECTOR_SIZE >> 6;
+
+    auto vb = DiskData(MGT_IMAGE_SIZE);
+    vb.insert(vb.begin(), reinterpret_cast<BYTE*>(&sh), reinterpret_cast<BYTE*>(&sh + 1));
+    return vb;
+}
+
+static std::vector<BYTE> EdskImage()
+{
+    const UINT uTrackSize = 256 + NORMAL_DISK_SECTORS * NORMAL_SECTOR_SIZE;
+    auto vbData = DiskData(MGT_IMAGE_SIZE);
+    std::vector<BYTE> vb(256);
+
+    auto peh = reinterpret_cast<EDSK_HEADER*>(vb.data());
+    memcpy(peh->szSignature, EDSK_SIGNATURE, sizeof(peh->szSignature));
+    memcpy(peh->szCreator, "SimCoupe", 8);
+    peh->bTracks = NORMAL_DISK_TRACKS;
+    peh->bSides = NORMAL_DISK_SIDES;
+
+    BYTE* pbSizes = reinterpret_cast<BYTE*>(peh + 1);
+    for (UINT i = 0; i < NORMAL_DISK_TRACKS * NORMAL_DISK_SIDES; i++)
+        pbSizes[i] = uTrackSize >> 8;
+
+    for (BYTE cyl = 0; cyl < NORMAL_DISK_TRACKS; cyl++)
+    {
+        for (BYTE head = 0; head < NORMAL_DISK_SIDES; head++)
+        {
+            BYTE abTrack[256]{};
+            auto pt = reinterpret_cast<EDSK_TRACK*>(abTrack);
+            auto ps = reinterpret_cast<EDSK_SECTOR*>(pt + 1);
+
+            memcpy(pt->szSignature, EDSK_TRACK_SIGNATURE, sizeof(EDSK_TRACK_SIGNATURE) - 1);
+            pt->bTrack = cyl;
+            pt->bSide = head;
+            pt->bSize = 2;
+            pt->bSectors = NORMAL_DISK_SECTORS;
+            pt->bGap3 = 0x4e;
+            pt->bFill = 0xe5;
+
+            for (BYTE i = 0; i < NORMAL_DISK_SECTORS; i++, ps++)
+            {
+                ps->bTrack = cyl;
+                ps->bSide = head;
+                ps->bSector = i + 1;
+                ps->bSize = 2;
+                ps->bDatalow = NORMAL_SECTOR_SIZE & 0xff;
+                ps->bDatahigh = NORMAL_SECTOR_SIZE >> 8;
+            }
+
+            auto it = vbData.begin() + (cyl * NORMAL_DISK_SIDES + head) * (uTrackSize - 256);
+            vb.insert(vb.end(), abTrack, abTrack + sizeof(abTrack));
+            vb.insert(vb.end(), it, it + (uTrackSize - 256));
+        }
+    }
+
+    return vb;
+}
+
+static void WriteRaw(const std::string& strPath_, const std::vector<BYTE>& vb_)
+{
+    if (FILE* hf = fopen(strPath_.c_str(), "wb"))
+    {
+        fwrite(vb_.data(), 1, vb_.size(), hf);
+        fclose(hf);
+    }
+}
+
+#ifdef HAVE_LIBZ
+
+static void WriteGzip(const std::string& strPath_, const std::vector<BYTE>& vb_)
+{
+    if (gzFile hf = gzopen(strPath_.c_str(), "wb"))
+    {
+        gzwrite(hf, vb_.data(), static_cast<unsigned>(vb_.size()));
+        gzclose(hf);
+    }
+}
+
+static void Put16(std::vector<BYTE>& vb_, UINT u_)
+{
+    vb_.push_back(u_ & 0xff);
+    vb_.push_back((u_ >> 8) & 0xff);
+}
+
+static void Put32(std::vector<BYTE>& vb_, DWORD dw_)
+{
+    Put16(vb_, dw_ & 0xffff);
+    Put16(vb_, dw_ >> 16);
+}
+
+// Single deflated file in a zip archive
+static void WriteZip(const std::string& strPath_, const char* pcszName_, const std::vector<BYTE>& vb_)
+{
+    uLongf uLen = compressBound(static_cast<uLong>(vb_.size()));
+    std::vector<BYTE> vbZlib(uLen), vb;
+    if (compress2(vbZlib.data(), &uLen, vb_.data(), static_cast<uLong>(vb_.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+        return;
+
+    // Zip uses raw deflate data, without the zlib header and Adler-32 trailer
+    DWORD dwCrc = crc32(0, vb_.data(), static_cast<uInt>(vb_.size()));
+    DWORD dwPacked = static_cast<DWORD>(uLen - 6), dwSize = static_cast<DWORD>(vb_.size());
+    UINT uName = static_cast<UINT>(strlen(pcszName_));
+
+    auto Entry = [&](DWORD dwSig_, bool fCentral_)
+    {
+        Put32(vb, dwSig_);
+        if (fCentral_) Put16(vb, 20);   // Version made by
+        Put16(vb, 20); Put16(vb, 0); Put16(vb, Z_DEFLATED);
+        Put16(vb, 0); Put16(vb, 0x21);  // 1980-01-01 00:00
+        Put32(vb, dwCrc); Put32(vb, dwPacked); Put32(vb, dwSize);
+        Put16(vb, uName); Put16(vb, 0);
+        if (fCentral_)
+        {
+            Put16(vb, 0); Put16(vb, 0); Put16(vb, 0);
+            Put32(vb, 0); Put32(vb, 0); // Attributes, local header offset
+        }
+        vb.insert(vb.end(), pcszName_, pcszName_ + uName);
+    };
+
+    Entry(0x04034b50, false);
+    vb.insert(vb.end(), vbZlib.begin() + 2, vbZlib.begin() + 2 + dwPacked);
+
+    DWORD dwCentral = static_cast<DWORD>(vb.size());
+    Entry(0x02014b50, true);
+    DWORD dwCentralSize = static_cast<DWORD>(vb.size()) - dwCentral;
+
+    Put32(vb, 0x06054b50);
+    Put16(vb, 0); Put16(vb, 0); Put16(vb, 1); Put16(vb, 1);
+    Put32(vb, dwCentralSize); Put32(vb, dwCentral); Put16(vb, 0);
+
+    WriteRaw(strPath_, vb);
+}
+
+#endif  // HAVE_LIBZ
+
+// Generate a mixed set of images, returning them with their expected types and contents
+static std::vector<IMAGE> GenerateImages(const fs::path& dir_)
+{
+    static const struct { const char* pcszName; int nType; std::vector<BYTE> (*pfnImage)(); } asFormats[] =
+    {
+        { "disk.mgt", dtMGT, MgtImage },
+        { "disk.sad", dtSAD, SadImage },
+        { "disk.dsk", dtEDSK, EdskImage },
+    };
+
+    std::vector<IMAGE> vImages;
+    fs::create_directories(dir_);
+
+    for (auto& format : asFormats)
+    {
+        auto vb = format.pfnImage();
+        auto strPath = (dir_ / format.pcszName).string();
+
+        WriteRaw(strPath, vb);
+        vImages.push_back({ strPath, format.nType, vb });
+#ifdef HAVE_LIBZ
+        WriteGzip(strPath + ".gz", vb);
+        vImages.push_back({ strPath + ".gz", format.nType, vb });
+
+        WriteZip(strPath + ".zip", format.pcszName, vb);
+        vImages.push_back({ strPath + ".zip", format.nType, vb });
+#endif
+    }
+
+    std::string str;
+    for (int i = 0; i < 100; i++)
+        str += "Not a disk image, but found in the same directory.\n";
+
+    std::vector<BYTE> vbText(str.begin(), str.end());
+    WriteRaw((dir_ / "notes.txt").string(), vbText);
+    vImages.push_back({ (dir_ / "notes.txt").string(), dtUnknown, vbText });
+
+    return vImages;
+}
+
+void StreamOpen()
+{
+    std::vector<IMAGE> vImages;
+    fs::path tempDir;
+
+    if (!strImageDir.empty())
+    {
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(strImageDir, ec))
+        {
+            if (entry.is_regular_file())
+                vImages.push_back({ entry.path().string(), IdentifyStream(entry.path().string().c_str()), {} });
+        }
+
+        if (vImages.empty())
+        {
+            Check("Image directory contains files", false);
+            return;
+        }
+    }
+    else
+    {
+        tempDir = fs::temp_directory_path() / "simcoupe-bench-images";
+        vImages = GenerateImages(tempDir);
+
+        for (auto& image : vImages)
+        {
+            char sz[64];
+            auto strFile = fs::path(image.strPath).filename().string();
+
+            snprintf(sz, sizeof(sz), "%s identified as %s", strFile.c_str(), TypeName(image.nType));
+            Check(sz, IdentifyStream(image.strPath.c_str()) == image.nType);
+
+            if (image.nType != dtUnknown)
+            {
+                snprintf(sz, sizeof(sz), "%s reads back unchanged", strFile.c_str());
+                Check(sz, ReadStream(image.strPath.c_str()) == image.vbData);
+            }
+        }
+    }
+
+    // Group the images by format and container
+    std::map<std::string, std::vector<std::string>> mGroups;
+    for (auto& image : vImages)
+        mGroups[std::string(TypeName(image.nType)) + " " + ContainerName(image.strPath)].push_back(image.strPath);
+
+    for (auto& group : mGroups)
+    {
+        auto& vPaths = group.second;
+        int nImages = static_cast<int>(vPaths.size());
+        char sz[64];
+
+        auto Identify = [&] { for (auto& strPath : vPaths) IdentifyStream(strPath.c_str()); };
+        snprintf(sz, sizeof(sz), "%s (%d), open and identify", group.first.c_str(), nImages);
+        Report(sz, Time(Identify, std::max(IDENTIFY_ITERATIONS / nImages, 1)) / nImages);
+
+        auto DiskOpen = [&] { for (auto& strPath : vPaths) delete CDisk::Open(strPath.c_str(), true); };
+        snprintf(sz, sizeof(sz), "%s (%d), CDisk::Open", group.first.c_str(), nImages);
+        Report(sz, Time(DiskOpen, std::max(DISK_OPEN_ITERATIONS / nImages, 1)) / nImages);
+    }
+
+    if (!tempDir.empty())
+    {
+        std::error_code ec;
+        fs::remove_all(tempDir, ec);
+    }
+}
+
+} // namespace Bench
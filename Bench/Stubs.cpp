@@ -0,0 +1,128 @@
+// Part of SimCoupe - A SAM Coupe emulator
+//
+// Stubs.cpp: Emulator services used by the benchmarked modules
+//
+//  Copyright (c) 1999-2015 Simon Owen
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+// Notes:
+//  The benchmarks link only the modules they measure, so anything those
+//  need from the rest of the emulator is supplied here. Output files are
+//  written to the system temporary directory.
+
+#include "SimCoupe.h"
+
+#include "Audio.h"
+#include "AVI.h"
+#include "Bench.h"
+#include "Frame.h"
+#include "Main.h"
+#include "Pipe.h"
+#include "SAMIO.h"
+#include "SID.h"
+#include "Sound.h"
+#include "UI.h"
+#include "WAV.h"
+
+#include <chrono>
+
+DWORD g_dwCycleCounter;
+int g_nAutoLoad;
+bool g_fReset, g_fBreak, g_fPaused;
+
+CDAC* pDAC;
+CSAA* pSAA;
+CSID* pSID;
+
+namespace Bench
+{
+std::vector<BYTE> vbAudioOut;
+bool fCaptureAudio;
+}
+
+namespace Main
+{
+void Exit() { }
+}
+
+void Frame::SetStatus(const char* pcszFormat_, ...)
+{
+    va_list args;
+    va_start(args, pcszFormat_);
+    vfprintf(stderr, pcszFormat_, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+}
+
+const COLOUR* IO::GetPalette()
+{
+    static COLOUR asPalette[N_PALETTE_COLOURS];
+    return asPalette;
+}
+
+void UI::ShowMessage(eMsgType /*eType_*/, const char* pszMessage_)
+{
+    fprintf(stderr, "%s\n", pszMessage_);
+}
+
+DWORD OSD::GetTime()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+const char* OSD::MakeFilePath(int /*nDir_*/, const char* pcszFile_/*=""*/)
+{
+    static std::string strPath;
+    strPath = (fs::temp_directory_path() / pcszFile_).string();
+
+    // Directories need a trailing separator
+    if (!*pcszFile_ && strPath.back() != PATH_SEPARATOR)
+        strPath += PATH_SEPARATOR;
+
+    return strPath.c_str();
+}
+
+void OSD::DebugTrace(const char* pcsz_)
+{
+    fputs(pcsz_, stderr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sound output is captured rather than played, at whatever rate is requested
+bool Audio::Init(bool /*fFirstInit_*/) { return true; }
+void Audio::Exit(bool /*fReInit_*/) { }
+void Audio::Silence() { }
+int Audio::GetSampleFreq() { return 0; }
+bool Audio::GetStats(AUDIO_STATS& /*stats_*/) { return false; }
+
+bool Audio::AddData(Uint8* pbData_, int nLength_)
+{
+    if (Bench::fCaptureAudio)
+        Bench::vbAudioOut.insert(Bench::vbAudioOut.end(), pbData_, pbData_ + nLength_);
+
+    return true;
+}
+
+// Recordings are never started
+void WAV::Stop() { }
+void WAV::AddFrame(const BYTE* /*pb_*/, int /*nLen_*/) { }
+void AVI::Stop() { }
+void AVI::AddFrame(const BYTE* /*pbAudio_*/, UINT /*uLen_*/) { }
+void Pipe::Stop() { }
+void Pipe::AddFrame(const BYTE* /*pb_*/, int /*nLen_*/) { }
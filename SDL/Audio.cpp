@@ -29,12 +29,59 @@
 #include "Util.h"
 #include "UI.h"
 
-#define SAMPLE_BUFFER_SIZE  2048
-
-static Uint8* m_pbStart, * m_pbEnd, * m_pbNow;
-static int m_nSampleBufferSize;
-static Uint32 uLastTime;
-
+// Notes:
+//  Sample data is passed to the SDL audio thread through a single-producer
+//  single-consumer ring buffer, so neither side takes a lock. The read and
+//  write positions are running byte totals, with only the producer storing
+//  uWritePos and only the callback storing uReadPos. The ring storage is a
+//  power of two, so masking the totals stays correct as they wrap at 2^32. Silence() can't move
+//  the read position itself, so it asks the callback to discard up to the
+//  write position it saw.
+//
+//  The ring fill level is the master clock. Each frame sleeps until it's
+//  due rather than polling, using the host clock for smooth frame timing
+//  within the frame, but the frame length is corrected from the smoothed
+//  fill level so emulation follows the audio device's clock over time.
+//  The instantaneous fill can't be used directly, as it drops in whole
+//  device buffers at each callback. To settle the buffered audio on the
+//  latency target the samples are also resampled by up to +/-0.5% based
+//  on the same fill level. That change in pitch is inaudible, and it
+//  replaces the old 1ms timing tweaks.
+//
+//  Statistics on the fill level, device callbacks and pacing are gathered
+//  per reporting period, for the profile display and AudioLog file.
+
+#define SAMPLE_BUFFER_SIZE  1024        // Device buffer size, in samples
+
+const double MAX_RATE_ADJUST = 0.005;   // Maximum dynamic rate adjustment (0.5%)
+const double FILL_SMOOTHING = 1.0 / 16; // Weight of each new fill level in the running average
+const double PACE_CORRECTION = 1.0 / 50;// Proportion of the fill error corrected by each frame's length
+
+static Uint8* pbRing;
+static Uint32 uRingSize, uRingMask;    // Usable ring size, and mask for the power-of-2 storage
+static std::atomic<Uint32> uReadPos, uWritePos;
+static std::atomic<Uint32> uFlushPos;
+static std::atomic<bool> fFlush;
+static std::atomic<int> nUnderruns, nOverruns;
+static int nSampleFreq;                 // Rate the device was opened at
+
+static int nTargetFill;                 // Target buffered audio, in bytes
+static double dAverageFill;             // Smoothed fill level, in bytes
+static double dResamplePos;             // Resampler position relative to asLast
+static Sint16 asLast[SAMPLE_CHANNELS];  // Final sample of the previous block
+static std::vector<Uint8> vbResampled;
+static std::chrono::steady_clock::time_point tNextFrame;
+
+// Statistics for the current reporting period
+static std::chrono::steady_clock::time_point tStatsStart;
+static int nFillMin, nFillMax, nFillCount;      // Buffered bytes seen when adding data
+static double dFillTotal;
+static int nLastUnderruns, nLastOverruns;       // Totals at the start of the period
+static double dSleepTime, dAudioTime;           // Seconds spent sleeping, and of audio generated
+static std::atomic<int> nCallbacks, nMaxJitter; // Callbacks, and largest interval error in us
+static std::chrono::steady_clock::time_point tLastCallback;  // callback only
+
+static void ResetStats();
 static bool InitSDLSound();
 static void ExitSDLSound();
 static void SoundCallback(void* pvParam_, Uint8* pbStream_, int nLen_);
@@ -55,13 +102,36 @@ bool Audio::Init(bool fFirstInit_/*=false*/)
         TRACE("Sound initialisation failed\n");
     else
     {
-        int nSamplesPerFrame = (SAMPLE_FREQ / EMULATED_FRAMES_PER_SECOND) + 1;
-        int nBufferedFrames = (SAMPLE_BUFFER_SIZE / nSamplesPerFrame) + 1 + GetOption(latency);
+        int nSamplesPerFrame = (nSampleFreq / EMULATED_FRAMES_PER_SECOND) + 1;
+
+        // Aim for the latency setting in frames on top of an average device buffer, which
+        // drains in blocks of SAMPLE_BUFFER_SIZE. The ring has room for overshoot above that.
+        nTargetFill = (SAMPLE_BUFFER_SIZE * 3 / 2 + nSamplesPerFrame * GetOption(latency)) * SAMPLE_BLOCK;
+        dAverageFill = nTargetFill;
+
+        uRingSize = nTargetFill * 2 + (SAMPLE_BUFFER_SIZE + nSamplesPerFrame * 2) * SAMPLE_BLOCK;
 
-        m_nSampleBufferSize = nSamplesPerFrame * SAMPLE_BLOCK * nBufferedFrames;
-        m_pbEnd = (m_pbNow = m_pbStart = new Uint8[m_nSampleBufferSize]) + m_nSampleBufferSize;
+        Uint32 uStorage = 1;
+        while (uStorage < uRingSize)
+            uStorage <<= 1;
 
-        TRACE("Sample buffer size = %d samples\n", m_nSampleBufferSize / SAMPLE_BLOCK);
+        uRingMask = uStorage - 1;
+        pbRing = new Uint8[uStorage];
+        uReadPos = uWritePos = 0;
+        fFlush = false;
+        nUnderruns = nOverruns = 0;
+        tLastCallback = {};
+        ResetStats();
+
+        // Allow for the largest rate increase, and the speed setting slowing audio
+        vbResampled.resize((nSamplesPerFrame * 2 * 102 / 100 + 2) * SAMPLE_BLOCK);
+        dResamplePos = 0.0;
+        memset(asLast, 0, sizeof(asLast));
+
+        // Start the callback once the buffer is ready
+        SDL_PauseAudio(0);
+
+        TRACE("Sample buffer size = %u samples, target %d samples\n", uRingSize / SAMPLE_BLOCK, nTargetFill / SAMPLE_BLOCK);
     }
 
     // Sound initialisation failure isn't fatal, so always return success
@@ -75,74 +145,156 @@ void Audio::Exit(bool fReInit_/*=false*/)
 
     ExitSDLSound();
 
+    if (pbRing)
+        TRACE("Audio: %d underruns, %d overruns\n", nUnderruns.load(), nOverruns.load());
+
+    delete[] pbRing;
+    pbRing = nullptr;
+    uRingSize = uRingMask = 0;
+
     TRACE("<- Audio::Exit()\n");
 }
 
-bool Audio::AddData(Uint8* pbData_, int nLength_)
+static void ResetStats()
+{
+    tStatsStart = std::chrono::steady_clock::now();
+    nFillMin = INT_MAX;
+    nFillMax = nFillCount = 0;
+    dFillTotal = dSleepTime = dAudioTime = 0.0;
+    nLastUnderruns = nUnderruns;
+    nLastOverruns = nOverruns;
+    nCallbacks = nMaxJitter = 0;
+}
+
+// Copy data into the ring at the current write position, returning the amount added (producer only)
+static int WriteRing(const Uint8* pb_, int nLength_)
 {
-    int nSpace = 0;
+    Uint32 uWrite = uWritePos.load(std::memory_order_relaxed);
+    Uint32 uSpace = uRingSize - (uWrite - uReadPos.load(std::memory_order_acquire));
+    Uint32 uAdd = std::min(uSpace, static_cast<Uint32>(nLength_));
 
-    // Calculate the frame time (in ms) from the sample data length
-    int nFrameTime = ((nLength_ * 1000 / SAMPLE_BLOCK) + (SAMPLE_FREQ / 2)) / SAMPLE_FREQ;
+    // Copy in up to two parts, either side of the wrap point
+    Uint32 uOffset = uWrite & uRingMask;
+    Uint32 uFirst = std::min(uAdd, uRingMask + 1 - uOffset);
 
-    // Loop until everything has been written
-    while (m_pbNow && nLength_ > 0)
+    if (pb_)
+    {
+        memcpy(pbRing + uOffset, pb_, uFirst);
+        memcpy(pbRing, pb_ + uFirst, uAdd - uFirst);
+    }
+    else
+    {
+        memset(pbRing + uOffset, 0x00, uFirst);
+        memset(pbRing, 0x00, uAdd - uFirst);
+    }
+
+    uWritePos.store(uWrite + uAdd, std::memory_order_release);
+    return static_cast<int>(uAdd);
+}
+
+// Linear resample 16-bit sample frames by the given ratio, returning the output length in bytes.
+// The position carries across calls so blocks join seamlessly.
+static int Resample(const Uint8* pb_, int nLength_, double dRatio_, Uint8* pbOut_, int nMaxOut_)
+{
+    auto psIn = reinterpret_cast<const Sint16*>(pb_);
+    auto psOut = reinterpret_cast<Sint16*>(pbOut_);
+    int nFrames = nLength_ / SAMPLE_BLOCK, nMaxFrames = nMaxOut_ / SAMPLE_BLOCK;
+    double dStep = 1.0 / dRatio_;
+    int nOut = 0;
+
+    // Positions are relative to the final sample of the previous block, at -1
+    for (double dPos = dResamplePos; dPos < nFrames - 1 && nOut < nMaxFrames; dPos += dStep, nOut++)
     {
-        SDL_LockAudio();
+        int nIndex = static_cast<int>(dPos + 1.0) - 1;
+        int nFrac = static_cast<int>((dPos - nIndex) * 65536);
+
+        for (int c = 0; c < SAMPLE_CHANNELS; c++)
+        {
+            int n0 = (nIndex < 0) ? asLast[c] : psIn[nIndex * SAMPLE_CHANNELS + c];
+            int n1 = psIn[(nIndex + 1) * SAMPLE_CHANNELS + c];
+            *psOut++ = static_cast<Sint16>(n0 + (((n1 - n0) * nFrac) >> 16));
+        }
+
+        dResamplePos = dPos + dStep;
+    }
+
+    dResamplePos -= nFrames;
+    for (int c = 0; c < SAMPLE_CHANNELS; c++)
+        asLast[c] = psIn[(nFrames - 1) * SAMPLE_CHANNELS + c];
+
+    return nOut * SAMPLE_BLOCK;
+}
 
-        // Determine the available space
-        nSpace = static_cast<int>(m_pbEnd - m_pbNow);
-        int nAdd = std::min(nSpace, nLength_);
+bool Audio::AddData(Uint8* pbData_, int nLength_)
+{
+    bool fWaited = false;
+
+    // Calculate the frame time from the sample data length, before any rate adjustment
+    std::chrono::duration<double> frame_time(static_cast<double>(nLength_ / SAMPLE_BLOCK) / Sound::GetSampleFreq());
+    std::chrono::duration<double> frame_length(frame_time);
 
-        // Copy as much as we can
-        memcpy(m_pbNow, pbData_, nAdd);
+    if (pbRing && nLength_ >= SAMPLE_BLOCK)
+    {
+        int nFill = GetBufferedBytes();
+        nFillMin = std::min(nFillMin, nFill);
+        nFillMax = std::max(nFillMax, nFill);
+        dFillTotal += nFill;
+        nFillCount++;
+        dAudioTime += frame_time.count();
+
+        // Track the average fill level, which is the latency we're adding
+        dAverageFill += (nFill - dAverageFill) * FILL_SMOOTHING;
+
+        // Lengthen the frame if the device is draining the ring slower than we fill it, or shorten
+        // it if faster, so the device clock paces emulation. Limit it to half a frame either way.
+        double dFillError = (dAverageFill - nTargetFill) / (nSampleFreq * SAMPLE_BLOCK);
+        frame_length += frame_time * std::min(std::max(dFillError * PACE_CORRECTION / frame_time.count(), -0.5), 0.5);
+
+        // Stretch the audio slightly if we're below target, or shrink it if we're above
+        double dError = (nTargetFill - dAverageFill) / nTargetFill;
+        double dRatio = 1.0 + MAX_RATE_ADJUST * std::min(std::max(dError, -1.0), 1.0);
+
+        nLength_ = Resample(pbData_, nLength_, dRatio, vbResampled.data(), static_cast<int>(vbResampled.size()));
+        pbData_ = vbResampled.data();
+    }
+
+    // Loop until everything has been written
+    while (pbRing && nLength_ > 0)
+    {
+        int nAdd = WriteRing(pbData_, nLength_);
 
         // Adjust for what was added
-        m_pbNow += nAdd;
         pbData_ += nAdd;
         nLength_ -= nAdd;
 
-        SDL_UnlockAudio();
-
         // All written?
         if (!nLength_)
             break;
 
+        // Count each frame that found the buffer full
+        if (!fWaited)
+        {
+            nOverruns++;
+            fWaited = true;
+        }
+
         // Wait for more space
         SDL_Delay(1);
     }
 
-    // How long since the frame?
-    Uint32 uNow = SDL_GetTicks();
-    Sint32 nElapsed = static_cast<Sint32>(uNow - uLastTime);
+    auto now = std::chrono::steady_clock::now();
+    auto next_frame = tNextFrame + std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_length);
 
     // If we're too far behind, re-sync
-    if (nElapsed > nFrameTime * 2)
-    {
-        uLastTime = uNow;
-    }
+    if (now > next_frame + frame_time)
+        tNextFrame = now;
     else
     {
-        // If we're falling behind, reduce the delay by 1ms
-        if (nSpace > (SAMPLE_BUFFER_SIZE * SAMPLE_BLOCK))
-            nFrameTime--;
+        // Sleep until the frame is due
+        std::this_thread::sleep_until(next_frame);
+        tNextFrame = next_frame;
 
-        for (;;)
-        {
-            // How long since the last frame?
-            nElapsed = static_cast<Sint32>(SDL_GetTicks() - uLastTime);
-
-            // Have we waited long enough?
-            if (nElapsed >= nFrameTime)
-            {
-                // Adjust for the next frame
-                uLastTime += nFrameTime;
-                break;
-            }
-
-            // Sleep a short time before checking again
-            SDL_Delay(1);
-        }
+        dSleepTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - now).count();
     }
 
     return true;
@@ -150,56 +302,145 @@ bool Audio::AddData(Uint8* pbData_, int nLength_)
 
 void Audio::Silence()
 {
-    if (!IsAvailable())
+    if (!IsAvailable() || !pbRing)
         return;
 
-    SDL_LockAudio();
-    memset(m_pbStart, 0x00, m_pbEnd - m_pbStart);
-    m_pbNow = m_pbEnd;
-    SDL_UnlockAudio();
+    // Ask the callback to discard what's queued, and refill to the target level with silence
+    uFlushPos.store(uWritePos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    fFlush.store(true, std::memory_order_release);
+    WriteRing(nullptr, nTargetFill);
+    dAverageFill = nTargetFill;
+}
+
+int Audio::GetBufferedBytes()
+{
+    return pbRing ? static_cast<int>(uWritePos.load(std::memory_order_acquire) - uReadPos.load(std::memory_order_acquire)) : 0;
+}
+
+// Fetch the statistics since the last call, and start a new period
+bool Audio::GetStats(AUDIO_STATS& stats_)
+{
+    if (!pbRing)
+        return false;
+
+    auto now = std::chrono::steady_clock::now();
+    double dPeriod = std::chrono::duration<double>(now - tStatsStart).count();
+    double dBytesPerMs = nSampleFreq * SAMPLE_BLOCK / 1000.0;
+
+    stats_.dPeriod = dPeriod * 1000.0;
+    stats_.dFillMin = nFillCount ? nFillMin / dBytesPerMs : 0.0;
+    stats_.dFillAvg = nFillCount ? dFillTotal / nFillCount / dBytesPerMs : 0.0;
+    stats_.dFillMax = nFillMax / dBytesPerMs;
+    stats_.nUnderruns = nUnderruns - nLastUnderruns;
+    stats_.nOverruns = nOverruns - nLastOverruns;
+    stats_.nCallbacks = nCallbacks;
+    stats_.dJitter = nMaxJitter / 1000.0;
+    stats_.dSleep = dSleepTime * 1000.0;
+    stats_.dDrift = (dPeriod - dAudioTime) * 1000.0;
+
+    ResetStats();
+    return true;
+}
+
+// Rate the device is playing at, or zero if there's no device
+int Audio::GetSampleFreq()
+{
+    return pbRing ? nSampleFreq : 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 bool InitSDLSound()
 {
-    SDL_AudioSpec sDesired = { };
-    sDesired.freq = SAMPLE_FREQ;
+    SDL_AudioSpec sDesired = { }, sObtained = { };
+    sDesired.freq = Sound::GetSampleFreq();
     sDesired.format = AUDIO_S16LSB;
     sDesired.channels = SAMPLE_CHANNELS;
     sDesired.samples = SAMPLE_BUFFER_SIZE;
     sDesired.callback = SoundCallback;
 
-    if (SDL_OpenAudio(&sDesired, nullptr) < 0)
+    // Without a configured rate the device is free to open at its native rate
+    bool fNative = !GetOption(samplerate);
+
+    if (SDL_OpenAudio(&sDesired, fNative ? &sObtained : nullptr) < 0)
     {
         TRACE("SDL_OpenAudio failed: %s\n", SDL_GetError());
         return false;
     }
 
-    SDL_PauseAudio(0);
+    nSampleFreq = sDesired.freq;
 
+    if (fNative)
+    {
+        // Accept only a rate change we can generate at, otherwise reopen and leave SDL to convert
+        if (sObtained.format == sDesired.format && sObtained.channels == sDesired.channels &&
+            sObtained.freq >= SAMPLE_FREQ_MIN && sObtained.freq <= SAMPLE_FREQ_MAX)
+        {
+            nSampleFreq = sObtained.freq;
+        }
+        else
+        {
+            SDL_CloseAudio();
+
+            if (SDL_OpenAudio(&sDesired, nullptr) < 0)
+            {
+                TRACE("SDL_OpenAudio failed: %s\n", SDL_GetError());
+                return false;
+            }
+        }
+    }
+
+    TRACE("SDL audio opened at %dHz\n", nSampleFreq);
     return true;
 }
 
 void ExitSDLSound()
 {
     SDL_CloseAudio();
-
-    m_pbNow = m_pbStart = m_pbEnd = nullptr;
 }
 
-// Callback used by SDL to request more sound data to play
+// Callback used by SDL to request more sound data to play (consumer only)
 void SoundCallback(void* /*pvParam_*/, Uint8* pbStream_, int nLen_)
 {
-    // Determine how much data we have available, how much to copy, and what is left over
-    int nData = static_cast<int>(m_pbNow - m_pbStart);
-    int nCopy = std::min(nData, nLen_), nLeft = nData - nCopy;
+    // Compare the time since the last callback with the time the last block took to play
+    auto now = std::chrono::steady_clock::now();
+    if (tLastCallback.time_since_epoch().count())
+    {
+        auto interval = std::chrono::duration_cast<std::chrono::microseconds>(now - tLastCallback);
+        int nExpected = static_cast<int>(1000000LL * (nLen_ / SAMPLE_BLOCK) / nSampleFreq);
+        int nJitter = std::abs(static_cast<int>(interval.count()) - nExpected);
+
+        // Keep the largest, allowing for the producer resetting it between reports
+        int nMax = nMaxJitter;
+        while (nJitter > nMax && !nMaxJitter.compare_exchange_weak(nMax, nJitter))
+        {
+        }
+    }
+    tLastCallback = now;
+    nCallbacks++;
+
+    Uint32 uRead = uReadPos.load(std::memory_order_relaxed);
 
-    // Update the sound stream with what we have, padded with silence if we're short
-    memcpy(pbStream_, m_pbStart, nCopy);
-    memset(pbStream_ + nCopy, 0x00, nLen_ - nCopy);
+    // Discard anything queued before a Silence() request
+    if (fFlush.exchange(false, std::memory_order_acquire))
+        uRead = uFlushPos.load(std::memory_order_relaxed);
+
+    // Determine how much data we have available, and how much to copy
+    Uint32 uData = uWritePos.load(std::memory_order_acquire) - uRead;
+    Uint32 uCopy = std::min(uData, static_cast<Uint32>(nLen_));
+
+    // Copy out in up to two parts, either side of the wrap point
+    Uint32 uOffset = uRead & uRingMask;
+    Uint32 uFirst = std::min(uCopy, uRingMask + 1 - uOffset);
+    memcpy(pbStream_, pbRing + uOffset, uFirst);
+    memcpy(pbStream_ + uFirst, pbRing, uCopy - uFirst);
+
+    // Pad with silence if we're short
+    if (uCopy < static_cast<Uint32>(nLen_))
+    {
+        memset(pbStream_ + uCopy, 0x00, nLen_ - uCopy);
+        nUnderruns++;
+    }
 
-    // Move any remaining data to the start of our buffer
-    m_pbNow = m_pbStart + nLeft;
-    memmove(m_pbStart, m_pbStart + nCopy, nLeft);
+    uReadPos.store(uRead + uCopy, std::memory_order_release);
 }
@@ -20,6 +20,8 @@
 
 #pragma once
 
+struct AUDIO_STATS;
+
 class Audio
 {
 public:
@@ -29,6 +31,10 @@ public:
     static bool IsAvailable() { return SDL_GetAudioStatus() == SDL_AUDIO_PLAYING; }
     static bool AddData(Uint8* pbData_, int nLength_);
     static void Silence();
+
+    static int GetBufferedBytes();
+    static int GetSampleFreq();
+    static bool GetStats(AUDIO_STATS& stats_);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -21,6 +21,7 @@
 #include "SimCoupe.h"
 #include "SDL12.h"
 
+#include "Blit.h"
 #include "Frame.h"
 #include "GUI.h"
 #include "Options.h"
@@ -32,6 +33,7 @@
 
 static DWORD aulPalette[N_PALETTE_COLOURS];
 static DWORD aulScanline[N_PALETTE_COLOURS];
+static SDL_Color acPalette[N_PALETTE_COLOURS * 2];
 
 
 SDLSurface::SDLSurface()
@@ -84,6 +86,9 @@ void SDLSurface::Update(CScreen* pScreen_, bool* pafDirty_)
 // Create whatever's needed for actually displaying the SAM image
 void SDLSurface::UpdatePalette()
 {
+    if (!pBack)
+        return;
+
     // Determine the scanline brightness level adjustment, in the range -100 to +100
     int nScanAdjust = GetOption(scanlines) ? (GetOption(scanlevel) - 100) : 0;
     if (nScanAdjust < -100) nScanAdjust = -100;
@@ -97,11 +102,29 @@ void SDLSurface::UpdatePalette()
         const COLOUR* p = &pSAM[i];
         BYTE r = p->bRed, g = p->bGreen, b = p->bBlue;
 
+        if (fIndexed)
+        {
+            // Scanline shades follow the SAM colours in the upper half of the palette
+            SDL_Color* pc = &acPalette[i];
+            pc->r = r, pc->g = g, pc->b = b, pc->unused = 0;
+            AdjustBrightness(r, g, b, nScanAdjust);
+            pc += N_PALETTE_COLOURS;
+            pc->r = r, pc->g = g, pc->b = b, pc->unused = 0;
+            continue;
+        }
+
         aulPalette[i] = SDL_MapRGB(pBack->format, r, g, b);
         AdjustBrightness(r, g, b, nScanAdjust);
         aulScanline[i] = SDL_MapRGB(pBack->format, r, g, b);
     }
 
+    // Let SDL expand the 8-bit back buffer when it's blitted to the display
+    if (fIndexed)
+    {
+        SDL_SetColors(pBack, acPalette, 0, N_PALETTE_COLOURS * 2);
+        bBlackIndex = static_cast<BYTE>(SDL_MapRGB(pBack->format, 0, 0, 0));
+    }
+
     // Ensure the display is redrawn to reflect the changes
     Video::SetDirty();
 }
@@ -121,17 +144,12 @@ bool SDLSurface::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     int nWidth = Frame::GetWidth();
     int nHeight = Frame::GetHeight();
 
-    int nRightHi = nWidth >> 3;
-
     bool fInterlace = !GUI::IsActive();
     if (fInterlace) nHeight >>= 1;
 
     DWORD* pdwBack = reinterpret_cast<DWORD*>(pBack->pixels), * pdw = pdwBack;
     long lPitchDW = pBack->pitch >> (fInterlace ? 1 : 2);
 
-    BYTE* pbSAM = pScreen_->GetLine(0), * pb = pbSAM;
-    long lPitch = pScreen_->GetPitch();
-
     int nShift = fInterlace ? 1 : 0;
     int nDepth = pBack->format->BitsPerPixel;
 
@@ -139,99 +157,80 @@ bool SDLSurface::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     // What colour depth is the target surface?
     switch (nDepth)
     {
-    case 16:
+    case 8:
     {
-        nWidth <<= 1;
+        // Indexed back buffer, so the SAM lines are copied as-is
+        BYTE* pbBack = reinterpret_cast<BYTE*>(pBack->pixels);
+        long lPitchB = pBack->pitch << nShift;
 
-        for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+        for (int y = 0; y < nHeight; pbBack += lPitchB, y++)
         {
             if (!pafDirty_[y])
                 continue;
 
-            for (int x = 0; x < nRightHi; x++)
-            {
-                pdw[0] = SDL_SwapLE32((aulPalette[pb[1]] << 16) | aulPalette[pb[0]]);
-                pdw[1] = SDL_SwapLE32((aulPalette[pb[3]] << 16) | aulPalette[pb[2]]);
-                pdw[2] = SDL_SwapLE32((aulPalette[pb[5]] << 16) | aulPalette[pb[4]]);
-                pdw[3] = SDL_SwapLE32((aulPalette[pb[7]] << 16) | aulPalette[pb[6]]);
+            BYTE* pb = pScreen_->GetLine(y);
 
-                pdw += 4;
-                pb += 8;
-            }
+            memcpy(pbBack, pb, nWidth);
 
             if (fInterlace)
             {
-                pb = pbSAM;
-                pdw = pdwBack + lPitchDW / 2;
+                BYTE* pbScan = pbBack + pBack->pitch;
 
                 if (!GetOption(scanlevel))
-                    memset(pdw, 0x00, nWidth);
+                    memset(pbScan, bBlackIndex, nWidth);
                 else
                 {
-                    for (int x = 0; x < nRightHi; x++)
-                    {
-                        pdw[0] = SDL_SwapLE32((aulScanline[pb[1]] << 16) | aulScanline[pb[0]]);
-                        pdw[1] = SDL_SwapLE32((aulScanline[pb[3]] << 16) | aulScanline[pb[2]]);
-                        pdw[2] = SDL_SwapLE32((aulScanline[pb[5]] << 16) | aulScanline[pb[4]]);
-                        pdw[3] = SDL_SwapLE32((aulScanline[pb[7]] << 16) | aulScanline[pb[6]]);
-
-                        pdw += 4;
-                        pb += 8;
-                    }
+                    for (int x = 0; x < nWidth; x++)
+                        pbScan[x] = pb[x] | N_PALETTE_COLOURS;
                 }
             }
         }
     }
     break;
 
-    case 32:
+    case 16:
     {
-        nWidth <<= 2;
-
-        for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+        for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, y++)
         {
             if (!pafDirty_[y])
                 continue;
 
-            for (int x = 0; x < nRightHi; x++)
+            BYTE* pb = pScreen_->GetLine(y);
+
+            Blit::Line16(pdw, pb, nWidth, aulPalette);
+
+            if (fInterlace)
             {
-                pdw[0] = aulPalette[pb[0]];
-                pdw[1] = aulPalette[pb[1]];
-                pdw[2] = aulPalette[pb[2]];
-                pdw[3] = aulPalette[pb[3]];
-                pdw[4] = aulPalette[pb[4]];
-                pdw[5] = aulPalette[pb[5]];
-                pdw[6] = aulPalette[pb[6]];
-                pdw[7] = aulPalette[pb[7]];
-
-                pdw += 8;
-                pb += 8;
+                pdw = pdwBack + lPitchDW / 2;
+
+                if (!GetOption(scanlevel))
+                    memset(pdw, 0x00, nWidth * 2);
+                else
+                    Blit::Line16(pdw, pb, nWidth, aulScanline);
             }
+        }
+    }
+    break;
+
+    case 32:
+    {
+        for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, y++)
+        {
+            if (!pafDirty_[y])
+                continue;
+
+            BYTE* pb = pScreen_->GetLine(y);
+
+            Blit::Line32(pdw, pb, nWidth, aulPalette);
 
             if (fInterlace)
             {
-                pb = pbSAM;
                 pdw = pdwBack + lPitchDW / 2;
 
                 if (!GetOption(scanlevel))
-                    memset(pdw, 0x00, nWidth);
+                    memset(pdw, 0x00, nWidth * 4);
                 else
-                {
-                    for (int x = 0; x < nRightHi; x++)
-                    {
-                        pdw[0] = aulScanline[pb[0]];
-                        pdw[1] = aulScanline[pb[1]];
-                        pdw[2] = aulScanline[pb[2]];
-                        pdw[3] = aulScanline[pb[3]];
-                        pdw[4] = aulScanline[pb[4]];
-                        pdw[5] = aulScanline[pb[5]];
-                        pdw[6] = aulScanline[pb[6]];
-                        pdw[7] = aulScanline[pb[7]];
-
-                        pdw += 8;
-                        pb += 8;
-                    }
-                }
+                    Blit::Line32(pdw, pb, nWidth, aulScanline);
             }
         }
     }
@@ -306,14 +305,25 @@ void SDLSurface::UpdateSize()
     if (!pFront)
         TRACE("Failed to create front buffer!\n");
 
-    // Create a back buffer in the same format as the front
-    else if (!(pBack = SDL_CreateRGBSurface(SDL_HWSURFACE, nWidth, nHeight, pFront->format->BitsPerPixel,
-        pFront->format->Rmask, pFront->format->Gmask, pFront->format->Bmask, pFront->format->Amask)))
-        TRACE("Can't create back buffer: %s\n", SDL_GetError());
     else
     {
-        // Clear out any garbage from the back surface
-        SDL_FillRect(pBack, nullptr, 0);
+        if (pBack) SDL_FreeSurface(pBack), pBack = nullptr;
+
+        // Prefer an 8-bit back buffer, leaving palette expansion to the blit of the dirty area
+        pBack = SDL_CreateRGBSurface(SDL_SWSURFACE, nWidth, nHeight, 8, 0, 0, 0, 0);
+        fIndexed = pBack != nullptr;
+
+        // Fall back on a back buffer in the same format as the front
+        if (!pBack && !(pBack = SDL_CreateRGBSurface(SDL_HWSURFACE, nWidth, nHeight, pFront->format->BitsPerPixel,
+            pFront->format->Rmask, pFront->format->Gmask, pFront->format->Bmask, pFront->format->Amask)))
+            TRACE("Can't create back buffer: %s\n", SDL_GetError());
+        else
+        {
+            TRACE("Back buffer: %d-bit%s\n", pBack->format->BitsPerPixel, fIndexed ? " (indexed)" : "");
+
+            // Clear out any garbage from the back surface
+            SDL_FillRect(pBack, nullptr, 0);
+        }
     }
 
     UpdatePalette();
@@ -51,6 +51,8 @@ private:
     SDL_Surface* pBack = nullptr;
     SDL_Surface* pIcon = nullptr;
     int nDesktopWidth = 0, nDesktopHeight = 0;
+    bool fIndexed = false;
+    BYTE bBlackIndex = 0;
 
     SDL_Rect m_rTarget{};
 };
@@ -21,6 +21,7 @@
 #include "SimCoupe.h"
 #include "SDL20.h"
 
+#include "Blit.h"
 #include "Frame.h"
 #include "GUI.h"
 #include "Options.h"
@@ -28,6 +29,8 @@
 
 #ifdef HAVE_LIBSDL2
 
+const int MAX_BAND_GAP = 2;     // Clean lines allowed between dirty lines uploaded together
+
 static DWORD aulPalette[N_PALETTE_COLOURS];
 static DWORD aulScanline[N_PALETTE_COLOURS];
 
@@ -177,93 +180,56 @@ bool SDLTexture::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     bool fHalfHeight = !GUI::IsActive();
     if (fHalfHeight) nHeight /= 2;
 
-    int nChangeFrom = 0, nChangeTo = nHeight - 1;
-    for (; nChangeFrom < nHeight && !pafDirty_[nChangeFrom]; nChangeFrom++);
-    if (nChangeFrom == nHeight)
-        return true;
-
-    for (; nChangeTo && !pafDirty_[nChangeTo]; nChangeTo--);
-
     // With bilinear filtering enabled, the GUI display in the lower half bleeds
     // into the bottom line of the display, so clear it when changing modes.
     static bool fLastHalfHeight = true;
     if (fHalfHeight && !fLastHalfHeight)
-        pScreen_->FillRect(0, nChangeTo = nHeight, pScreen_->GetPitch(), 1, BLACK);
-    fLastHalfHeight = fHalfHeight;
-
-    // Lock only the portion we're changing
-    SDL_Rect rLock = { 0, nChangeFrom, nWidth, nChangeTo - nChangeFrom + 1 };
-    void* pvPixels = nullptr;
-    int nPitch = 0;
-
-    // Lock the surface for direct access below
-    if (SDL_LockTexture(m_pTexture, &rLock, &pvPixels, &nPitch) != 0)
     {
-        TRACE("!!! SDL_LockSurface failed: %s\n", SDL_GetError());
-        return false;
+        pScreen_->FillRect(0, nHeight, pScreen_->GetPitch(), 1, BLACK);
+        Video::SetLineDirty(nHeight);
     }
+    fLastHalfHeight = fHalfHeight;
 
-    int nRightHi = nWidth >> 3;
-
-    DWORD* pdwBack = reinterpret_cast<DWORD*>(pvPixels), * pdw = pdwBack;
-    long lPitchDW = nPitch >> 2;
-
-    BYTE* pbSAM = pScreen_->GetLine(nChangeFrom), * pb = pbSAM;
-    long lPitch = pScreen_->GetPitch();
-
+    // The line below a half-height display is included, for the clearing above
+    int nLastLine = fHalfHeight ? nHeight : nHeight - 1;
+    bool fChanged = false;
 
-    // What colour depth is the target surface?
-    switch (m_nDepth)
+    // Upload each band of dirty lines, limited to the columns changed within it
+    for (int y = 0; y <= nLastLine; )
     {
-    case 16:
-    {
-        for (int y = nChangeFrom; y <= nChangeTo; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+        if (!pafDirty_[y])
         {
-            if (!pafDirty_[y])
-                continue;
-
-            for (int x = 0; x < nRightHi; x++)
-            {
-                pdw[0] = SDL_SwapLE32((aulPalette[pb[1]] << 16) | aulPalette[pb[0]]);
-                pdw[1] = SDL_SwapLE32((aulPalette[pb[3]] << 16) | aulPalette[pb[2]]);
-                pdw[2] = SDL_SwapLE32((aulPalette[pb[5]] << 16) | aulPalette[pb[4]]);
-                pdw[3] = SDL_SwapLE32((aulPalette[pb[7]] << 16) | aulPalette[pb[6]]);
-
-                pdw += 4;
-                pb += 8;
-            }
+            y++;
+            continue;
         }
-    }
-    break;
 
-    case 32:
-    {
-        for (int y = nChangeFrom; y <= nChangeTo; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
-        {
-            if (!pafDirty_[y])
-                continue;
+        int nLeft, nRight;
+        Video::GetDirtySpan(y, &nLeft, &nRight);
 
-            for (int x = 0; x < nRightHi; x++)
+        // Extend the band over nearby dirty lines, as each lock has an overhead
+        int nFrom = y, nTo = y;
+        for (int i = y + 1; i <= nLastLine && i - nTo <= MAX_BAND_GAP; i++)
+        {
+            if (pafDirty_[i])
             {
-                pdw[0] = aulPalette[pb[0]];
-                pdw[1] = aulPalette[pb[1]];
-                pdw[2] = aulPalette[pb[2]];
-                pdw[3] = aulPalette[pb[3]];
-                pdw[4] = aulPalette[pb[4]];
-                pdw[5] = aulPalette[pb[5]];
-                pdw[6] = aulPalette[pb[6]];
-                pdw[7] = aulPalette[pb[7]];
-
-                pdw += 8;
-                pb += 8;
+                int nLineLeft, nLineRight;
+                Video::GetDirtySpan(i, &nLineLeft, &nLineRight);
+                nLeft = std::min(nLeft, nLineLeft);
+                nRight = std::max(nRight, nLineRight);
+                nTo = i;
             }
         }
-    }
-    break;
+
+        if (!DrawRect(pScreen_, nLeft, nFrom, nRight - nLeft, nTo - nFrom + 1))
+            return false;
+
+        for (int i = nFrom; i <= nTo; pafDirty_[i++] = false);
+        fChanged = true;
+        y = nTo + 1;
     }
 
-    // Unlock the texture now we're done drawing on it
-    SDL_UnlockTexture(m_pTexture);
+    if (!fChanged)
+        return true;
 
     SDL_Rect rTexture = { 0,0, nWidth, nHeight };
     SDL_Rect rWindow = { 0,0, 0,0 };
@@ -309,6 +275,41 @@ bool SDLTexture::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     return true;
 }
 
+// Convert a rectangle of the SAM screen into the texture
+bool SDLTexture::DrawRect(CScreen* pScreen_, int nX_, int nY_, int nWidth_, int nHeight_)
+{
+    // Lock only the portion we're changing
+    SDL_Rect rLock = { nX_, nY_, nWidth_, nHeight_ };
+    void* pvPixels = nullptr;
+    int nPitch = 0;
+
+    // Lock the surface for direct access below
+    if (SDL_LockTexture(m_pTexture, &rLock, &pvPixels, &nPitch) != 0)
+    {
+        TRACE("!!! SDL_LockSurface failed: %s\n", SDL_GetError());
+        return false;
+    }
+
+    // Locked texture data is write-only, so every line in the rectangle is drawn
+    BYTE* pbBack = reinterpret_cast<BYTE*>(pvPixels);
+
+    for (int y = nY_; y < nY_ + nHeight_; pbBack += nPitch, y++)
+    {
+        BYTE* pb = pScreen_->GetLine(y) + nX_;
+        DWORD* pdw = reinterpret_cast<DWORD*>(pbBack);
+
+        // What colour depth is the target surface?
+        if (m_nDepth == 16)
+            Blit::Line16(pdw, pb, nWidth_, aulPalette);
+        else if (m_nDepth == 32)
+            Blit::Line32(pdw, pb, nWidth_, aulPalette);
+    }
+
+    // Unlock the texture now we're done drawing on it
+    SDL_UnlockTexture(m_pTexture);
+    return true;
+}
+
 void SDLTexture::UpdateSize()
 {
     // Toggle fullscreen state if necessary
@@ -322,6 +323,7 @@ void SDLTexture::UpdateSize()
     int nWidth = Frame::GetWidth();
     int nHeight = Frame::GetHeight();
 
+    // SDL 2.0 rejects palettised textures on all renderers, so we convert to the native format ourselves
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, m_fFilter ? "linear" : "nearest");
     m_pTexture = SDL_CreateTexture(m_pRenderer, SDL_PIXELFORMAT_UNKNOWN, SDL_TEXTUREACCESS_STREAMING, nWidth, nHeight);
 
@@ -45,6 +45,7 @@ public:
 
 protected:
     bool DrawChanges(CScreen* pScreen_, bool* pafDirty_);
+    bool DrawRect(CScreen* pScreen_, int nX_, int nY_, int nWidth_, int nHeight_);
 
 private:
     SDL_Window* m_pWindow = nullptr;
@@ -21,6 +21,8 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+struct AUDIO_STATS;
+
 class Audio
 {
 public:
@@ -29,6 +31,12 @@ public:
 
     static void Silence();
     static bool AddData(BYTE* pb_, int nLen_);
+
+    // DirectSound converts from whatever rate we ask for, so never dictates one
+    static int GetSampleFreq() { return 0; }
+
+    // Statistics aren't gathered for DirectSound
+    static bool GetStats(AUDIO_STATS& /*stats_*/) { return false; }
 };
 
 #endif  // AUDIO_H
@@ -378,18 +378,19 @@ bool Direct3D9Video::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     DWORD* pdwBack = reinterpret_cast<DWORD*>(d3dlr.pBits), * pdw = pdwBack;
     LONG lPitchDW = d3dlr.Pitch >> 2;
 
-    BYTE* pbSAM = pScreen_->GetLine(0), * pb = pbSAM;
-    LONG lPitch = pScreen_->GetPitch();
+    BYTE* pbSAM = nullptr, * pb = nullptr;
 
     int nRightHi = nWidth >> 3;
 
     nWidth <<= 2;
 
-    for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+    for (int y = 0; y < nHeight; pdw = pdwBack += lPitchDW, y++)
     {
         if (!pafDirty_[y])
             continue;
 
+        pb = pbSAM = pScreen_->GetLine(y);
+
         for (int x = 0; x < nRightHi; x++)
         {
             pdw[0] = adwPalette[pb[0]];
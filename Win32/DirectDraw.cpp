@@ -306,8 +306,7 @@ bool DirectDrawVideo::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     DWORD* pdwBack = reinterpret_cast<DWORD*>(ddsd.lpSurface), * pdw = pdwBack;
     LONG lPitchDW = ddsd.lPitch >> 2;
 
-    BYTE* pbSAM = pScreen_->GetLine(0), * pb = pbSAM;
-    LONG lPitch = pScreen_->GetPitch();
+    BYTE* pbSAM = nullptr, * pb = nullptr;
 
     int nDepth = ddsd.ddpfPixelFormat.dwRGBBitCount;
     int nBottom = pScreen_->GetHeight() >> (GUI::IsActive() ? 0 : 1);
@@ -319,11 +318,13 @@ bool DirectDrawVideo::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     {
         nWidth <<= 1;
 
-        for (int y = 0; y < nBottom; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+        for (int y = 0; y < nBottom; pdw = pdwBack += lPitchDW, y++)
         {
             if (!pafDirty_[y])
                 continue;
 
+            pb = pbSAM = pScreen_->GetLine(y);
+
             for (int x = 0; x < nRightHi; x++)
             {
                 // Draw 8 pixels at a time
@@ -363,11 +364,13 @@ bool DirectDrawVideo::DrawChanges(CScreen* pScreen_, bool* pafDirty_)
     {
         nWidth <<= 2;
 
-        for (int y = 0; y < nBottom; pdw = pdwBack += lPitchDW, pb = pbSAM += lPitch, y++)
+        for (int y = 0; y < nBottom; pdw = pdwBack += lPitchDW, y++)
         {
             if (!pafDirty_[y])
                 continue;
 
+            pb = pbSAM = pScreen_->GetLine(y);
+
             for (int x = 0; x < nRightHi; x++)
             {
                 pdw[0] = aulPalette[pb[0]];